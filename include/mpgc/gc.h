@@ -141,6 +141,14 @@ namespace mpgc {
       in_use_current += bytes;
       n_objects_current++;
     }
+    void marked(const offset_ptr<const gc_allocated> &p, std::size_t count) {
+      std::size_t bytes = p->get_gc_descriptor().object_size()*8;
+      in_use_current += bytes*count;
+      n_objects_current += count;
+    }
+    void grew(std::size_t words) {
+      in_use_current += words*8;
+    }
   };
 
   struct persistent_root_key {
@@ -322,9 +330,9 @@ namespace mpgc {
   };
 
   struct gc_control_block {
-    //We need 1 bit in expansion_slots_total below. So if the size of array
+    //We need 1 bit in expansion_slots_total below. So if the number of expansion slots
     //below needs to be larger than (1<<15), then use a type for the counter accordingly.
-    std::array<gc_allocator::skiplist, 2> global_free_lists;
+    std::array<gc_allocator::sharded_skiplist, 2> global_free_lists;
     gc_allocator::bump_allocation_slots bump_alloc_slots;
 
     persistent_roots_t persistent_roots;
@@ -351,6 +359,26 @@ namespace mpgc {
 
     std::atomic<Stage> stage;
 
+    /*
+     * A heap file can only be used by code that lays out the control
+     * block the way it was written, so the block records a magic number
+     * and a format version, checked when the heap is mapped.  Anything
+     * that changes the layout (of the free lists, say) has to bump
+     * format_version.  (Version 1, which had no magic, had a single
+     * skiplist per cycle.)  They go at the end rather than the start:
+     * the first free list's head node has to stay at offset zero, where
+     * a stale pointer to it reads as null to the marker.
+     */
+    constexpr static std::uint32_t format_magic = 0x6370676d;
+    constexpr static std::uint32_t format_version = 2;
+
+    std::uint32_t magic;
+    std::uint32_t version;
+
+    bool has_current_format() const {
+      return magic == format_magic && version == format_version;
+    }
+
     gc_control_block(std::size_t size, uint8_t* after_cblock) :
       bump_alloc_slots(after_cblock),
       bitmap(size),
@@ -359,7 +387,9 @@ namespace mpgc {
       marking_barrier(marking_barrier_type(Barrier_stage::incrementing, Barrier_indices::marking1)),
       weak_stage(0),
       status(gc_status(gc_handshake::Signum::sigSweep)),
-      stage(Stage::Sweeped)
+      stage(Stage::Sweeped),
+      magic(format_magic),
+      version(format_version)
     {
       std::size_t size_bump_slots_block = bump_alloc_slots.sentinel[0]->get_gc_descriptor().object_size() << 3;
       std::size_t* first_free_word = reinterpret_cast<std::size_t*>(after_cblock + size_bump_slots_block);
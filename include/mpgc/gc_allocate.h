@@ -29,6 +29,9 @@
 
 #include <utility>
 #include <iterator>
+#include <tuple>
+#include <limits>
+#include <new>
 
 #include "mpgc/gc_skiplist_allocator.h"
 #include "mpgc/gc_ptr.h"
@@ -40,6 +43,17 @@ namespace mpgc {
 
   extern gc_handshake::in_memory_thread_struct& allocation_prologue();
   extern void allocation_epilogue(gc_handshake::in_memory_thread_struct&, void*, gc_token&, std::size_t);
+  extern void allocation_epilogue_n(gc_handshake::in_memory_thread_struct&, void*, gc_token&,
+                                    std::size_t, std::size_t);
+  extern bool extend_in_place(void*, std::size_t, std::size_t, gc_token&, std::size_t);
+
+  /*
+   * The largest n for which n objects of type T fit in a size_t.
+   */
+  template <typename T>
+  constexpr std::size_t max_batch_count() {
+    return std::numeric_limits<std::size_t>::max() / sizeof(T);
+  }
 
   class gc_managed_placement_t {};
   static const gc_managed_placement_t in_gc_managed_space;
@@ -48,6 +62,8 @@ namespace mpgc {
   class gc_allocator__ {
     template <typename X, typename ...Args>
     friend gc_ptr<X> make_gc(Args&&...args);
+    template <typename X, typename Fn, typename Sink>
+    friend void make_gc_n(std::size_t n, Fn &&ctor_args_fn, Sink &&sink);
     template <typename X> friend class gc_allocator__;
 
     static void check_descriptor() {
@@ -55,10 +71,13 @@ namespace mpgc {
       desc_for<T>();
     }
 
-    template <typename ...Args>
-    gc_ptr<T> allocate(Args&&...args) {
-      //      check_descriptor();
-      gc_descriptor valdesc = desc_for<T>();
+    /*
+     * Check that the descriptor agrees with sizeof(T).  This decodes
+     * the descriptor, so it's only done once per type, on the first
+     * allocation, rather than on every allocation.
+     */
+    static bool validate_descriptor() {
+      const gc_descriptor &valdesc = desc_for<T>();
       std::size_t vdsize = valdesc.object_size();
       if (vdsize * 8 != sizeof(T)) {
         std::cout << "Obj desc says "
@@ -66,19 +85,71 @@ namespace mpgc {
                   << sizeof(T) << " bytes" << std::endl;
         valdesc.trace(typeid(T).name());
       }
-      assert(valdesc.object_size()*8 == sizeof(T));
-      gc_token tok(valdesc);
+      assert(vdsize*8 == sizeof(T));
+      return vdsize*8 == sizeof(T);
+    }
+
+    template <typename ...Args>
+    gc_ptr<T> allocate(Args&&...args) {
+      static_assert(sizeof(T) % sizeof(gc_descriptor) == 0,
+                    "Object size is not a whole number of words");
       static_assert(is_collectible<T>::value,
                     "Has non-trivial destructor and no is_collectible<T> specialization");
+      static const bool validated __attribute__((unused)) = validate_descriptor();
+      gc_token tok(desc_for<T>());
 
       gc_handshake::in_memory_thread_struct& ts = allocation_prologue();
-      void *ptr = gc_allocator::alloc(ts, sizeof(T), alignof(T));
+      void *ptr = gc_allocator::alloc(ts, sizeof(T), alignof(T), !self_initializing<T>::value);
       allocation_epilogue(ts, ptr, tok, 0);
 
       auto res = new (ptr) T(tok, std::forward<Args>(args)...);
       assert(&(res->get_gc_descriptor()) == ptr);
+      dirty_tracking::note(res, sizeof(T));
       return gc_ptr_from_bare_ptr(res);
     }
+
+    template <typename Tuple, std::size_t ...I>
+    static T *construct_from(void *ptr, gc_token &tok, Tuple &&args, std::index_sequence<I...>) {
+      return new (ptr) T(tok, std::get<I>(std::forward<Tuple>(args))...);
+    }
+
+    /*
+     * Carve n objects out of one chunk. ctor_args_fn(i) returns a tuple
+     * of constructor args for the ith object, and sink(i, ptr) is
+     * handed each object once it has been constructed.
+     */
+    template <typename Fn, typename Sink>
+    void allocate_n(std::size_t n, Fn &&ctor_args_fn, Sink &&sink) {
+      static_assert(sizeof(T) % sizeof(gc_descriptor) == 0,
+                    "Object size is not a whole number of words");
+      static_assert(is_collectible<T>::value,
+                    "Has non-trivial destructor and no is_collectible<T> specialization");
+      static const bool validated __attribute__((unused)) = validate_descriptor();
+      if (n == 0) {
+        return;
+      }
+      // n * sizeof(T) would wrap around to a too-small chunk.
+      if (n > max_batch_count<T>()) {
+        throw std::bad_array_new_length();
+      }
+      gc_token tok(desc_for<T>());
+
+      gc_handshake::in_memory_thread_struct& ts = allocation_prologue();
+      void *ptr = gc_allocator::alloc(ts, n * sizeof(T), alignof(T), !self_initializing<T>::value);
+      // The objects are the sink's responsibility once this goes out of scope.
+      gc_handshake::pending_batch_scope batch_scope(ts);
+      allocation_epilogue_n(ts, ptr, tok, sizeof(T), n);
+
+      uint8_t *p = static_cast<uint8_t*>(ptr);
+      for (std::size_t i = 0; i < n; i++, p += sizeof(T)) {
+        auto &&args = ctor_args_fn(i);
+        using tuple_type = std::decay_t<decltype(args)>;
+        T *res = construct_from(p, tok, std::forward<decltype(args)>(args),
+                                std::make_index_sequence<std::tuple_size<tuple_type>::value>{});
+        sink(i, gc_ptr_from_bare_ptr(res));
+      }
+      dirty_tracking::note(ptr, n * sizeof(T));
+    }
   };
   template <typename T>
   class gc_allocator__<gc_array<T>> {
@@ -87,17 +158,49 @@ namespace mpgc {
     using size_type = typename array_type::size_type;
     template <typename X, typename ...Args>
     friend gc_ptr<X> make_gc(Args&&...args);
+    template <typename X>
+    friend bool grow_in_place(gc_array<X> &arr, std::size_t n);
 
     static void check_descriptor() {
       gc_allocator__<T>::check_descriptor();
     }
     
-    static void *allocate_space_for(gc_handshake::in_memory_thread_struct &ts, size_type n) {
+    static std::size_t words_for(size_type n) {
+      return gc_allocator::align_size_up(sizeof(gc_array_base)+n*sizeof(value_type),
+                                         sizeof(std::size_t)) / sizeof(std::size_t);
+    }
+
+    static void *allocate_space_for(gc_handshake::in_memory_thread_struct &ts, size_type n,
+                                    bool zero) {
       std::size_t sz = sizeof(gc_array_base)+n*sizeof(value_type);
-      return gc_allocator::alloc(ts, sz, alignof(T));
+      return gc_allocator::alloc(ts, sz, alignof(T), zero);
+    }
+
+    static bool grow_in_place(array_type &arr, size_type n) {
+      // The new elements will just be zero.
+      if (!zero_init_okay<value_type>::value) {
+        return false;
+      }
+      assert(n > arr.size());
+      gc_descriptor valdesc = desc_for<value_type>();
+      gc_token tok(valdesc.in_array<value_type>(n));
+      if (!extend_in_place(&arr, words_for(arr.size()), words_for(n), tok, n)) {
+        return false;
+      }
+      dirty_tracking::note(&arr, words_for(n) * sizeof(std::size_t));
+      return true;
+    }
+
+    /*
+     * When every element gets copied in, there's no need to zero
+     * the elements first unless they can hold references.
+     */
+    static gc_ptr<array_type> constructed(array_type *bp, size_type n) {
+      dirty_tracking::note(bp, words_for(n) * sizeof(std::size_t));
+      return gc_ptr_from_bare_ptr(bp);
     }
 
-    std::pair<void *, gc_token> allocate_(std::size_t n) 
+    std::pair<void *, gc_token> allocate_(std::size_t n, bool copying_all = false)
     {
       check_descriptor();
       assert(n > 0);
@@ -105,7 +208,7 @@ namespace mpgc {
       gc_token tok(valdesc.in_array<value_type>(n));
 
       gc_handshake::in_memory_thread_struct& ts = allocation_prologue();
-      void *ptr = allocate_space_for(ts, n);
+      void *ptr = allocate_space_for(ts, n, !(copying_all && self_initializing<value_type>::value));
       allocation_epilogue(ts, ptr, tok, n);
       return std::make_pair(ptr, tok);
     }
@@ -116,7 +219,7 @@ namespace mpgc {
       }
       auto pair = allocate_(n);
       array_type *bp = new (pair.first) array_type(pair.second, n);
-      gc_ptr<array_type> p = gc_ptr_from_bare_ptr(bp);
+      gc_ptr<array_type> p = constructed(bp, n);
       //assert(p->get_gc_descriptor().object_size()*8
       //	     == (sizeof(gc_array_base)
       //		 + gc_allocator::align_size_up(n*sizeof(value_type), 8)));
@@ -136,9 +239,9 @@ namespace mpgc {
         return nullptr;
       }
       size_type n = std::distance(from, to);
-      auto pair = allocate_(n);
+      auto pair = allocate_(n, true);
       array_type *bp = new (pair.first) array_type(pair.second, n, from, n);
-      gc_ptr<array_type> p = gc_ptr_from_bare_ptr(bp);
+      gc_ptr<array_type> p = constructed(bp, n);
       return p;
     }
 
@@ -154,12 +257,25 @@ namespace mpgc {
       } else if (k > n) {
         k = n;
       }
-      auto pair = allocate_(n);
+      auto pair = allocate_(n, k == n);
       array_type *bp = new (pair.first) array_type(pair.second, n, from, k);
-      gc_ptr<array_type> p = gc_ptr_from_bare_ptr(bp);
+      gc_ptr<array_type> p = constructed(bp, n);
       return p;
     }
 
+    /*
+     * A new array of n elements, starting with the first k of from.
+     */
+    gc_ptr<array_type> allocate(size_type n, const array_type &from, size_type k)
+    {
+      if (k == 0) {
+        return allocate(n);
+      }
+      auto pair = allocate_(n, k == n);
+      array_type *bp = new (pair.first) array_type(pair.second, n, from, k);
+      return constructed(bp, n);
+    }
+
   };
   /*
    * Allocate a T, perfect forwarding args as ctor parameters, along with an allocator reference.
@@ -172,6 +288,24 @@ namespace mpgc {
     gc_allocator__<T> a;
     return a.allocate(std::forward<Args>(args)...);
   }
+
+  /*
+   * Allocate n Ts in one contiguous chunk.  The allocation prologue
+   * and epilogue (and black marking, if needed) are done once for the
+   * whole batch.  ctor_args_fn(i) must return a std::tuple of the ctor
+   * parameters for the ith object (std::forward_as_tuple() is fine as
+   * long as the referents outlive the call), and sink(i, ptr) gets each
+   * object as soon as it's constructed.  Everything in the batch is kept
+   * alive until make_gc_n() returns, so the sink should store the
+   * pointers somewhere reachable.
+   */
+  template <typename T, typename Fn, typename Sink>
+  inline
+  void make_gc_n(std::size_t n, Fn &&ctor_args_fn, Sink &&sink) {
+    gc_allocator__<T> a;
+    a.allocate_n(n, std::forward<Fn>(ctor_args_fn), std::forward<Sink>(sink));
+  }
+
   template <typename T>
   inline
   gc_ptr<gc_array<T>> make_gc_array(std::size_t n) {
@@ -191,6 +325,38 @@ namespace mpgc {
     return make_gc<gc_array<T>>(n, std::forward<Iter>(from), std::forward<Iter>(to));
   }
 
+  /*
+   * Like make_gc_n() above, but collects pointers to the objects in a
+   * new gc_array.
+   */
+  template <typename T, typename Fn>
+  inline
+  gc_array_ptr<gc_ptr<T>> make_gc_n(std::size_t n, Fn &&ctor_args_fn) {
+    // Fail before allocating the array, not after.
+    if (n > max_batch_count<T>()) {
+      throw std::bad_array_new_length();
+    }
+    gc_array_ptr<gc_ptr<T>> res = make_gc_array<gc_ptr<T>>(n);
+    make_gc_n<T>(n, std::forward<Fn>(ctor_args_fn),
+                 [&res](std::size_t i, const gc_ptr<T> &p) {
+                   res[i] = p;
+                 });
+    return res;
+  }
+
+  /*
+   * Try to grow arr to n elements without moving it, by taking the
+   * free space that immediately follows it, if this thread has that
+   * space in its local free list.  The new elements are zero.  This
+   * only works for element types that zero is a fine value for, and
+   * not while the GC is marking.  Returns false if it didn't happen.
+   */
+  template <typename T>
+  inline
+  bool grow_in_place(gc_array<T> &arr, std::size_t n) {
+    return gc_allocator__<gc_array<T>>::grow_in_place(arr, n);
+  }
+
   template <typename T>
   inline
   auto as_bare_pointer(const gc_ptr<T> &p) {
@@ -33,6 +33,7 @@
 #include <memory>
 #include <stdexcept>
 #include <algorithm>
+#include <cstring>
 #include "mpgc/gc_allocated.h"
 
 namespace mpgc {
@@ -301,6 +302,33 @@ public:
         }
       }
     }
+    /*
+     * Copy the first n_to_copy elements of another array (as when
+     * growing it).  This is construction into a fresh array, so
+     * there are no write barriers, and we can skip the iterators and
+     * memcpy() when the elements allow it.
+     */
+    gc_array(gc_token &gc, size_type n, const gc_array &from, size_type n_to_copy)
+      : gc_array_base(gc, n),
+	_first_value(from._first_value)
+    {
+      assert(n_to_copy > 0);
+      assert(n_to_copy <= n && n_to_copy <= from.size());
+      const value_type *src = &from._first_value+1;
+      value_type *p = &_first_value+1;
+      if (bitwise_copy_okay<value_type>::value) {
+        std::memcpy(static_cast<void*>(p), static_cast<const void*>(src),
+                    (n_to_copy-1)*sizeof(value_type));
+        p += n_to_copy-1;
+      } else {
+        p = std::uninitialized_copy_n(src, n_to_copy-1, p);
+      }
+      if (!zero_init_okay<value_type>::value) {
+        for (size_type i=n_to_copy; i<n; i++) {
+          new (p++) value_type;
+        }
+      }
+    }
     /*
      * And other ctors copying and working from iterators
      * Probably op=, as well.
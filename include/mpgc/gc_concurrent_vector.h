@@ -0,0 +1,294 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the 
+ *  Application containing code generated by the Library and added to the 
+ *  Application during this compilation process under terms of your choice, 
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+/*
+ * gc_concurrent_vector.h
+ *
+ * An append-only vector in the GC heap that any number of threads
+ * (in any number of processes) can push_back() to and read from
+ * without locking.
+ *
+ * The elements are in segments, each twice the size of the one
+ * before, so nothing is ever copied or moved once it's been added.
+ * An append reserves an index by bumping _reserved, installs the
+ * index's segment if nobody has yet (the losers of the race just
+ * drop theirs), writes the element, and marks its slot ready.  The
+ * size() readers see is _published, which everybody who appends
+ * pushes forward over the ready slots, so it only ever covers
+ * elements that are completely written.  An element beyond size()
+ * can still be read with try_get() once its slot is ready.
+ *
+ * If a process dies between reserving an index and marking it
+ * ready, size() stays below that index until somebody calls
+ * recover(), which gives up on every index that's reserved but not
+ * ready.  Marking a slot ready or given up is a CAS, so an appender
+ * that's merely slow loses the race, finds out, and moves its value
+ * to a fresh index.  Indexes that were given up on are holes: they
+ * count toward size(), but they hold no element.
+ */
+
+#ifndef GC_CONCURRENT_VECTOR_H_
+#define GC_CONCURRENT_VECTOR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <utility>
+#include <tuple>
+#include <algorithm>
+#include <cassert>
+
+#include "mpgc/gc.h"
+
+namespace mpgc {
+  template <typename T>
+  struct concurrent_vector_slot {
+    constexpr static std::uint8_t unready = 0;
+    constexpr static std::uint8_t ready = 1;
+    constexpr static std::uint8_t abandoned = 2;
+
+    T value;
+    std::atomic<std::uint8_t> state;
+
+    static const auto &descriptor() {
+      static gc_descriptor d =
+	GC_DESC(concurrent_vector_slot)
+	.template WITH_FIELD(&concurrent_vector_slot::value)
+	.template WITH_FIELD(&concurrent_vector_slot::state);
+      return d;
+    }
+  };
+
+  template <typename T>
+  constexpr std::uint8_t concurrent_vector_slot<T>::unready;
+  template <typename T>
+  constexpr std::uint8_t concurrent_vector_slot<T>::ready;
+  template <typename T>
+  constexpr std::uint8_t concurrent_vector_slot<T>::abandoned;
+
+  template <typename T>
+  struct zero_init_okay<concurrent_vector_slot<T>> : zero_init_okay<T> {};
+
+  template <typename T>
+  class gc_concurrent_vector : public gc_allocated {
+  public:
+    using value_type = T;
+    using size_type = std::size_t;
+    constexpr static size_type n_segments = 48;
+  private:
+    using slot_type = concurrent_vector_slot<T>;
+    using segment_ptr = gc_array_ptr<slot_type>;
+    using atomic_segment_ptr = std::atomic<segment_ptr>;
+
+    const size_type _first_segment_size;
+    const gc_array_ptr<atomic_segment_ptr> _segments;
+    std::atomic<size_type> _reserved{0};
+    std::atomic<size_type> _published{0};
+
+    /*
+     * Segment s holds _first_segment_size << s elements, starting at
+     * _first_segment_size * (2^s - 1).
+     */
+    std::pair<size_type, size_type> locate(size_type i) const {
+      std::uint64_t q = i/_first_segment_size + 1;
+      size_type s = 63-__builtin_clzll(q);
+      return std::make_pair(s, i - _first_segment_size*((size_type{1} << s) - 1));
+    }
+
+    segment_ptr segment(size_type s) {
+      assert(s < n_segments);
+      atomic_segment_ptr &ap = _segments[s];
+      segment_ptr seg = ap.load();
+      if (seg == nullptr) {
+        segment_ptr fresh = make_gc_array<slot_type>(_first_segment_size << s);
+        seg = ap.compare_exchange_strong(seg, fresh) ? fresh : seg;
+      }
+      return seg;
+    }
+
+    const slot_type *find_slot(size_type i) const {
+      size_type s, offset;
+      std::tie(s, offset) = locate(i);
+      assert(s < n_segments);
+      segment_ptr seg = _segments[s].load();
+      return seg == nullptr ? nullptr : &(*seg)[offset];
+    }
+
+    slot_type &slot_at(size_type i) {
+      size_type s, offset;
+      std::tie(s, offset) = locate(i);
+      return (*segment(s))[offset];
+    }
+
+    std::uint8_t state(size_type i) const {
+      const slot_type *slot = find_slot(i);
+      return slot == nullptr ? slot_type::unready : slot->state.load(std::memory_order_acquire);
+    }
+
+    /*
+     * Moves _published over every slot that's either ready or been
+     * given up on.
+     */
+    void publish() {
+      size_type p = _published.load();
+      while (state(p) != slot_type::unready) {
+        if (_published.compare_exchange_weak(p, p+1)) {
+          p++;
+        }
+      }
+    }
+
+    static bool settle(slot_type &slot, std::uint8_t to) {
+      std::uint8_t expected = slot_type::unready;
+      return slot.state.compare_exchange_strong(expected, to, std::memory_order_acq_rel);
+    }
+
+    template <typename Fn>
+    size_type append(Fn &&fill) {
+      size_type i = _reserved.fetch_add(1);
+      slot_type *slot = &slot_at(i);
+      std::forward<Fn>(fill)(slot->value);
+      while (!settle(*slot, slot_type::ready)) {
+        // recover() gave up on this index, so the value moves to a new one.
+        i = _reserved.fetch_add(1);
+        slot_type *next = &slot_at(i);
+        next->value = std::move(slot->value);
+        slot = next;
+      }
+      publish();
+      return i;
+    }
+
+  public:
+    explicit gc_concurrent_vector(gc_token &gc, size_type first_segment_size = 16)
+      : gc_allocated{gc},
+        _first_segment_size{first_segment_size == 0 ? 1 : first_segment_size},
+        _segments{make_gc_array<atomic_segment_ptr>(n_segments)}
+    {}
+
+    static const auto &descriptor() {
+      static gc_descriptor d =
+	GC_DESC(gc_concurrent_vector)
+	.template WITH_FIELD(&gc_concurrent_vector::_first_segment_size)
+	.template WITH_FIELD(&gc_concurrent_vector::_segments)
+	.template WITH_FIELD(&gc_concurrent_vector::_reserved)
+	.template WITH_FIELD(&gc_concurrent_vector::_published);
+      return d;
+    }
+
+    /*
+     * Returns the index the value went in at.
+     */
+    size_type push_back(const T &val) {
+      return append([&val](T &slot) { slot = val; });
+    }
+
+    size_type push_back(T &&val) {
+      return append([&val](T &slot) { slot = std::move(val); });
+    }
+
+    /*
+     * The number of indexes known to be settled.  Every index below it
+     * can be read with operator[], unless recover() gave up on it.
+     */
+    size_type size() const {
+      return _published.load(std::memory_order_acquire);
+    }
+
+    bool empty() const {
+      return size() == 0;
+    }
+
+    /*
+     * The number of indexes handed out, some of which may not be
+     * written yet.
+     */
+    size_type reserved() const {
+      return _reserved.load();
+    }
+
+    const T &operator[](size_type i) const {
+      assert(i < size() && state(i) == slot_type::ready);
+      return find_slot(i)->value;
+    }
+
+    /*
+     * Gives up on every index that's been reserved (as of the call) but
+     * isn't ready, so that size() can move past indexes whose appenders
+     * died.  It's safe to call at any time, since a live appender whose
+     * index is given up on just takes another, but appends in progress
+     * will be renumbered, so it's meant for when a process is known (or
+     * suspected) to have died.  Returns the number of indexes given up
+     * on.
+     */
+    size_type recover() {
+      size_type end = _reserved.load();
+      size_type n = 0;
+      for (size_type i = _published.load(); i < end; i++) {
+        if (settle(slot_at(i), slot_type::abandoned)) {
+          n++;
+        }
+      }
+      publish();
+      return n;
+    }
+
+    /*
+     * Reads the element at i, if it's been written, whether or not
+     * it's been published.
+     */
+    bool try_get(size_type i, T &out) const {
+      const slot_type *slot = find_slot(i);
+      if (slot == nullptr || slot->state.load(std::memory_order_acquire) != slot_type::ready) {
+        return false;
+      }
+      out = slot->value;
+      return true;
+    }
+
+    /*
+     * Calls fn(i, val) for each element below size() (as of the
+     * call), in order, skipping indexes that were given up on.
+     */
+    template <typename Fn>
+    void for_each(Fn &&fn) const {
+      size_type n = size();
+      for (size_type s = 0, start = 0; start < n; s++) {
+        segment_ptr seg = _segments[s].load();
+        size_type end = std::min(n, start + (_first_segment_size << s));
+        for (size_type i = start; i < end; i++) {
+          const slot_type &slot = (*seg)[i-start];
+          if (slot.state.load(std::memory_order_acquire) == slot_type::ready) {
+            fn(i, static_cast<const T &>(slot.value));
+          }
+        }
+        start = end;
+      }
+    }
+  };
+}
+
+#endif /* GC_CONCURRENT_VECTOR_H_ */
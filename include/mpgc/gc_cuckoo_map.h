@@ -35,6 +35,7 @@
 #define GC_CUCKOO_MAP_H_
 
 #include <cstdint>
+#include <algorithm>
 #include <random>
 #include <atomic>
 #include <memory>
@@ -106,6 +107,8 @@ namespace mpgc {
     constexpr static std::size_t n_tables = 2;
     constexpr static std::size_t n_seg_bits = SegBits;
     constexpr static std::size_t max_eviction_depth = 8;
+    // Segment growth hands out slots to helpers in blocks of this many.
+    constexpr static std::size_t migration_block_slots = 512;
     constexpr static std::size_t default_initial_segment_bits = 10;
     constexpr static std::size_t max_segment_slot_bits = 64-n_seg_bits;
     constexpr static std::size_t default_cap = 1 << (n_seg_bits + default_initial_segment_bits);
@@ -206,7 +209,25 @@ namespace mpgc {
       const std::size_t _mask = _size-1;
       gc_array_ptr<atomic_entry_ptr_type> _slots{_size};
       std::atomic<pointer<segment>> _replacement{nullptr};
+      // The next migration block to claim when this segment is being replaced.
       mutable std::atomic<std::size_t> _next_to_migrate{0};
+      /*
+       * Entries put in this segment less entries cleared from it.
+       * Only used to estimate size(), so it's updated relaxed.
+       */
+      std::atomic<std::ptrdiff_t> _count{0};
+
+      /*
+       * When this segment replaces a prior one, a flag for each
+       * migration block of the prior, set once the block has been
+       * copied, and the number of blocks not yet copied.
+       */
+      std::atomic<gc_array_ptr<std::atomic<bool>>> _migrated{nullptr};
+      std::atomic<std::size_t> _blocks_left{0};
+
+      void count_change(std::ptrdiff_t delta) {
+        _count.fetch_add(delta, std::memory_order_relaxed);
+      }
 
       friend class table;
       friend class gc_cuckoo_map;
@@ -256,6 +277,7 @@ namespace mpgc {
         //  due to a process crash immediately following removal of
         //  the "moving" flag.  (At least when evicting)
         if (ur) {
+          count_change(1);
           return true;
         } else if (ur.prior_value[frozen]) {
           pointer<segment> new_seg = help_with_grow();
@@ -331,6 +353,9 @@ namespace mpgc {
 	   */
           return false;
         }
+        if (ur.prior_value.pointer() == nullptr) {
+          count_change(1);
+        }
 
         // Check to make sure the old value wasn't deleted since we read it.
         entry_ptr_type sp = source.contents();
@@ -380,10 +405,9 @@ namespace mpgc {
         // At the end it will be installed.
       }
 
-      pointer<segment> help_with_grow() const {
-        pointer<segment> r = _replacement;
+      void migrate(const pointer<segment> &r, std::size_t from, std::size_t to) const {
         segment *nc_this = const_cast<segment *>(this);
-        for (std::size_t i = _next_to_migrate; i < _size; /* update at end */) {
+        for (std::size_t i = from; i < to; i++) {
           // We're okay with casting away constness to freeze the slot.
           atomic_entry_ptr_type &slot = nc_this->_slots[i];
           auto ur = slot.template set_flag(frozen);
@@ -412,19 +436,63 @@ namespace mpgc {
             // So instead we try to replace the initial null with this
             // value.  If it fails, that means that somebody else did
             // it.
-            r->_slots[i].change(nullptr, ep);
+            if (r->_slots[i].change(nullptr, ep)) {
+              r->count_change(1);
+            }
+          }
+        }
+      }
+
+      void migrate_block(const pointer<segment> &r, std::size_t b,
+                         gc_array_ptr<std::atomic<bool>> flags) const {
+        std::size_t from = b * migration_block_slots;
+        migrate(r, from, std::min(from + migration_block_slots, _size));
+        if (!flags[b].exchange(true)) {
+          r->_blocks_left--;
+        }
+      }
+
+      /*
+       * Helpers claim blocks of migration_block_slots slots, one CAS
+       * per block.  Once all blocks are claimed, a helper copies any
+       * block that isn't finished yet, since its claimer may still be
+       * working on it or may have died.  Copying a slot twice is
+       * harmless.
+       */
+      pointer<segment> help_with_grow() const {
+        pointer<segment> r = _replacement;
+        // The flags are dropped once the grow is installed, but we
+        // keep them alive while we're using them.
+        gc_array_ptr<std::atomic<bool>> flags = r->_migrated.load();
+        if (flags != nullptr) {
+          std::size_t n_blocks = flags->size();
+          for (std::size_t b = _next_to_migrate.fetch_add(1); b < n_blocks;
+               b = _next_to_migrate.fetch_add(1))
+          {
+            migrate_block(r, b, flags);
+          }
+          if (r->_blocks_left != 0) {
+            for (std::size_t b = 0; b < n_blocks; b++) {
+              if (!flags[b]) {
+                migrate_block(r, b, flags);
+              }
+            }
           }
-	  i = ruts::increment_to_at_least(_next_to_migrate, i+1).resulting_value();
         }
         // Now everything has been moved.  We might be the first to have finished (or the
         // one who was might have died before installing), so we'll try to install.
+        segment *nc_this = const_cast<segment *>(this);
         ruts::cas_loop_return_value<pointer<segment>>
           install_res = ruts::try_change_value(_table->_segments[_num], this_as_gc_ptr(nc_this), r);
         // If that failed, somebody else got there first... and we might even have grown
         // again.  But that's okay.  We've completed this grow.
-        // Even if it succeeded, we can't delete the old one yet, because others are using it.
-        // So we'll drop it on the floor for now.  Eventually, we'll probably need to use
-        // hazard pointers.
+        if (install_res.succeeded) {
+          // Nothing in the map refers to this segment any more, and the
+          // replacement doesn't point back to it, so the GC can reclaim it
+          // (and its slots) as soon as the threads that are still looking
+          // at it let go.  The migration flags are no longer needed either.
+          r->_migrated.store(nullptr);
+        }
         // In any case, we return the currently-installed segment.
         return install_res.resulting_value();
       }
@@ -445,6 +513,9 @@ namespace mpgc {
       {
 //        std::cerr << "--- Growing segment " << prior << " (" << prior->_slot_bits << ") "
 //            << "into " << this << " (" << _slot_bits << ")." << std::endl;
+        std::size_t n_blocks = (prior->_size + migration_block_slots - 1) / migration_block_slots;
+        _migrated.store(make_gc_array<std::atomic<bool>>(n_blocks));
+        _blocks_left = n_blocks;
       }
 
       static const auto &descriptor() {
@@ -458,7 +529,10 @@ namespace mpgc {
 	  .template WITH_FIELD(&segment::_mask)
 	  .template WITH_FIELD(&segment::_slots)
 	  .template WITH_FIELD(&segment::_replacement)
-	  .template WITH_FIELD(&segment::_next_to_migrate);
+	  .template WITH_FIELD(&segment::_next_to_migrate)
+	  .template WITH_FIELD(&segment::_count)
+	  .template WITH_FIELD(&segment::_migrated)
+	  .template WITH_FIELD(&segment::_blocks_left);
         return d;
       }
 
@@ -491,6 +565,7 @@ namespace mpgc {
 	  }
 	  auto ur = s->change_using(ep, inc_and_clear_value);
 	  if (ur) {
+	    count_change(-1);
 	    return true;
 	  }
 	  /*
@@ -504,6 +579,22 @@ namespace mpgc {
       }
 
 
+      /*
+       * Frozen slots are reported too.  Once frozen, a slot doesn't
+       * change, so it holds what was there when the grow started.
+       */
+      template <typename Fn>
+      void for_each(Fn&& fn) const {
+        for (std::size_t i = 0; i < _size; i++) {
+          entry_ptr_type ep = _slots[i].contents();
+          pointer<entry_type> e = ep.pointer();
+          // A moving entry is still in its source, and we'll see it there.
+          if (e != nullptr && !moving(ep)) {
+            fn(e->key, e->val.load());
+          }
+        }
+      }
+
       void growth_candidate(const key_type &key1,
                             const key_type &key2,
                             pointer<segment> &best,
@@ -579,6 +670,30 @@ namespace mpgc {
         return d;
       }
 
+      std::ptrdiff_t count() const {
+        std::ptrdiff_t n = 0;
+        for (const auto &p : _segments) {
+          pointer<segment> seg = p;
+          n += seg->_count.load(std::memory_order_relaxed);
+        }
+        return n;
+      }
+
+      /*
+       * If the segment is being replaced, we finish that first, so
+       * that we don't miss entries that only made it into the
+       * replacement.  A grow that starts after this is fine, since
+       * the frozen slots keep what was in them.
+       */
+      template <typename Fn>
+      void for_each(std::size_t seg_num, Fn&& fn) const {
+        pointer<segment> seg = _segments[seg_num];
+        while (seg->_replacement.load() != nullptr) {
+          seg = seg->help_with_grow();
+        }
+        seg->for_each(std::forward<Fn>(fn));
+      }
+
       pointer<table> other_side() const {
         return _map->other_table(_side);
       }
@@ -626,6 +741,56 @@ namespace mpgc {
       return e;
     }
 
+    /*
+     * get_many() does its keys in batches of this many, so that the
+     * slot and entry misses for a batch overlap.
+     */
+    constexpr static std::size_t get_many_batch_size = 16;
+
+    /*
+     * The candidate slots for one get_many() key, and what was in
+     * them.
+     */
+    struct probe {
+      pointer<segment> seg[n_tables];
+      const atomic_entry_ptr_type *slot[n_tables];
+      entry_ptr_type contents[n_tables];
+    };
+
+    void start_probe(const key_type &key, probe &p) const {
+      const pointer<table> tables[n_tables] = { _left_table, _right_table };
+      for (std::size_t t = 0; t < n_tables; t++) {
+        hash_type hash = tables[t]->_hash(key);
+        p.seg[t] = tables[t]->find_segment(hash);
+        p.slot[t] = p.seg[t]->slot(hash).slot;
+        __builtin_prefetch(p.slot[t]);
+      }
+    }
+
+    // Left before right, as in find().
+    void read_probe(probe &p) const {
+      for (std::size_t t = 0; t < n_tables; t++) {
+        p.contents[t] = p.slot[t]->contents();
+        pointer<entry_type> e = p.contents[t].pointer();
+        if (e != nullptr) {
+          __builtin_prefetch(e.as_bare_pointer());
+        }
+      }
+    }
+
+    pointer<entry_type> finish_probe(const key_type &key, const probe &p) const {
+      for (std::size_t t = 0; t < n_tables; t++) {
+        if (p.contents[t][frozen]) {
+          // The segment is growing.  Do this one the slow way.
+          return find(key);
+        }
+        if (p.seg[t]->matches(key, p.contents[t])) {
+          return p.contents[t];
+        }
+      }
+      return nullptr;
+    }
+
 
 
     class grow_needed {};
@@ -746,6 +911,7 @@ namespace mpgc {
     bool clear_slot(const slot_ref &slot, entry_ptr_type expected, const key_type &key){
       auto ur = slot->change_using(expected, inc_and_clear_value);
       if (ur) {
+        slot.seg->count_change(-1);
         return true;
       } else {
         if (ur.prior_value[frozen]) {
@@ -869,6 +1035,33 @@ namespace mpgc {
       return e == nullptr ? value_type{} : static_cast<value_type>(e->val);
     }
 
+    /*
+     * Writes get(k) for each key k in [from, to) to out, and returns
+     * the advanced out.  Rather than probing for one key at a time,
+     * it hashes a batch of keys and prefetches both of their
+     * candidate slots, then reads the slots and prefetches the
+     * entries, and only then compares keys.  KeyIter must be a
+     * forward iterator, since each batch is walked more than once.
+     */
+    template <typename KeyIter, typename OutIter>
+    OutIter get_many(KeyIter from, KeyIter to, OutIter out) const {
+      probe probes[get_many_batch_size];
+      while (from != to) {
+        std::size_t n = 0;
+        for (KeyIter it = from; it != to && n < get_many_batch_size; ++it, ++n) {
+          start_probe(*it, probes[n]);
+        }
+        for (std::size_t i = 0; i < n; i++) {
+          read_probe(probes[i]);
+        }
+        for (std::size_t i = 0; i < n; i++, ++from, ++out) {
+          pointer<entry_type> e = finish_probe(*from, probes[i]);
+          *out = e == nullptr ? value_type{} : static_cast<value_type>(e->val);
+        }
+      }
+      return out;
+    }
+
     bool remove(const key_type &key) {
       // need to go in reverse order just in case the two tables both
       // temporarily hold values (left shadowing right) with different
@@ -879,6 +1072,50 @@ namespace mpgc {
       return res1 || res2;
     }
 
+    /*
+     * An estimate of the number of entries, summed from per-segment
+     * counts.  An entry that's in the middle of being moved may be
+     * counted in both tables.
+     */
+    std::size_t size() const {
+      std::ptrdiff_t n = _left_table->count() + _right_table->count();
+      return n < 0 ? 0 : n;
+    }
+
+    /*
+     * The number of positions for for_each(): one for each segment in
+     * each table.
+     */
+    constexpr static std::size_t scan_positions() {
+      return n_tables * table::n_segments;
+    }
+
+    /*
+     * The [begin, end) positions that the i'th of n threads should
+     * pass to for_each() to split a scan among them.
+     */
+    static std::pair<std::size_t, std::size_t> scan_range(std::size_t i, std::size_t n) {
+      std::size_t total = scan_positions();
+      return std::make_pair(total*i/n, total*(i+1)/n);
+    }
+
+    /*
+     * Calls fn(key, value) for the entries in the segments at
+     * positions [begin, end).  This is weakly consistent.  Entries
+     * that are there throughout will be seen unless they're evicted
+     * to the other table during the scan, in which case they may be
+     * missed or seen twice.  Entries added or removed during the scan
+     * may or may not be seen.  Other threads can scan disjoint
+     * ranges at the same time.
+     */
+    template <typename Fn>
+    void for_each(Fn&& fn, std::size_t begin = 0, std::size_t end = scan_positions()) const {
+      for (std::size_t p = begin; p < end; p++) {
+        pointer<table> t = p < table::n_segments ? _left_table : _right_table;
+        t->for_each(p % table::n_segments, fn);
+      }
+    }
+
     template <typename F>
     constexpr static bool is_binary_guard()
     { return meta::is_callable<F(bool, const value_type), bool>::value; }
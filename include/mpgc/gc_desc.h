@@ -89,6 +89,25 @@ namespace mpgc {
   template <typename T, typename Enabled = void>
   class gc_traits;
 
+  /**
+   * A traits class to describe, at compile time, which fields of type
+   * `T` hold GC references.
+   *
+   * This is used by desc_spec<T,Fields> to compute compact
+   * gc_descriptor representations at compile time.  If there is no
+   * way to know a type's reference fields without calling
+   * desc_for<T>(), #is_known will be `false` and the descriptor will
+   * be computed at runtime.
+   *
+   * @tparam T the type.
+   * @tparam Enabled an optional concept parameter, typically given as
+   * std::enable_if_t.
+   */
+  template <typename T, typename Enabled = void>
+  struct static_ref_map;
+
+  template <typename T, typename...Fields>
+  struct desc_spec;
 
   class ref_field_collector__;
 
@@ -242,6 +261,7 @@ namespace mpgc {
 
     friend class gc_allocated;
     friend class ref_field_collector__;
+    template <typename T, typename...Fields> friend struct desc_spec;
 
     /**
      * An enum representing the format category based on bits 63 and 62.
@@ -634,6 +654,105 @@ namespace mpgc {
       return r;
     }
 
+    /**
+     * The largest number of fields in a type whose descriptor can be
+     * computed at compile time by compact_rep().
+     *
+     * Reference fields are passed as a 64-bit map, and bits::mask()
+     * can't produce a mask covering all 64 bits.
+     */
+    constexpr static std::size_t max_static_fields = 63;
+
+    /**
+     * Create a list object descriptor given a map of the indices.
+     *
+     * This is a constexpr analogue of list_rep() for use by
+     * compact_rep().
+     *
+     * @param words the number of fields in the object.
+     * @param refs the number of bits set in `map`.
+     * @param includep `true` for an include list descriptor, `false`
+     * for an exclude list descriptor
+     * @param map a map whose set bits are the indices to put in the
+     * list.
+     * @returns the representation of the descriptor if the number of
+     * fields is no bigger than the maximum size given the list length
+     * (as given by max_size_for_list()), zero otherwise.
+     * @pre words<=max_static_fields
+     */
+    constexpr static rep_type list_rep_from_map(std::size_t words, std::size_t refs,
+                                                bool includep, std::uint64_t map)
+    {
+      const std::size_t w = list_width[refs];
+      if (words > size_field(list_base-w, w).max_val()) {
+        return 0;
+      }
+      rep_type r = is_compact_fld.encode(true)
+        | is_bitmap_fld.encode(false)
+        | n_fields_fld.encode(refs)
+        | include_fields_fld.encode(includep)
+        | size_field(list_base-w, w).encode(words);
+      std::size_t shift = list_base-2*w;
+      for (std::size_t i=0; i<words; i++) {
+        if ((map & (std::uint64_t{1} << i)) != 0) {
+          r |= size_field(shift, w).encode(i);
+          shift -= w;
+        }
+      }
+      return r;
+    }
+
+    /**
+     * Compute a compact object descriptor given a map of reference
+     * fields.
+     *
+     * This follows the same logic as
+     * ref_field_collector__::to_descriptor(), but can be evaluated at
+     * compile time.  It is used by desc_spec<T,Fields> when the
+     * reference fields of all of its members are known statically.
+     *
+     * @param words the number of fields in the object.
+     * @param map a map in which bit `i` is set iff field `i` holds a
+     * GC reference.
+     * @returns the representation of the descriptor, or zero if the
+     * object can only be described by an external descriptor.
+     * @pre words<=max_static_fields
+     */
+    constexpr static rep_type compact_rep(std::size_t words, std::uint64_t map) {
+      std::size_t nrefs = 0;
+      for (std::size_t i=0; i<words; i++) {
+        if ((map & (std::uint64_t{1} << i)) != 0) {
+          nrefs++;
+        }
+      }
+      if (nrefs == 0) {
+        return gc_descriptor(as_list{}, words)._rep;
+      }
+      if (nrefs == words) {
+        return list_rep_from_map(words, 0, false, 0);
+      }
+      const rep_type pos_list = nrefs > n_fields_fld.max_val() ? 0
+        : list_rep_from_map(words, nrefs, true, map);
+      const std::size_t n_missing = words-nrefs;
+      if (n_missing < 8 && n_missing < nrefs) {
+        const rep_type neg_list = list_rep_from_map(words, n_missing, false,
+                                                    ~map & bits::mask(words));
+        if (neg_list != 0) {
+          return neg_list;
+        }
+      }
+      if (pos_list != 0) {
+        return pos_list;
+      }
+      if (words <= 32) {
+        return is_compact_fld.encode(true)
+          | is_bitmap_fld.encode(true)
+          | bitmap_size_fld.encode(words-1)
+          | bitmap_map_fld.encode(map);
+      }
+      return 0;
+    }
+
 
     /**
      * The category of the descriptor .
@@ -756,6 +875,19 @@ namespace mpgc {
       return category() == cat::illegal;
     }
 
+    /**
+     * Do two descriptors have the same representation?
+     * @returns `true` if the representations are identical.  Two
+     * external descriptors are only equal if they are the same
+     * external_descriptor object.
+     */
+    constexpr bool operator==(const gc_descriptor &other) const {
+      return _rep == other._rep;
+    }
+    constexpr bool operator!=(const gc_descriptor &other) const {
+      return _rep != other._rep;
+    }
+
     /**
      * The number of words consumed by a given number of bytes
      *
@@ -895,7 +1027,8 @@ namespace mpgc {
         }
       case cat::bitmap:
         {
-          std::size_t total_fields = bitmap_size_fld[_rep];
+          // The size field holds one less than the number of fields.
+          std::size_t total_fields = bitmap_size_fld[_rep]+1;
           std::size_t bm = bitmap_map_fld[_rep];
           std::size_t f = 1;
           for (std::size_t i=0; i<total_fields; i++,f<<=1) {
@@ -1749,7 +1882,10 @@ s   */
    * type `T` have been covered by superclasses and members in
    * `Fields...`.
    *
-   * 2. At runtime, it can create a gc_descriptor corresponding to `T`.
+   * 2. It can create a gc_descriptor corresponding to `T`.  When the
+   * reference fields of all of the superclasses and members are known
+   * at compile time (as indicated by static_ref_map), this is done at
+   * compile time.  Otherwise it is done at runtime.
    *
    * The expectation is that a class will construct a desc_spec
    * incrementally during the construction of its descriptor by
@@ -1766,10 +1902,11 @@ s   */
    * The GC_DESC() call creates a desc_spec with no field_spec
    * objects.  Each call to WITH_SUPER() and WITH_FIELD() creates a
    * new one with an extra field_spec representing the superclass or
-   * member.  Finally, the conversion to gc_descriptor creates a
-   * #collector that uses static_assert() to check coverage at compile
-   * time and calls collector::to_descriptor() to create the
-   * gc_descriptor at runtime.
+   * member.  Finally, the conversion to gc_descriptor uses
+   * static_assert() to check coverage at compile time and either
+   * computes the gc_descriptor at compile time (via static_rep()) or
+   * creates a #collector and calls collector::to_descriptor() to
+   * create it at runtime.
    */
   template <typename T, typename...Fields>
   struct desc_spec : desc_spec_base<T> {
@@ -1913,8 +2050,8 @@ s   */
      *
      * @tparam S the superclass.
      */
-    template <typename S> 
-    auto with_super() {
+    template <typename S>
+    constexpr auto with_super() {
       static_assert(is_collectible<S>::value,
                     "Has non-trivial destructor and no is_collectible<T> specialization");
       return desc_spec<T, Fields..., decltype(desc_spec_base<T>::template super_as_field<S>())>();
@@ -1927,7 +2064,7 @@ s   */
      * @tparam Field a member of `T`.
      */
     template <typename X, X T::*Field>
-    auto with_field() {
+    constexpr auto with_field() {
       static_assert(is_collectible<X>::value,
                     "Has non-trivial destructor and no is_collectible<T> specialization");
 
@@ -1981,28 +2118,100 @@ s   */
      * no longer is and should probably be removed.)
      */
     template <std::size_t Size, std::size_t Mask>
-    static void check_coverage() {
+    constexpr static void check_coverage() {
       static_assert(Mask == 0, "Not all fields covered");
     }
-    
+
     /**
-     * Convert the collector to a gc_descriptor.
+     * The reference fields of a single field_spec, shifted to its
+     * position in `T`.
      *
-     * Calls check_coverage() to ensure complete coverage at compile
-     * time and then calls to_descriptor() to compile the
-     * gc_descriptor().
+     * @tparam F the field_spec.
+     * @returns a map with a bit set for each field of `T` covered by
+     * `F` that holds a GC reference.
+     * @pre `static_ref_map<F::type>::is_known`
+     */
+    template <typename F>
+    constexpr static std::uint64_t field_ref_map() {
+      using X = std::remove_cv_t<typename F::type>;
+      // Same adjustment as collector::add_fields()
+      const std::size_t off = collector::template is_gc_allocated<X>()
+        ? F::offset : collector::adjust(F::offset);
+      return off < 64 ? static_ref_map<X>::value << off : 0;
+    }
+
+    /**
+     * Are the reference fields of `T` known at compile time?
      *
-     * @returns the equivalent gc_descriptor.
-     * @pre check_coverage() doesn't fail.
+     * @returns `true` if `T` is small enough for compact_rep() and
+     * static_ref_map<X>::is_known for every field_spec in
+     * `Fields...`.
      */
-    operator gc_descriptor() const {
-      check_coverage<desc_spec_base<T>::template width<T>(), desc_spec_base<T>::template coverage_mask<Fields...>()>();
+    constexpr static bool all_fields_known() {
+      const bool known[] = { true,
+                             static_ref_map<std::remove_cv_t<typename Fields::type>>::is_known... };
+      for (bool k : known) {
+        if (!k) {
+          return false;
+        }
+      }
+      return collector::n_fields() <= gc_descriptor::max_static_fields;
+    }
+
+    /**
+     * The compact representation of the gc_descriptor for `T`,
+     * computed at compile time.
+     *
+     * @returns the representation, or zero if the descriptor can only
+     * be computed at runtime (either because some field's reference
+     * fields aren't statically known or because `T` needs an external
+     * descriptor).
+     */
+    constexpr static gc_descriptor::rep_type static_rep() {
+      if (!all_fields_known()) {
+        return 0;
+      }
+      const std::uint64_t maps[] = { 0, field_ref_map<Fields>()... };
+      std::uint64_t map = 0;
+      for (std::uint64_t m : maps) {
+        map |= m;
+      }
+      return gc_descriptor::compact_rep(collector::n_fields(), map);
+    }
+
+    /**
+     * Compute the gc_descriptor at runtime.
+     *
+     * Uses a #collector and calls to_descriptor() on it.  This is
+     * only used when static_rep() can't describe `T`.
+     */
+    static gc_descriptor runtime_descriptor() {
       collector c;
       gc_descriptor d = c.to_descriptor();
       // type_printer<Fields...>::print(std::cout, "Field: ");
       // d.trace(typeid(T).name());
       return d;
     }
+
+    /**
+     * Convert the collector to a gc_descriptor.
+     *
+     * Calls check_coverage() to ensure complete coverage at compile
+     * time.  If static_rep() can describe `T`, the result is a
+     * constant expression, so the static variable conventionally
+     * initialized from it in a `descriptor()` function is constant
+     * initialized and needs no guard.  Otherwise calls
+     * runtime_descriptor() to compile the gc_descriptor.
+     *
+     * @returns the equivalent gc_descriptor.
+     * @pre check_coverage() doesn't fail.
+     */
+    constexpr operator gc_descriptor() const {
+      check_coverage<desc_spec_base<T>::template width<T>(), desc_spec_base<T>::template coverage_mask<Fields...>()>();
+      return static_rep() != 0
+        ? gc_descriptor(gc_descriptor::direct{}, static_rep())
+        : runtime_descriptor();
+    }
   };
 
   /**
@@ -2254,6 +2463,55 @@ s   */
     }
   };
 
+  /**
+   * The default definition of static_ref_map<T>.
+   *
+   * The reference fields are known when gc_traits<T> derives from
+   * is_ref_descriptor (a single reference) or from
+   * no_ref_descriptor<T> (a blob).  Other types, in particular those
+   * that define their own descriptor() method, are unknown and will
+   * cause an enclosing desc_spec to compute its descriptor at
+   * runtime.
+   */
+  template <typename T, typename Enabled>
+  struct static_ref_map {
+    /** `true` if `T` is a single GC reference. */
+    constexpr static bool is_ref = std::is_base_of<is_ref_descriptor, gc_traits<T>>::value;
+    /** `true` if #value is meaningful. */
+    constexpr static bool is_known = is_ref
+      || std::is_base_of<no_ref_descriptor<T>, gc_traits<T>>::value;
+    /** A map with bit `i` set iff field `i` of `T` is a GC reference. */
+    constexpr static std::uint64_t value = is_ref ? 1 : 0;
+  };
+
+  /**
+   * A specialization of static_ref_map for std::atomic<T>.
+   *
+   * delegates to static_ref_map<T>, as gc_traits<std::atomic<T>> does.
+   */
+  template <typename T>
+  struct static_ref_map<std::atomic<T>> : static_ref_map<T> {};
+
+  /**
+   * A specialization of static_ref_map for std::pair<X,Y>.
+   *
+   * Known if both members are known.
+   */
+  template <typename T1, typename T2>
+  struct static_ref_map<std::pair<T1,T2>> {
+    using this_type = std::pair<T1,T2>;
+    using first_map = static_ref_map<std::remove_cv_t<T1>>;
+    using second_map = static_ref_map<std::remove_cv_t<T2>>;
+    constexpr static std::size_t second_offset
+      = desc_spec_base<this_type>::template field_offset<T2, &this_type::second>();
+
+    constexpr static bool is_known = first_map::is_known && second_map::is_known
+      && gc_descriptor::size_in_words<this_type>() < 64;
+    constexpr static std::uint64_t value = is_known
+      ? first_map::value | (second_map::value << second_offset)
+      : 0;
+  };
+
 #ifdef GC_FRIENDLY_TUPLES
   template <std::size_t N, typename Tuple>
   struct enumerate_tuple_elements {
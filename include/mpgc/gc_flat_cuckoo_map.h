@@ -0,0 +1,999 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the 
+ *  Application containing code generated by the Library and added to the 
+ *  Application during this compilation process under terms of your choice, 
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+/*
+ * gc_flat_cuckoo_map.h
+ *
+ * A variant of gc_cuckoo_map that keeps keys and values in the
+ * segments' slot arrays rather than in a separately allocated entry
+ * per key.  Keys must be trivially copyable and fit in a word.
+ * Values must be something flat_cuckoo_value_traits knows how to
+ * pack into the low base_offset_ptr::used_bits() bits of a word:
+ * gc_ptrs and integral or enum types of up to 32 bits.
+ *
+ * The tables, segments, eviction, and segment growth work as they do
+ * in gc_cuckoo_map.  The difference is in moving: since the two
+ * slots can't share an entry, the source is cleared before the
+ * "moving" flag is removed from the target, and lookups treat a
+ * moving cell as present when the other table doesn't hold the key.
+ */
+
+#ifndef GC_FLAT_CUCKOO_MAP_H_
+#define GC_FLAT_CUCKOO_MAP_H_
+
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <atomic>
+#include <utility>
+#include <cassert>
+#include <type_traits>
+
+#include "mpgc/gc.h"
+#include "mpgc/write_barrier.h"
+#include "ruts/atomic16B.h"
+#include "ruts/bit_field.h"
+#include "ruts/meta.h"
+#include "ruts/hashes.h"
+#include "ruts/cas_loop.h"
+
+namespace mpgc {
+
+  /*
+   * The value word of a gc_flat_cuckoo_map slot.  When IsRef is true,
+   * the low bits hold a gc_ptr, and the word is traced as a reference.
+   */
+  template <bool IsRef>
+  struct flat_cuckoo_word {
+    std::uint64_t bits;
+  };
+
+  template <>
+  struct gc_traits<flat_cuckoo_word<true>> : is_ref_descriptor {};
+
+  template <>
+  struct gc_traits<flat_cuckoo_word<false>> : no_ref_descriptor<flat_cuckoo_word<false>> {};
+
+  /*
+   * How values are packed into a flat_cuckoo_word.  to_bits() must
+   * only use the low base_offset_ptr::used_bits() bits.  barrier()
+   * wraps a change of the packed value from old_bits to new_bits.
+   */
+  template <typename V, typename Enable = void>
+  struct flat_cuckoo_value_traits;
+
+  template <typename V>
+  struct flat_cuckoo_value_traits<V, std::enable_if_t<(std::is_integral<V>::value
+                                                       || std::is_enum<V>::value)
+                                                      && sizeof(V) <= sizeof(std::uint32_t)>>
+  {
+    constexpr static bool is_ref = false;
+    static std::uint64_t to_bits(const V &v) {
+      std::uint64_t bits = 0;
+      std::memcpy(&bits, &v, sizeof(V));
+      return bits;
+    }
+    static V from_bits(std::uint64_t bits) {
+      V v;
+      std::memcpy(&v, &bits, sizeof(V));
+      return v;
+    }
+    template <typename Fn>
+    static void barrier(std::uint64_t old_bits, std::uint64_t new_bits, Fn&& func) {
+      std::forward<Fn>(func)();
+    }
+  };
+
+  template <typename T>
+  struct flat_cuckoo_value_traits<gc_ptr<T>> {
+    using ptr_traits = std::versioned_pointer_traits<gc_ptr<T>>;
+    constexpr static bool is_ref = true;
+    static std::uint64_t to_bits(const gc_ptr<T> &p) {
+      return ptr_traits::to_prim_rep(p);
+    }
+    static gc_ptr<T> from_bits(std::uint64_t bits) {
+      return ptr_traits::from_prim_rep(bits);
+    }
+    template <typename Fn>
+    static void barrier(std::uint64_t old_bits, std::uint64_t new_bits, Fn&& func) {
+      write_barrier(from_bits(old_bits).as_offset_pointer(),
+                    from_bits(new_bits).as_offset_pointer(),
+                    std::forward<Fn>(func));
+    }
+  };
+
+  template <typename K, typename V, typename Hash1=ruts::hash1<K>, typename Hash2=ruts::hash2<K>,
+      std::size_t SegBits = 10>
+  class gc_flat_cuckoo_map : public gc_allocated {
+  public:
+    using key_type = K;
+    using value_type = V;
+
+    using hash1_fn_type = Hash1;
+    using hash2_fn_type = Hash2;
+    using hash_type = uint64_t;
+
+    template <typename T>
+    using pointer = gc_ptr<T>;
+
+    static_assert(std::is_trivially_copyable<key_type>::value
+                  && sizeof(key_type) <= sizeof(std::uint64_t),
+                  "gc_flat_cuckoo_map keys must be trivially copyable and fit in a word");
+
+  private:
+    using value_traits = flat_cuckoo_value_traits<value_type>;
+    using value_word = flat_cuckoo_word<value_traits::is_ref>;
+
+    /*
+     * The high bits of the value word hold three flags and a version
+     * number.  Since every CAS compares the whole cell, the version
+     * only has to tell apart successive identical contents, so the
+     * few bits we have left are enough.
+     */
+    constexpr static std::size_t payload_bits = base_offset_ptr::used_bits();
+    constexpr static std::uint64_t payload_mask = (std::uint64_t{1} << payload_bits) - 1;
+    constexpr static std::uint64_t occupied_bit = std::uint64_t{1} << payload_bits;
+    /**
+     * Cell is in the process of being moved from one table to the other.  Not considered there
+     * yet unless the other table no longer has the key.
+     */
+    constexpr static std::uint64_t moving_bit = occupied_bit << 1;
+    /**
+     * Cell has (maybe) been moved from segment to its replacement and shouldn't be overwritten
+     */
+    constexpr static std::uint64_t frozen_bit = occupied_bit << 2;
+    constexpr static std::uint64_t flag_mask = occupied_bit | moving_bit | frozen_bit;
+    constexpr static std::uint64_t version_one = frozen_bit << 1;
+    constexpr static std::uint64_t version_mask = ~(version_one - 1);
+    static_assert(payload_bits + 3 < 64, "No room for a version number");
+
+    constexpr static std::size_t n_tables = 2;
+    constexpr static std::size_t n_seg_bits = SegBits;
+    constexpr static std::size_t max_eviction_depth = 8;
+    constexpr static std::size_t migration_block_slots = 512;
+    constexpr static std::size_t default_initial_segment_bits = 10;
+    constexpr static std::size_t max_segment_slot_bits = 64-n_seg_bits;
+    constexpr static std::size_t default_cap = 1 << (n_seg_bits + default_initial_segment_bits);
+
+    enum class side { LEFT, RIGHT };
+
+    static std::uint64_t key_bits_of(const key_type &key) {
+      std::uint64_t bits = 0;
+      std::memcpy(&bits, &key, sizeof(key_type));
+      return bits;
+    }
+
+    static key_type key_from_bits(std::uint64_t bits) {
+      key_type key;
+      std::memcpy(&key, &bits, sizeof(key_type));
+      return key;
+    }
+
+    /*
+     * The contents of a slot.  Keys are compared bitwise.
+     */
+    struct alignas(16) cell {
+      std::uint64_t key_bits;
+      value_word val;
+
+      bool occupied() const {
+        return (val.bits & occupied_bit) != 0;
+      }
+      bool moving() const {
+        return (val.bits & moving_bit) != 0;
+      }
+      bool frozen() const {
+        return (val.bits & frozen_bit) != 0;
+      }
+      bool holds(const key_type &key) const {
+        return occupied() && key_bits == key_bits_of(key);
+      }
+      key_type key() const {
+        return key_from_bits(key_bits);
+      }
+      std::uint64_t payload() const {
+        return val.bits & payload_mask;
+      }
+      value_type value() const {
+        return value_traits::from_bits(payload());
+      }
+
+      static cell holding(const key_type &key, const value_type &v) {
+        std::uint64_t bits = value_traits::to_bits(v);
+        assert((bits & ~payload_mask) == 0);
+        return cell{key_bits_of(key), value_word{occupied_bit | bits}};
+      }
+
+      std::uint64_t next_version() const {
+        return (val.bits & version_mask) + version_one;
+      }
+      /* These contents, with the version following prior's */
+      cell replacing(const cell &prior) const {
+        return cell{key_bits, value_word{(val.bits & ~version_mask) | prior.next_version()}};
+      }
+      cell with_value(const value_type &v) const {
+        std::uint64_t bits = value_traits::to_bits(v);
+        assert((bits & ~payload_mask) == 0);
+        return cell{key_bits, value_word{next_version() | (val.bits & flag_mask) | bits}};
+      }
+      cell with_moving(bool on) const {
+        std::uint64_t rest = val.bits & ~version_mask & ~moving_bit;
+        return cell{key_bits, value_word{next_version() | rest | (on ? moving_bit : 0)}};
+      }
+      cell with_frozen(bool on) const {
+        std::uint64_t rest = val.bits & ~frozen_bit;
+        return cell{key_bits, value_word{rest | (on ? frozen_bit : 0)}};
+      }
+      cell emptied() const {
+        return cell{0, value_word{next_version()}};
+      }
+
+      static const auto &descriptor() {
+        static gc_descriptor d =
+          GC_DESC(cell)
+          .template WITH_FIELD(&cell::key_bits)
+          .template WITH_FIELD(&cell::val);
+        return d;
+      }
+    };
+
+    struct slot_type : ruts::atomic16B<cell> {
+      using base = ruts::atomic16B<cell>;
+      using base::base;
+      static const auto &descriptor() {
+        return cell::descriptor();
+      }
+    };
+    static_assert(sizeof(slot_type) == sizeof(cell), "slot_type must be the same size as a cell");
+
+    static bool change(slot_type &slot, cell &expected, const cell &desired) {
+      bool ret;
+      value_traits::barrier(expected.payload(), desired.payload(), [&] {
+        ret = slot.compare_exchange_strong(expected, desired);
+      });
+      dirty_tracking::note(&slot);
+      return ret;
+    }
+
+    class switched_hash {
+      const hash1_fn_type hash1;
+      const hash2_fn_type hash2;
+      const bool use_hash1;
+    public:
+      switched_hash(side s, const hash1_fn_type h1, const hash2_fn_type h2) : hash1(h1), hash2(h2), use_hash1(s == side::LEFT) {}
+      hash_type operator()(const key_type &key) const {
+        return use_hash1 ? hash1(key) : hash2(key);
+      }
+      static const auto &descriptor() {
+        static gc_descriptor d =
+          GC_DESC(switched_hash)
+          .template WITH_FIELD(&switched_hash::hash1)
+          .template WITH_FIELD(&switched_hash::hash2)
+          .template WITH_FIELD(&switched_hash::use_hash1);
+        return d;
+      }
+    };
+
+    struct replace_return {
+      bool replaced = false;
+      bool had_value = false;
+      value_type old_value;
+      value_type resulting_value;
+      operator bool() const {
+        return replaced;
+      }
+      replace_return() {}
+      replace_return(bool r, bool hv, const value_type &ov, const value_type &nv)
+      : replaced(r),
+        had_value(hv),
+        old_value(ov),
+        resulting_value(nv)
+      {}
+    };
+
+    class table;
+    class segment;
+
+    struct slot_ref {
+      pointer<segment> seg;
+      std::size_t index = 0;
+      slot_type *slot = nullptr;
+      cell contents() const {
+        return slot->load();
+      }
+      slot_ref() {}
+      slot_ref(const pointer<segment> &s, std::size_t i, slot_type &sr)
+      : seg(s), index(i), slot(&sr)
+      {}
+    };
+
+    /*
+     * Where a key was found and what was there when we looked.
+     */
+    struct location {
+      slot_ref slot;
+      cell contents;
+    };
+
+    class source_grew {};
+
+    class segment : public gc_allocated {
+      const std::size_t _num;
+      const pointer<table> _table;
+      switched_hash _hash = _table->_hash;
+      const std::size_t _slot_bits;
+      const std::size_t _size = (std::size_t{1} << _slot_bits);
+      const std::size_t _mask = _size-1;
+      gc_array_ptr<slot_type> _slots{_size};
+      std::atomic<pointer<segment>> _replacement{nullptr};
+      // The next migration block to claim when this segment is being replaced.
+      mutable std::atomic<std::size_t> _next_to_migrate{0};
+      // As in gc_cuckoo_map, set when this segment replaces a prior one.
+      std::atomic<gc_array_ptr<std::atomic<bool>>> _migrated{nullptr};
+      std::atomic<std::size_t> _blocks_left{0};
+
+      friend class table;
+      friend class gc_flat_cuckoo_map;
+
+      /*constexpr*/ std::size_t slot_index(hash_type hash) const {
+        return hash & _mask;
+      }
+
+      slot_ref slot(hash_type hash) {
+        std::size_t i = slot_index(hash);
+        return slot_ref(GC_THIS, i, _slots[i]);
+      }
+
+      slot_ref slot_for(const key_type &key) {
+        return slot(_hash(key));
+      }
+
+      bool replace_null(const cell &with, hash_type hash) {
+        slot_type &s = _slots[slot_index(hash)];
+        cell current = s.load();
+        while (!current.occupied() && !current.frozen()) {
+          if (change(s, current, with.replacing(current))) {
+            return true;
+          }
+        }
+        if (current.frozen()) {
+          pointer<segment> new_seg = help_with_grow();
+          return new_seg->replace_null(with, hash);
+        }
+        return false;
+      }
+
+      // Throws source_grew if the source is frozen when we go to clear it, because this
+      // may no longer be the slot we wanted to move from.
+
+      // On successful return, the destination has the value and the source doesn't.  On
+      // unsuccessful return, the source (if anything) has it.
+
+      /*
+       * As in gc_cuckoo_map, we allow a left-to-right move to overwrite
+       * a (shadowed) cell with the same key, but not the other way.
+       */
+      bool accept_move(slot_ref &source,
+                       const cell &current,
+                       slot_ref &target)
+      {
+        if (current.moving()) {
+          // we can't move something that's being moved.
+          return false;
+        }
+        if (!current.occupied()) {
+          // For some reason we're trying to move an empty slot.
+          // We'll just say we did it.
+          return true;
+        }
+
+        cell t = target.contents();
+        while (true) {
+          if (t.frozen()) {
+            pointer<segment> new_seg = help_with_grow();
+            // Find the new target slot (and communicate it back to the caller)
+            target = new_seg->slot_for(current.key());
+            return new_seg->accept_move(source, current, target);
+          }
+          if (t.occupied()
+              && (t.moving() || t.key_bits != current.key_bits || _table->_side != side::RIGHT))
+          {
+            return false;
+          }
+          if (change(*target.slot, t, current.with_moving(true).replacing(t))) {
+            break;
+          }
+        }
+
+        // The copy doesn't count while the source still holds the key.  Clearing the
+        // source fails if it was changed (or removed) since we read it.
+        cell sc = current;
+        if (!change(*source.slot, sc, current.emptied())) {
+          _table->_map->finish_move(target, current.key(), false);
+          if (sc.frozen()) {
+            throw source_grew{};
+          }
+          return false;
+        }
+        // Lookups already see the copy, since the source is clear.  Make it official.
+        _table->_map->finish_move(target, current.key(), true);
+        return true;
+      }
+
+      void grow(std::size_t by) {
+        pointer<segment> new_seg = make_gc<segment>(GC_THIS, by);
+        if (!ruts::try_change_value(_replacement, nullptr, new_seg)) {
+          // Somebody else got there first.  That's okay.
+        }
+        help_with_grow();
+        // At the end it will be installed.
+      }
+
+      void migrate(const pointer<segment> &r, std::size_t from, std::size_t to) const {
+        segment *nc_this = const_cast<segment *>(this);
+        for (std::size_t i = from; i < to; i++) {
+          // We're okay with casting away constness to freeze the slot.
+          slot_type &s = nc_this->_slots[i];
+          cell c = s.load();
+          while (!c.frozen() && !change(s, c, c.with_frozen(true))) {
+          }
+          // We may not have been the first one to freeze it, but we can't assume that
+          // the one who did succeeded in copying it.
+          if (c.occupied()) {
+            std::size_t j = r->slot_index(_hash(c.key()));
+            // As in gc_cuckoo_map, we only replace the initial empty cell, in case
+            // the whole grow finished and somebody changed the copy while we were
+            // delayed.  It's okay if it's moving, since we still want to complete
+            // the move.
+            cell initial{};
+            change(r->_slots[j], initial, c.with_frozen(false));
+          }
+        }
+      }
+
+      void migrate_block(const pointer<segment> &r, std::size_t b,
+                         gc_array_ptr<std::atomic<bool>> flags) const {
+        std::size_t from = b * migration_block_slots;
+        migrate(r, from, std::min(from + migration_block_slots, _size));
+        if (!flags[b].exchange(true)) {
+          r->_blocks_left--;
+        }
+      }
+
+      // Blocks are claimed and finished as in gc_cuckoo_map.
+      pointer<segment> help_with_grow() const {
+        pointer<segment> r = _replacement;
+        gc_array_ptr<std::atomic<bool>> flags = r->_migrated.load();
+        if (flags != nullptr) {
+          std::size_t n_blocks = flags->size();
+          for (std::size_t b = _next_to_migrate.fetch_add(1); b < n_blocks;
+               b = _next_to_migrate.fetch_add(1))
+          {
+            migrate_block(r, b, flags);
+          }
+          if (r->_blocks_left != 0) {
+            for (std::size_t b = 0; b < n_blocks; b++) {
+              if (!flags[b]) {
+                migrate_block(r, b, flags);
+              }
+            }
+          }
+        }
+        // Now everything has been moved.  We might be the first to have finished (or the
+        // one who was might have died before installing), so we'll try to install.
+        segment *nc_this = const_cast<segment *>(this);
+        ruts::cas_loop_return_value<pointer<segment>>
+          install_res = ruts::try_change_value(_table->_segments[_num], this_as_gc_ptr(nc_this), r);
+        if (install_res.succeeded) {
+          // The GC can have this segment once nobody's looking at it.
+          r->_migrated.store(nullptr);
+        }
+        return install_res.resulting_value();
+      }
+
+    public:
+      segment(gc_token &gc, std::size_t n, std::size_t slot_bits, const pointer<table> &t)
+      : gc_allocated{gc},
+        _num(n),
+        _table(t),
+        _slot_bits(slot_bits)      {
+      }
+
+      explicit segment(gc_token &gc, const pointer<segment> &prior, std::size_t plus_bits)
+      : segment(gc,
+                prior->_num,
+                prior->_slot_bits+plus_bits,
+                prior->_table)
+      {
+        std::size_t n_blocks = (prior->_size + migration_block_slots - 1) / migration_block_slots;
+        _migrated.store(make_gc_array<std::atomic<bool>>(n_blocks));
+        _blocks_left = n_blocks;
+      }
+
+      static const auto &descriptor() {
+        static gc_descriptor d =
+          GC_DESC(segment)
+          .template WITH_FIELD(&segment::_num)
+          .template WITH_FIELD(&segment::_table)
+          .template WITH_FIELD(&segment::_hash)
+          .template WITH_FIELD(&segment::_slot_bits)
+          .template WITH_FIELD(&segment::_size)
+          .template WITH_FIELD(&segment::_mask)
+          .template WITH_FIELD(&segment::_slots)
+          .template WITH_FIELD(&segment::_replacement)
+          .template WITH_FIELD(&segment::_next_to_migrate)
+          .template WITH_FIELD(&segment::_migrated)
+          .template WITH_FIELD(&segment::_blocks_left);
+        return d;
+      }
+
+      bool locate(const key_type &key, hash_type hash, location &loc) {
+        slot_ref s = slot(hash);
+        cell c = s.contents();
+        if (c.frozen()) {
+          pointer<segment> new_seg = help_with_grow();
+          return new_seg->locate(key, hash, loc);
+        }
+        if (!c.holds(key)) {
+          return false;
+        }
+        loc.slot = s;
+        loc.contents = c;
+        return true;
+      }
+
+      bool remove(const key_type &key, hash_type hash) {
+        slot_type &s = _slots[slot_index(hash)];
+        cell c = s.load();
+        while (true) {
+          if (c.frozen()) {
+            pointer<segment> new_seg = help_with_grow();
+            return new_seg->remove(key, hash);
+          }
+          if (!c.holds(key)) {
+            return false;
+          }
+          if (change(s, c, c.emptied())) {
+            return true;
+          }
+          // Otherwise somebody changed it, so we go around again and check.
+        }
+      }
+
+      void growth_candidate(const key_type &key1,
+                            const key_type &key2,
+                            pointer<segment> &best,
+                            std::size_t &resulting_size,
+                            std::size_t &growth)
+      {
+        // If we're already too big, don't bother.
+        if (_slot_bits >= resulting_size) {
+          return;
+        }
+        hash_type h1 = _hash(key1);
+        hash_type h2 = _hash(key2);
+        // We assume they collide in the current _slot_bits
+        hash_type x = (h1 ^ h2) >> (_slot_bits+1);
+        for (std::size_t b = _slot_bits+1; b <= resulting_size; b++, x >>= 1) {
+          if ((x & 1) != 0) {
+            std::size_t g = b-_slot_bits;
+            if (b < resulting_size || g > growth) {
+              resulting_size = b;
+              growth = g;
+              best = GC_THIS;
+            }
+            return;
+          }
+        }
+      }
+    };
+
+    class table : public gc_allocated {
+      static const std::size_t n_segments = 1 << n_seg_bits;
+
+      const pointer<gc_flat_cuckoo_map> _map;
+      const side _side;
+      const switched_hash _hash;
+      using atomic_seg_ptr = std::atomic<pointer<segment>>;
+      const gc_array_ptr<atomic_seg_ptr> _segments = make_gc_array<atomic_seg_ptr>(n_segments);
+
+      pointer<segment> find_segment(hash_type hash) const {
+        std::size_t seg_num = left_bit_field(hash, n_seg_bits);
+        return _segments[seg_num];
+      }
+
+      friend class segment;
+      friend class gc_flat_cuckoo_map;
+    public:
+
+      explicit table(gc_token &gc, const pointer<gc_flat_cuckoo_map> &m, side s,
+                     const hash1_fn_type &hash1, const hash2_fn_type hash2, std::size_t seg_slot_bits) :
+      gc_allocated{gc}, _map(m), _side(s), _hash(s, hash1, hash2)
+      {
+        int n = 0;
+        for (auto &p : _segments) {
+          p = make_gc<segment>(n++, seg_slot_bits, GC_THIS);
+        }
+      }
+
+      static const auto &descriptor() {
+        static gc_descriptor d =
+          GC_DESC(table)
+          .template WITH_FIELD(&table::_map)
+          .template WITH_FIELD(&table::_side)
+          .template WITH_FIELD(&table::_hash)
+          .template WITH_FIELD(&table::_segments);
+        return d;
+      }
+
+      pointer<table> other_side() const {
+        return _map->other_table(_side);
+      }
+
+      slot_ref slot(const key_type &key) {
+        hash_type hash = _hash(key);
+        pointer<segment> seg = find_segment(hash);
+        return seg->slot(hash);
+      }
+
+      bool locate(const key_type &key, location &loc) const {
+        hash_type hash = _hash(key);
+        pointer<segment> seg = find_segment(hash);
+        return seg->locate(key, hash, loc);
+      }
+
+      bool remove(const key_type &key) {
+        hash_type hash = _hash(key);
+        pointer<segment> seg = find_segment(hash);
+        return seg->remove(key, hash);
+      }
+      bool replace_null(const cell &with) {
+        hash_type hash = _hash(with.key());
+        pointer<segment> seg = find_segment(hash);
+        return seg->replace_null(with, hash);
+      }
+    };
+
+    pointer<table> _left_table;
+    pointer<table> _right_table;
+
+    pointer<table> table_on(side s) {
+      return s == side::LEFT ? _left_table : _right_table;
+    }
+
+    pointer<table> other_table(side s) {
+      return s == side::RIGHT ? _left_table : _right_table;
+    }
+
+    /*
+     * A moving cell only counts if the other table doesn't hold the
+     * key, which means that the mover has already cleared the source.
+     * (Or that the key is being removed, in which case we're just
+     * ahead of the remove.)
+     */
+    bool locate(const key_type &key, location &loc) const {
+      bool in_left = _left_table->locate(key, loc);
+      if (in_left && !loc.contents.moving()) {
+        return true;
+      }
+      location right;
+      if (_right_table->locate(key, right) && (!in_left || !right.contents.moving())) {
+        loc = right;
+        return true;
+      }
+      return in_left;
+    }
+
+    /*
+     * Either clears the moving flag on the target's copy of key (if
+     * keep is true) or removes the copy, following it into a
+     * replacement segment if necessary.  If the copy isn't there,
+     * somebody removed it, and that's fine.
+     */
+    void finish_move(slot_ref target, const key_type &key, bool keep) {
+      cell t = target.contents();
+      while (true) {
+        if (t.frozen()) {
+          pointer<segment> new_seg = target.seg->help_with_grow();
+          target = new_seg->slot_for(key);
+          t = target.contents();
+          continue;
+        }
+        if (!t.holds(key) || !t.moving()) {
+          return;
+        }
+        if (change(*target.slot, t, keep ? t.with_moving(false) : t.emptied())) {
+          return;
+        }
+      }
+    }
+
+    class grow_needed {};
+
+    // Propagates source_grew if it gets one from an accept_move() call
+    side
+    evict_one(slot_ref &left_source, slot_ref &right_source,
+              std::size_t depth, std::size_t max_depth)
+    {
+      if (depth > max_depth) {
+        throw grow_needed{};
+      }
+
+      while (1) {
+        // we loop until we succeed in moving or until we get told it's impossible
+
+        cell left_current = left_source.contents();
+        if (!left_current.occupied() && !left_current.frozen()) {
+          // there's no point in moving nothing.
+          return side::LEFT;
+        }
+        cell right_current = right_source.contents();
+        if (!right_current.occupied() && !right_current.frozen()) {
+          // there's no point in moving nothing.
+          return side::RIGHT;
+        }
+        if (left_current.frozen() || right_current.frozen()) {
+          throw source_grew{};
+        }
+
+        slot_ref left_target = _right_table->slot(left_current.key());
+        if (left_target.seg->accept_move(left_source, left_current, left_target)) {
+          return side::LEFT;
+        }
+        slot_ref right_target = _left_table->slot(right_current.key());
+        if (right_target.seg->accept_move(right_source, right_current, right_target)) {
+          return side::RIGHT;
+        }
+
+        side rec_call;
+        try {
+          // This may throw a grow_needed.  We pass it through.
+          rec_call = evict_one(right_target, left_target, depth+1, max_depth);
+        } catch (source_grew& ex) {
+          continue;
+        }
+        switch (rec_call) {
+        case side::LEFT:
+          // we cleared out the one on the left, so we try to move the right source
+          if (right_target.seg->accept_move(right_source, right_source.contents(), right_target)) {
+            return side::RIGHT;
+          }
+          break;
+        case side::RIGHT:
+          // we cleared out the one on the right, so we try to move the left source
+          if (left_target.seg->accept_move(left_source, left_source.contents(), left_target)) {
+            return side::LEFT;
+          }
+          break;
+        }
+      }
+      assert(ruts::fail("infinite loop ended"));
+      throw grow_needed{};
+    }
+
+    void best_to_grow(pointer<table> t,
+                      key_type key,
+                      pointer<segment> &best,
+                      std::size_t &resulting_size,
+                      std::size_t &growth)
+    {
+      for (std::size_t d = 0; d < max_eviction_depth; d++) {
+        slot_ref slot = t->slot(key);
+        cell c = slot.contents();
+        if (!c.occupied()) {
+          // There's an open slot.  No point in continuing.
+          best = nullptr;
+          return;
+        }
+        slot.seg->growth_candidate(key, c.key(), best, resulting_size, growth);
+        key = c.key();
+        t = t->other_side();
+      }
+    }
+
+    std::pair<pointer<segment>, std::size_t>
+    best_to_grow(const key_type &key) {
+      pointer<segment> best = nullptr;
+      std::size_t resulting_size = 65;
+      std::size_t growth = 0;
+      best_to_grow(_left_table, key, best, resulting_size, growth);
+      if (best != nullptr) {
+        best_to_grow(_right_table, key, best, resulting_size, growth);
+      }
+      return std::make_pair(best, growth);
+    }
+
+    void evict_blocker(const key_type &key) {
+      while (true) {
+        slot_ref left_slot = _left_table->slot(key);
+        slot_ref right_slot = _right_table->slot(key);
+        try {
+          evict_one(left_slot, right_slot, 0, max_eviction_depth);
+          return;
+        } catch (source_grew &) {
+          continue;
+        } catch (grow_needed &) {
+          std::pair<pointer<segment> , std::size_t> to_grow = best_to_grow(key);
+          if (to_grow.first == nullptr) {
+            // If it's null, that means we found a null along the way.
+            continue;
+          }
+          to_grow.first->grow(to_grow.second);
+          return;
+        }
+      }
+    }
+
+    template <typename GFn, typename UFn>
+    bool put_in_existing(const key_type &key, replace_return &rr, GFn&& gfn, UFn&&ufn) {
+      location loc;
+      while (locate(key, loc)) {
+        value_type old = loc.contents.value();
+        if (!gfn(true, old)) {
+          rr = replace_return(false, true, old, old);
+          return true;
+        }
+        value_type nv = ufn(true, old);
+        if (change(*loc.slot.slot, loc.contents, loc.contents.with_value(nv))) {
+          rr = replace_return(true, true, old, nv);
+          return true;
+        }
+        // It changed (or moved, or went away) since we looked.  Look again.
+      }
+      return false;
+    }
+
+    template <typename GFn, typename UFn>
+    void evict_and_put(const cell &e, replace_return &rr, GFn &&gfn, UFn &&ufn) {
+      // This should eventually succeed.  (Most of the time, the first or second time around)
+      while (true) {
+        if (_left_table->replace_null(e)) {
+          rr = replace_return(true, false, value_type(), e.value());
+          return;
+        }
+        if (_right_table->replace_null(e)) {
+          rr = replace_return(true, false, value_type(), e.value());
+          return;
+        }
+        evict_blocker(e.key());
+        if (put_in_existing(e.key(), rr, std::forward<GFn>(gfn), std::forward<UFn>(ufn))) {
+          return;
+        }
+      }
+    }
+
+    static std::size_t slot_bits_for(std::size_t cap) {
+      std::size_t bits = 1;
+      std::size_t size = 1<<(n_seg_bits+1);
+      while (size < cap) {
+        bits++;
+        size <<=1;
+      }
+      return bits;
+    }
+
+  public:
+    gc_flat_cuckoo_map(gc_token &gc, const hash1_fn_type &h1, const hash2_fn_type &h2,
+                       std::size_t capacity = default_cap) :
+      gc_allocated{gc},
+      _left_table{make_gc<table>(GC_THIS, side::LEFT, h1, h2, slot_bits_for(capacity))},
+      _right_table{make_gc<table>(GC_THIS, side::RIGHT, h1, h2, slot_bits_for(capacity))}
+      {}
+    explicit gc_flat_cuckoo_map(gc_token &gc, std::size_t capacity = default_cap) :
+        gc_flat_cuckoo_map(gc, hash1_fn_type{}, hash2_fn_type{}, capacity)
+    {}
+
+    static const auto &descriptor() {
+      static gc_descriptor d =
+        GC_DESC(gc_flat_cuckoo_map)
+        .template WITH_FIELD(&gc_flat_cuckoo_map::_left_table)
+        .template WITH_FIELD(&gc_flat_cuckoo_map::_right_table);
+      return d;
+    }
+
+    bool contains(const key_type &key) const {
+      location loc;
+      return locate(key, loc);
+    }
+
+    value_type get(const key_type &key) const {
+      location loc;
+      return locate(key, loc) ? loc.contents.value() : value_type{};
+    }
+
+    std::pair<bool, value_type> lookup(const key_type &key) const {
+      location loc;
+      if (locate(key, loc)) {
+        return std::make_pair(true, loc.contents.value());
+      } else {
+        return std::make_pair(false, value_type());
+      }
+    }
+
+    value_type operator[](const key_type &key) const {
+      return get(key);
+    }
+
+    bool remove(const key_type &key) {
+      // As in gc_cuckoo_map, right first, so that removing a shadowing
+      // cell doesn't make a shadowed one reappear.
+      bool res2 = _right_table->remove(key);
+      bool res1 = _left_table->remove(key);
+      return res1 || res2;
+    }
+
+    template <typename F>
+    constexpr static bool is_binary_guard()
+    { return meta::is_callable<F(bool, const value_type), bool>::value; }
+
+    template <typename F>
+    constexpr static bool is_binary_updater()
+    { return meta::is_callable<F(bool, const value_type), value_type>::value; }
+
+    template <typename GFn, typename UFn,
+              typename = std::enable_if_t<(is_binary_guard<GFn>() && is_binary_updater<UFn>())> >
+    replace_return put(const key_type &key, GFn&& guard, UFn&& updater)
+    {
+      replace_return rr;
+      if (!put_in_existing(key, rr, std::forward<GFn>(guard), std::forward<UFn>(updater))
+          && std::forward<GFn>(guard)(false, value_type{}))
+        {
+          cell e = cell::holding(key, std::forward<UFn>(updater)(false, value_type{}));
+          evict_and_put(e, rr, std::forward<GFn>(guard), std::forward<UFn>(updater));
+        }
+      return rr;
+    }
+
+    template <typename UFn, typename = std::enable_if_t<is_binary_updater<UFn>()> >
+    replace_return put(const key_type &key, UFn&& updater)
+    {
+      auto guard = [](bool, const value_type &){ return true; };
+      return put(key, guard, std::forward<UFn>(updater));
+    }
+
+    replace_return put(const key_type &key, const value_type &val) {
+      return put(key, [&](bool, const value_type &){ return val; });
+    }
+
+    replace_return put_new(const key_type &key, const value_type &val) {
+      auto guard = [](bool has_val, const value_type &){ return !has_val; };
+      return put(key, guard, [&](bool, const value_type &){ return val; });
+    }
+
+    replace_return replace(const key_type &key,
+                           const value_type &expected,
+                           const value_type &val) {
+      auto guard = [&](bool has_val, const value_type &old){ return has_val && old == expected; };
+      return put(key, guard, [&](bool, const value_type &){ return val; });
+    }
+  };
+
+  template <typename K, typename V, typename Hash1=ruts::hash1<K>, typename Hash2=ruts::hash2<K> >
+  using small_gc_flat_cuckoo_map = gc_flat_cuckoo_map<K,V,Hash1,Hash2,0>;
+
+}
+
+#endif /* GC_FLAT_CUCKOO_MAP_H_ */
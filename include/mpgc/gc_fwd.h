@@ -108,6 +108,34 @@ namespace mpgc {
   struct zero_init_okay<gc_ptr<T>> : std::true_type {};
   template <typename T>
   struct zero_init_okay<gc_sub_ptr<T>> : std::true_type {};
+
+  /*
+   * Types whose values can be copied with memcpy(), which is how
+   * gc_array copies them when it can.
+   */
+  template <typename T, typename = void>
+  struct bitwise_copy_okay : std::is_trivially_copyable<T> {};
+
+  template <typename T>
+  struct bitwise_copy_okay<offset_ptr<T>> : std::true_type {};
+
+  template <typename T>
+  struct bitwise_copy_okay<gc_ptr<T>> : std::true_type {};
+
+  /*
+   * Allocation normally zeroes an object's memory before the ctor
+   * runs.  Specialize this to true_type for types whose ctors write
+   * every word themselves, and the allocator will skip that.  For
+   * gc_array elements, it applies when the whole array is copied
+   * in.  Since a new object can be scanned before its ctor is done,
+   * this is only safe for types that hold no references.
+   */
+  template <typename T, typename = void>
+  struct self_initializing : std::false_type {};
+
+  template <typename T>
+  struct self_initializing<T, std::enable_if_t<std::is_arithmetic<T>::value
+                                               || std::is_enum<T>::value> > : std::true_type {};
 }
 
 #endif
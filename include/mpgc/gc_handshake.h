@@ -82,6 +82,22 @@ namespace mpgc {
       Working
     };
 
+    /*
+     * A run of equally-sized objects carved out of a single chunk by
+     * make_gc_n().  Only the first one is guaranteed to be reachable
+     * from the stack while the rest are being constructed, so the
+     * async handshake treats every object in the run as a root.
+     * A make_gc_n() called while another one is constructing its
+     * objects saves the enclosing batch on the stack (see
+     * pending_batch_scope) and chains it through outer.
+     */
+    struct allocation_batch {
+      std::size_t *begin = nullptr;
+      std::size_t stride = 0; // in words
+      std::size_t count = 0;
+      const allocation_batch *outer = nullptr;
+    };
+
     extern Signum *status_ptr;
     extern per_process_struct *process_struct;
     extern mark_bitmap *mbitmap;
@@ -134,6 +150,7 @@ namespace mpgc {
       volatile bool sweep_signal_disabled;
       volatile bool sweep_signal_requested;
       volatile bool clear_local_allocator;
+      allocation_batch pending_batch;
 
       static bool is_marked(in_memory_thread_struct *s) { return s->live == Alive::Dead; }
       void mark_dead() {
@@ -162,7 +179,8 @@ namespace mpgc {
           mark_signal_requested(Signum::sigInit),
           sweep_signal_disabled(false),
           sweep_signal_requested(false),
-          clear_local_allocator(false)
+          clear_local_allocator(false),
+          pending_batch()
       {}
 
       ~in_memory_thread_struct() {
@@ -187,6 +205,43 @@ namespace mpgc {
       }
     };
 
+    /*
+     * Keeps a copy of the thread's pending batch for the life of a
+     * make_gc_n() call and puts it back when the call ends, whether or
+     * not a constructor threw. The copy is reachable through outer in
+     * the meantime. count is always zeroed before begin and stride
+     * change, so the signal handler never pairs a count with the wrong
+     * run.
+     */
+    class pending_batch_scope {
+      in_memory_thread_struct &_ts;
+      const allocation_batch _saved;
+    public:
+      explicit pending_batch_scope(in_memory_thread_struct &ts)
+        : _ts(ts), _saved(ts.pending_batch)
+      {
+        std::atomic_signal_fence(std::memory_order_release);
+        _ts.pending_batch.outer = &_saved;
+        std::atomic_signal_fence(std::memory_order_release);
+      }
+
+      pending_batch_scope(const pending_batch_scope &) = delete;
+      pending_batch_scope &operator=(const pending_batch_scope &) = delete;
+
+      ~pending_batch_scope() {
+        allocation_batch &batch = _ts.pending_batch;
+        batch.count = 0;
+        std::atomic_signal_fence(std::memory_order_release);
+        batch.begin = _saved.begin;
+        batch.stride = _saved.stride;
+        std::atomic_signal_fence(std::memory_order_release);
+        batch.count = _saved.count;
+        std::atomic_signal_fence(std::memory_order_release);
+        batch.outer = _saved.outer;
+        std::atomic_signal_fence(std::memory_order_release);
+      }
+    };
+
     typedef ruts::sequential_lazy_delete_collection<in_memory_thread_struct, std::allocator<in_memory_thread_struct>> in_memory_thread_struct_list_type;
     extern in_memory_thread_struct_list_type thread_struct_list;
 
@@ -34,11 +34,14 @@
 #ifndef GC_INTERNED_STRING_H_
 #define GC_INTERNED_STRING_H_
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <type_traits>
 #include <ostream>
+#include <iterator>
 
 #include "ruts/uniform_key.h"
 #include "mpgc/gc.h"
@@ -135,8 +138,9 @@ namespace mpgc {
       return d;
     }
 
+  private:
     template <typename Iter>
-    value_type intern(const Iter &from, const Iter &to) {
+    static key_type key_for(const Iter &from, const Iter &to) {
       using namespace ruts;
       /*
        * Whatever the iterator, we want to treat it as if it's pointing to a char16_t;
@@ -146,12 +150,92 @@ namespace mpgc {
         accums.first.add(c);
         accums.second.add(c);
       }
-      uniform_key key{accums};
+      return uniform_key{accums};
+    }
+
+    /*
+     * Contiguous char and char16_t input.  The keys have to be the
+     * same as the ones computed above (other processes find strings
+     * by them), so this is the same masher step, but with both hashes
+     * kept in locals and read straight off the pointer rather than
+     * through range_over().  Each hash is a serial chain, so this
+     * doesn't vectorize; the two chains are independent, though, so
+     * their table loads can overlap.
+     */
+    template <typename C>
+    static key_type key_for_contiguous(const C *from, const C *to) {
+      using namespace ruts;
+      std::pair<masher::accumulator_type, masher::accumulator_type> accums = uniform_key::accumulators();
+      const auto &hi_table = accums.first.table;
+      const auto &lo_table = accums.second.table;
+      masher::hash_type hi = accums.first.hash;
+      masher::hash_type lo = accums.second.hash;
+      auto step = [&](char16_t c) {
+        hi = ruts::rotate(hi) + hi_table[c];
+        lo = ruts::rotate(lo) + lo_table[c];
+      };
+      for (; from != to; ++from) {
+        step(*from);
+      }
+      accums.first.hash = hi;
+      accums.second.hash = lo;
+      return uniform_key{accums};
+    }
+    static key_type key_for(const char *from, const char *to) {
+      return key_for_contiguous(from, to);
+    }
+    static key_type key_for(const char16_t *from, const char16_t *to) {
+      return key_for_contiguous(from, to);
+    }
+
+    /*
+     * Literals tend to be interned over and over from the same call
+     * sites, so each thread remembers the keys of the last few short
+     * ones it's seen, along with a copy of their characters.  The
+     * array overloads below are also handed stack and other mutable
+     * buffers, so a hit on address and length alone isn't trusted
+     * until the characters are compared, which is still much cheaper
+     * than hashing them.  Only the key is cached, not the interned
+     * string: the key doesn't depend on the table, and nothing in
+     * thread-local storage is seen by the collector.
+     */
+    template <typename C>
+    static key_type literal_key(const C *chars, std::size_t len) {
+      constexpr std::size_t max_cached_len = 32;
+      if (len > max_cached_len) {
+        return key_for(chars, chars+len);
+      }
+      struct cached {
+        const void *chars;
+        std::size_t len;
+        C copy[max_cached_len];
+        key_type key;
+      };
+      constexpr std::size_t n_cached = 64;
+      static thread_local cached cache[n_cached];
+      std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(chars);
+      cached &c = cache[((addr >> 4) ^ (addr >> 10) ^ len) % n_cached];
+      if (c.chars != chars || c.len != len || !std::equal(chars, chars+len, c.copy)) {
+        c.key = key_for(chars, chars+len);
+        std::copy(chars, chars+len, c.copy);
+        c.chars = chars;
+        c.len = len;
+      }
+      return c.key;
+    }
+
+    template <typename Iter>
+    value_type lookup_or_add(const key_type &key, const Iter &from, const Iter &to) {
       gc_ptr<const keyed_string_type> s = _map->get(key);
       if (s != nullptr) {
         return s;
       }
-      s = make_gc<keyed_string_type>(key, from, to);
+      return add(key, from, to);
+    }
+
+    template <typename Iter>
+    value_type add(const key_type &key, const Iter &from, const Iter &to) {
+      gc_ptr<const keyed_string_type> s = make_gc<keyed_string_type>(key, from, to);
       auto rr = _map->put_new(key, s);
       // if
       if (rr.had_value) {
@@ -162,6 +246,37 @@ namespace mpgc {
       }
     }
 
+  public:
+    template <typename Iter>
+    value_type intern(const Iter &from, const Iter &to) {
+      return lookup_or_add(key_for(from, to), from, to);
+    }
+
+    /*
+     * Interns each string in [from, to), writing the results to out,
+     * and returns the advanced out.  The strings can be anything
+     * with begin() and end().  The keys for a batch are computed
+     * first and looked up together with get_many(), so the probes
+     * overlap.  StrIter must be a forward iterator.
+     */
+    template <typename StrIter, typename OutIter>
+    OutIter intern_many(StrIter from, StrIter to, OutIter out) {
+      constexpr std::size_t batch_size = 16;
+      key_type keys[batch_size];
+      value_type found[batch_size];
+      while (from != to) {
+        std::size_t n = 0;
+        for (StrIter it = from; it != to && n < batch_size; ++it, ++n) {
+          keys[n] = key_for(std::begin(*it), std::end(*it));
+        }
+        _map->get_many(keys, keys+n, found);
+        for (std::size_t i = 0; i < n; i++, ++from, ++out) {
+          *out = found[i] != nullptr ? found[i] : add(keys[i], std::begin(*from), std::end(*from));
+        }
+      }
+      return out;
+    }
+
     value_type intern(const char *chars, std::size_t len) {
       return intern(chars, chars+len);
     }
@@ -169,7 +284,7 @@ namespace mpgc {
     // This is assumed to be a literal string (with a null byte at the end)
     template <std::size_t N>
     value_type intern(const char (&chars)[N]) {
-      return intern(chars, N-1);
+      return lookup_or_add(literal_key(chars, N-1), &chars[0], &chars[N-1]);
     }
 
     value_type intern(const char16_t *chars, std::size_t len) {
@@ -178,7 +293,7 @@ namespace mpgc {
     // This is assumed to be a literal string (with a null byte at the end)
     template <std::size_t N>
     value_type intern(const char16_t (&chars)[N]) {
-      return intern(chars, N-1);
+      return lookup_or_add(literal_key(chars, N-1), &chars[0], &chars[N-1]);
     }
 
     value_type intern(const wchar_t *chars, std::size_t len) {
@@ -192,7 +307,7 @@ namespace mpgc {
 
     template <typename C, typename T, typename A>
     value_type intern(const std::basic_string<C,T,A> &s) {
-      return intern(s.begin(), s.end());
+      return intern(s.data(), s.data()+s.size());
     }
 
   };
@@ -0,0 +1,350 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the 
+ *  Application containing code generated by the Library and added to the 
+ *  Application during this compilation process under terms of your choice, 
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+
+/*
+ * gc_mpmc_queue.h
+ *
+ * A bounded FIFO queue of gc_ptrs in the GC heap that any number of
+ * threads (in any number of processes) can push to and pop from
+ * without locking.
+ *
+ * The queue is a ring of slots, each holding a sequence number and a
+ * value, as in Vyukov's bounded MPMC queue.  The slot for position p
+ * has sequence number p when it's free for the push at p, and p+1
+ * once that push has filled it.  The pop at p empties it and sets
+ * the sequence number to p+capacity, freeing it for the push a lap
+ * later.
+ *
+ * Unlike the usual form, a push or pop doesn't first claim its
+ * position and then write the slot.  It changes the slot (sequence
+ * number and value together) with a single 16-byte CAS, and only
+ * then moves the shared position forward, which anybody who sees the
+ * slot already changed will do on its behalf.  So there's no window
+ * in which a process that dies leaves a position claimed but never
+ * filled or emptied, and a dying process can't wedge the queue.  (A
+ * value popped by a process that then dies is, of course, gone.)
+ *
+ * push() and pop() block by waiting on a futex on the 32-bit counts
+ * of pushes and pops, which live in the heap, so waiters in one
+ * process are woken by pushes and pops in another.  Waits are
+ * bounded by wait_slice, so a waiter that misses a wake (or whose
+ * waker died) just looks again.  A process that dies while waiting
+ * leaves the waiter count high, which only costs others a spurious
+ * wake call.
+ */
+
+#ifndef GC_MPMC_QUEUE_H_
+#define GC_MPMC_QUEUE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <ctime>
+#include <cassert>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "mpgc/gc.h"
+#include "ruts/atomic16B.h"
+
+namespace mpgc {
+  /*
+   * The value word of a gc_mpmc_queue slot.  It holds a gc_ptr in its
+   * primitive representation and is traced as a reference.
+   */
+  struct mpmc_queue_word {
+    std::uint64_t bits;
+  };
+
+  template <>
+  struct gc_traits<mpmc_queue_word> : is_ref_descriptor {};
+
+  template <typename T>
+  class gc_mpmc_queue : public gc_allocated {
+  public:
+    using value_type = gc_ptr<T>;
+    using size_type = std::size_t;
+    constexpr static std::chrono::milliseconds wait_slice{10};
+  private:
+    using ptr_traits = std::versioned_pointer_traits<value_type>;
+
+    struct alignas(16) cell {
+      std::uint64_t seq;
+      mpmc_queue_word val;
+
+      value_type value() const {
+        return ptr_traits::from_prim_rep(val.bits);
+      }
+
+      static cell holding(std::uint64_t seq, const value_type &v) {
+        return cell{seq, mpmc_queue_word{ptr_traits::to_prim_rep(v)}};
+      }
+
+      static const auto &descriptor() {
+        static gc_descriptor d =
+          GC_DESC(cell)
+          .template WITH_FIELD(&cell::seq)
+          .template WITH_FIELD(&cell::val);
+        return d;
+      }
+    };
+
+    struct slot_type : ruts::atomic16B<cell> {
+      using base = ruts::atomic16B<cell>;
+      using base::base;
+      static const auto &descriptor() {
+        return cell::descriptor();
+      }
+    };
+    static_assert(sizeof(slot_type) == sizeof(cell), "slot_type must be the same size as a cell");
+
+    using counter_type = std::atomic<std::uint32_t>;
+    static_assert(sizeof(counter_type) == sizeof(int), "futex words must be 32 bits");
+
+    const std::uint64_t _mask;
+    const gc_array_ptr<slot_type> _slots;
+    std::atomic<std::uint64_t> _enqueue_pos{0};
+    std::atomic<std::uint64_t> _dequeue_pos{0};
+    counter_type _pushes{0};
+    counter_type _pops{0};
+    counter_type _push_waiters{0};
+    counter_type _pop_waiters{0};
+
+    static std::uint64_t round_up(size_type n) {
+      std::uint64_t c = 1;
+      while (c < n) {
+        c <<= 1;
+      }
+      return c;
+    }
+
+    static bool change(slot_type &slot, cell &expected, const cell &desired) {
+      bool ret;
+      write_barrier(expected.value().as_offset_pointer(),
+                    desired.value().as_offset_pointer(),
+                    [&] {
+                      ret = slot.compare_exchange_strong(expected, desired);
+                    });
+      dirty_tracking::note(&slot);
+      return ret;
+    }
+
+    /*
+     * Moves pos from p to p+1, if nobody has yet.
+     */
+    static void advance(std::atomic<std::uint64_t> &pos, std::uint64_t p) {
+      pos.compare_exchange_strong(p, p+1);
+    }
+
+    /*
+     * Not FUTEX_WAIT_PRIVATE, since the word may be shared with other
+     * processes.
+     */
+    static void futex_wait(counter_type &word, std::uint32_t seen,
+                           std::chrono::nanoseconds timeout)
+    {
+      auto secs = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+      struct timespec ts;
+      ts.tv_sec = secs.count();
+      ts.tv_nsec = (timeout - secs).count();
+      syscall(SYS_futex, reinterpret_cast<int*>(&word), FUTEX_WAIT, seen, &ts, nullptr, 0);
+    }
+
+    static void notify(counter_type &word, counter_type &waiters) {
+      word.fetch_add(1);
+      if (waiters.load() != 0) {
+        syscall(SYS_futex, reinterpret_cast<int*>(&word), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+      }
+    }
+
+    /*
+     * Calls attempt() until it succeeds or deadline passes, sleeping
+     * on word (which notify() bumps whenever attempt() may have
+     * started to succeed) between tries.
+     */
+    template <typename Fn>
+    static bool wait_until(counter_type &word, counter_type &waiters,
+                           std::chrono::steady_clock::time_point deadline,
+                           Fn &&attempt)
+    {
+      while (true) {
+        std::uint32_t seen = word.load();
+        if (attempt()) {
+          return true;
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+          return false;
+        }
+        std::chrono::nanoseconds timeout = std::min<std::chrono::nanoseconds>(deadline - now, wait_slice);
+        waiters.fetch_add(1);
+        futex_wait(word, seen, timeout);
+        waiters.fetch_sub(1);
+      }
+    }
+
+  public:
+    /*
+     * The capacity is rounded up to a power of two, and to at least
+     * two.  With a single slot, p+capacity (emptied) would be p+1
+     * (filled), so a popper could take an empty slot for a full one.
+     */
+    explicit gc_mpmc_queue(gc_token &gc, size_type capacity = 1024)
+      : gc_allocated{gc},
+        _mask{round_up(std::max<size_type>(capacity, 2)) - 1},
+        _slots{make_gc_array<slot_type>(_mask + 1)}
+    {
+      for (std::uint64_t i = 0; i <= _mask; i++) {
+        (*_slots)[i].store(cell{i, mpmc_queue_word{0}});
+      }
+    }
+
+    static const auto &descriptor() {
+      static gc_descriptor d =
+        GC_DESC(gc_mpmc_queue)
+        .template WITH_FIELD(&gc_mpmc_queue::_mask)
+        .template WITH_FIELD(&gc_mpmc_queue::_slots)
+        .template WITH_FIELD(&gc_mpmc_queue::_enqueue_pos)
+        .template WITH_FIELD(&gc_mpmc_queue::_dequeue_pos)
+        .template WITH_FIELD(&gc_mpmc_queue::_pushes)
+        .template WITH_FIELD(&gc_mpmc_queue::_pops)
+        .template WITH_FIELD(&gc_mpmc_queue::_push_waiters)
+        .template WITH_FIELD(&gc_mpmc_queue::_pop_waiters);
+      return d;
+    }
+
+    size_type capacity() const {
+      return _mask + 1;
+    }
+
+    /*
+     * Only a snapshot, since other threads may be pushing and popping.
+     */
+    size_type size() const {
+      std::uint64_t d = _dequeue_pos.load();
+      std::uint64_t e = _enqueue_pos.load();
+      return e > d ? e - d : 0;
+    }
+
+    bool empty() const {
+      return size() == 0;
+    }
+
+    /*
+     * Returns false if the queue is full.
+     */
+    bool try_push(const value_type &val) {
+      assert(val != nullptr);
+      std::uint64_t p = _enqueue_pos.load();
+      while (true) {
+        slot_type &slot = (*_slots)[p & _mask];
+        cell current = slot.load();
+        std::int64_t diff = static_cast<std::int64_t>(current.seq - p);
+        if (diff == 0) {
+          if (change(slot, current, cell::holding(p+1, val))) {
+            advance(_enqueue_pos, p);
+            notify(_pushes, _pop_waiters);
+            return true;
+          }
+        } else if (diff == 1) {
+          // Somebody filled it but hasn't moved _enqueue_pos yet.
+          advance(_enqueue_pos, p);
+        } else if (diff < 0 && _enqueue_pos.load() == p) {
+          // Still holds the value pushed a lap ago.
+          return false;
+        }
+        p = _enqueue_pos.load();
+      }
+    }
+
+    /*
+     * Returns false if the queue is empty.
+     */
+    bool try_pop(value_type &out) {
+      std::uint64_t p = _dequeue_pos.load();
+      while (true) {
+        slot_type &slot = (*_slots)[p & _mask];
+        cell current = slot.load();
+        std::int64_t diff = static_cast<std::int64_t>(current.seq - (p+1));
+        if (diff == 0) {
+          value_type val = current.value();
+          if (change(slot, current, cell::holding(p+_mask+1, nullptr))) {
+            advance(_dequeue_pos, p);
+            notify(_pops, _push_waiters);
+            out = val;
+            return true;
+          }
+        } else if (diff == static_cast<std::int64_t>(_mask)) {
+          // Somebody emptied it but hasn't moved _dequeue_pos yet.
+          advance(_dequeue_pos, p);
+        } else if (diff < 0 && _dequeue_pos.load() == p) {
+          return false;
+        }
+        p = _dequeue_pos.load();
+      }
+    }
+
+    /*
+     * Blocks while the queue is full.
+     */
+    void push(const value_type &val) {
+      wait_until(_pops, _push_waiters, std::chrono::steady_clock::time_point::max(),
+                 [&] { return try_push(val); });
+    }
+
+    /*
+     * Blocks while the queue is empty.
+     */
+    value_type pop() {
+      value_type val;
+      wait_until(_pushes, _pop_waiters, std::chrono::steady_clock::time_point::max(),
+                 [&] { return try_pop(val); });
+      return val;
+    }
+
+    template <typename Rep, typename Period>
+    bool try_push_for(const value_type &val, const std::chrono::duration<Rep, Period> &timeout) {
+      return wait_until(_pops, _push_waiters, std::chrono::steady_clock::now() + timeout,
+                        [&] { return try_push(val); });
+    }
+
+    template <typename Rep, typename Period>
+    bool try_pop_for(value_type &out, const std::chrono::duration<Rep, Period> &timeout) {
+      return wait_until(_pushes, _pop_waiters, std::chrono::steady_clock::now() + timeout,
+                        [&] { return try_pop(out); });
+    }
+  };
+
+  template <typename T>
+  constexpr std::chrono::milliseconds gc_mpmc_queue<T>::wait_slice;
+}
+
+#endif /* GC_MPMC_QUEUE_H_ */
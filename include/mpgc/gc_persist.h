@@ -0,0 +1,142 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the 
+ *  Application containing code generated by the Library and added to the 
+ *  Application during this compilation process under terms of your choice, 
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+
+/*
+ * gc_persist.h
+ *
+ * Making changes to the GC heap durable.  persist() flushes a range
+ * of the heap to the heap file right away.  sync_dirty() flushes
+ * whatever this process has changed since its last sync_dirty() (or
+ * since it attached to the heap).
+ *
+ * Changes are only tracked in code built with MPGC_DIRTY_TRACKING
+ * defined (the library and everything using it have to agree), and
+ * then only when the MPGC_TRACK_DIRTY environment variable is set.
+ * Otherwise the hooks below compile away, and sync_dirty() flushes
+ * the whole heap.  Changes are tracked per granule, a page unless
+ * MPGC_DIRTY_GRANULE_BITS says otherwise.  New objects mark their
+ * granules once they're constructed, and stores through gc_ptrs
+ * (plain or atomic) into the heap mark the granule they store into,
+ * after the store.  Other stores into existing objects (to scalar
+ * fields, say) aren't seen, so code that relies on sync_dirty() for
+ * them needs to call mark_dirty() (or persist() the object itself).
+ *
+ * sync_dirty() hands the kernel one msync() per run of dirty
+ * granules, and spreads the runs over a few threads.
+ */
+
+#ifndef GC_PERSIST_H_
+#define GC_PERSIST_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+
+#include "mpgc/gc_fwd.h"
+#include "mpgc/offset_ptr.h"
+
+namespace mpgc {
+#ifndef MPGC_DIRTY_GRANULE_BITS
+#define MPGC_DIRTY_GRANULE_BITS 12
+#endif
+
+  namespace dirty_tracking {
+    constexpr std::size_t granule_bits = MPGC_DIRTY_GRANULE_BITS;
+    static_assert(granule_bits >= 12, "A granule can't be smaller than a page");
+
+    /*
+     * One bit per granule of the heap, or nullptr if changes aren't
+     * being tracked.
+     */
+    extern std::atomic<std::uint64_t> *granules;
+
+    extern void initialize();
+
+    inline void note_granule(std::size_t g) {
+      std::atomic<std::uint64_t> &word = granules[g >> 6];
+      const std::uint64_t bit = std::uint64_t{1} << (g & 63);
+      if ((word.load(std::memory_order_relaxed) & bit) == 0) {
+        word.fetch_or(bit, std::memory_order_relaxed);
+      }
+    }
+
+    /*
+     * Records a change to the n bytes at p, if p is in the heap.
+     * Stores to gc_ptrs on the stack (or anywhere else outside the
+     * heap) fall out at the range check.
+     */
+#ifdef MPGC_DIRTY_TRACKING
+    inline void note(const volatile void *p, std::size_t n = 1) {
+      uint8_t *start = static_cast<uint8_t*>(const_cast<void*>(p));
+      if (start < base_offset_ptr::base() || start >= base_offset_ptr::end()
+          || granules == nullptr || n == 0) {
+        return;
+      }
+      std::size_t first = (start - base_offset_ptr::base()) >> granule_bits;
+      std::size_t last = (start + n - 1 - base_offset_ptr::base()) >> granule_bits;
+      for (std::size_t g = first; g <= last; g++) {
+        note_granule(g);
+      }
+    }
+#else
+    inline void note(const volatile void *, std::size_t = 1) {}
+#endif
+  }
+
+  /*
+   * Tells sync_dirty() that the n bytes at p have changed.
+   */
+  inline void mark_dirty(const void *p, std::size_t n) {
+    dirty_tracking::note(p, n);
+  }
+
+  /*
+   * Flushes the pages holding the n bytes at p to the heap file
+   * before returning.  Returns false (with errno set) if msync()
+   * failed.
+   */
+  extern bool persist(const void *p, std::size_t n);
+
+  template <typename T>
+  inline bool persist(const gc_ptr<T> &p) {
+    if (p == nullptr) {
+      return true;
+    }
+    return persist(p.as_bare_pointer(), p->get_gc_descriptor().object_size() * sizeof(std::size_t));
+  }
+
+  /*
+   * Flushes everything this process has changed (as far as it's been
+   * tracked), or the whole heap if changes aren't being tracked.
+   * Returns false if any msync() failed; the ranges that failed stay
+   * dirty, so a later call tries them again.  If n_bytes isn't null,
+   * it's set to the number of bytes handed to msync().
+   */
+  extern bool sync_dirty(std::size_t *n_bytes = nullptr);
+}
+
+#endif /* GC_PERSIST_H_ */
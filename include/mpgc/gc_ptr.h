@@ -284,6 +284,7 @@ namespace mpgc {
       write_barrier(_ptr, rhs._ptr, [&] {
         _ptr = rhs._ptr;
       });
+      dirty_tracking::note(this);
       return *this;
     }
     /**
@@ -297,6 +298,7 @@ namespace mpgc {
       write_barrier(_ptr, rhs._ptr, [&, rhs = std::move(rhs)] () mutable {
         _ptr = std::move(rhs._ptr);
       });
+      dirty_tracking::note(this);
       return *this;
     }
 
@@ -350,6 +352,7 @@ namespace mpgc {
       write_barrier(_ptr, rhs._ptr, [&] {
         _ptr = rhs._ptr;
       });
+      dirty_tracking::note(this);
       return *this;
     }
     /**
@@ -364,6 +367,7 @@ namespace mpgc {
       write_barrier(_ptr, rhs._ptr, [&, rhs = std::move(rhs)] () mutable {
         _ptr = std::move(rhs._ptr);
       });
+      dirty_tracking::note(this);
       return *this;
     }
 
@@ -414,6 +418,8 @@ namespace mpgc {
       write_barrier(other._ptr, nullptr, [&] {
         std::swap(_ptr, other._ptr);
       });
+      dirty_tracking::note(this);
+      dirty_tracking::note(&other);
     }
 
     /**
@@ -1366,6 +1372,7 @@ namespace std {
       mpgc::write_barrier(forward<OV>(old_val)().as_offset_pointer(),
                           new_v.as_offset_pointer(),
                           [&new_v, mod=forward<M>(mod)] { return mod(new_v); });
+      mpgc::dirty_tracking::note(loc);
     }
   };
 
@@ -1397,6 +1404,7 @@ namespace std {
       mpgc::write_barrier(load().as_offset_pointer(), desired.as_offset_pointer(), [&] {
         base::store(desired, order);
       });
+      mpgc::dirty_tracking::note(this);
     }
 
     void store(const mpgc::gc_ptr<T> &desired,
@@ -1405,6 +1413,7 @@ namespace std {
       mpgc::write_barrier(load().as_offset_pointer(), desired.as_offset_pointer(), [&] {
         base::store(desired, order);
       });
+      mpgc::dirty_tracking::note(this);
     }
 
     mpgc::gc_ptr<T> exchange(const mpgc::gc_ptr<T> &desired,
@@ -1414,6 +1423,7 @@ namespace std {
       mpgc::write_barrier(load().as_offset_pointer(), desired.as_offset_pointer(), [&] {
         ret = base::exchange(desired, order);
       });
+      mpgc::dirty_tracking::note(this);
       return ret;
     }
 
@@ -1424,6 +1434,7 @@ namespace std {
       mpgc::write_barrier(load().as_offset_pointer(), desired.as_offset_pointer(), [&] {
         ret = base::exchange(desired, order);
       });
+      mpgc::dirty_tracking::note(this);
       return ret;
     }
 
@@ -1437,6 +1448,7 @@ namespace std {
         ret = base::compare_exchange_weak(expected, desired,
                                           success, failure);
       });
+      mpgc::dirty_tracking::note(this);
       return ret;
     }
 
@@ -1457,6 +1469,7 @@ namespace std {
         ret = base::compare_exchange_weak(expected, desired,
                                           success, failure);
       });
+      mpgc::dirty_tracking::note(this);
       return ret;
     }
 
@@ -1482,6 +1495,7 @@ namespace std {
         ret = base::compare_exchange_strong(expected, desired,
                                             success, failure);
       });
+      mpgc::dirty_tracking::note(this);
       return ret;
     }
 
@@ -1502,6 +1516,7 @@ namespace std {
         ret = base::compare_exchange_strong(expected, desired,
                                             success, failure);
       });
+      mpgc::dirty_tracking::note(this);
       return ret;
     }
 
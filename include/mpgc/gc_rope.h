@@ -0,0 +1,588 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the 
+ *  Application containing code generated by the Library and added to the 
+ *  Application during this compilation process under terms of your choice, 
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+/*
+ * gc_rope.h
+ *
+ * An immutable string whose characters are shared in the GC heap.
+ * Taking a substring makes a slice (an array, an offset, and a
+ * length) of the characters already there, and concatenation makes a
+ * node pointing to its two halves, so neither copies anything.  Since
+ * the GC keeps the arrays alive as long as anything refers to them,
+ * the sharing is safe.  The characters are only copied into one
+ * array when somebody asks for them contiguously (data() or c_str()),
+ * and a concatenation remembers the result.
+ *
+ * For a mutable string, use gc_basic_string.
+ */
+
+#ifndef GC_ROPE_H_
+#define GC_ROPE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <algorithm>
+#include <string>
+#include <ostream>
+#include <stdexcept>
+
+#include "mpgc/gc.h"
+#include "mpgc/gc_string.h"
+
+namespace mpgc {
+  template <typename CharT>
+  class gc_rope_node : public gc_allocated {
+  public:
+    using size_type = std::size_t;
+    using chars_ptr = gc_array_ptr<CharT>;
+    using node_ptr = gc_ptr<const gc_rope_node>;
+    /*
+     * Concatenations shorter than this are copied rather than
+     * linked, and ones deeper than max_depth are flattened.
+     */
+    constexpr static size_type min_link_length = 64;
+    constexpr static size_type max_depth = 48;
+  private:
+    /*
+     * A slice is the _length characters in _chars starting at
+     * _offset.  A concatenation has _left and _right, and its _chars
+     * is null until it's flattened.  Any array this class allocates
+     * has a null after its last character, so a node that runs to the
+     * end of its array is null-terminated.  A slice that doesn't is
+     * copied into _terminated the first time c_str() is asked for.
+     */
+    mutable std::atomic<chars_ptr> _chars;
+    mutable std::atomic<chars_ptr> _terminated{nullptr};
+    const node_ptr _left;
+    const node_ptr _right;
+    const size_type _offset;
+    const size_type _length;
+    const size_type _depth;
+
+    static chars_ptr new_chars(size_type n) {
+      return make_gc_array<CharT>(n+1);
+    }
+
+  public:
+    gc_rope_node(gc_token &gc, const chars_ptr &chars, size_type offset, size_type length)
+      : gc_allocated{gc}, _chars{chars}, _offset{offset}, _length{length}, _depth{0}
+    {}
+    gc_rope_node(gc_token &gc, const node_ptr &left, const node_ptr &right)
+      : gc_allocated{gc}, _chars{nullptr}, _left{left}, _right{right},
+        _offset{0}, _length{left->length()+right->length()},
+        _depth{1+std::max(left->depth(), right->depth())}
+    {}
+
+    static const auto &descriptor() {
+      static gc_descriptor d =
+	GC_DESC(gc_rope_node)
+	.template WITH_FIELD(&gc_rope_node::_chars)
+	.template WITH_FIELD(&gc_rope_node::_terminated)
+	.template WITH_FIELD(&gc_rope_node::_left)
+	.template WITH_FIELD(&gc_rope_node::_right)
+	.template WITH_FIELD(&gc_rope_node::_offset)
+	.template WITH_FIELD(&gc_rope_node::_length)
+	.template WITH_FIELD(&gc_rope_node::_depth);
+      return d;
+    }
+
+    size_type length() const {
+      return _length;
+    }
+    size_type depth() const {
+      return _depth;
+    }
+
+    /*
+     * Calls fn(p, n) for each contiguous run of the characters in
+     * [pos, pos+count), in order.
+     */
+    template <typename Fn>
+    void for_each_chunk(size_type pos, size_type count, Fn &&fn) const {
+      if (count == 0) {
+        return;
+      }
+      chars_ptr chars = _chars.load();
+      if (chars != nullptr) {
+        fn(&(*chars)[_offset+pos], count);
+        return;
+      }
+      size_type left_len = _left->length();
+      if (pos < left_len) {
+        size_type n = std::min(count, left_len-pos);
+        _left->for_each_chunk(pos, n, fn);
+        pos += n;
+        count -= n;
+      }
+      _right->for_each_chunk(pos-left_len, count, fn);
+    }
+
+    CharT at(size_type pos) const {
+      const gc_rope_node *n = this;
+      for (chars_ptr chars = n->_chars.load(); chars == nullptr; chars = n->_chars.load()) {
+        size_type left_len = n->_left->length();
+        if (pos < left_len) {
+          n = n->_left.as_bare_pointer();
+        } else {
+          pos -= left_len;
+          n = n->_right.as_bare_pointer();
+        }
+      }
+      return (*n->_chars.load())[n->_offset+pos];
+    }
+
+    void copy_to(CharT *dest, size_type pos, size_type count) const {
+      for_each_chunk(pos, count, [&dest](const CharT *p, size_type n) {
+          std::copy_n(p, n, dest);
+          dest += n;
+        });
+    }
+
+    /*
+     * The characters, contiguously.  A concatenation is flattened the
+     * first time, and the result is kept.  If two threads race, they
+     * both flatten, and they both use whichever array got installed.
+     */
+    const CharT *data() const {
+      chars_ptr chars = _chars.load();
+      if (chars == nullptr) {
+        chars_ptr flat = new_chars(_length);
+        copy_to(&(*flat)[0], 0, _length);
+        chars = _chars.compare_exchange_strong(chars, flat) ? flat : chars;
+      }
+      return &(*chars)[_offset];
+    }
+
+    bool is_null_terminated() const {
+      chars_ptr chars = _chars.load();
+      return chars != nullptr && _offset+_length+1 == chars.size();
+    }
+
+    /*
+     * The characters followed by a null.  Flattening always leaves a
+     * concatenation null-terminated, so only a slice that stops short
+     * of the end of its array needs a copy, and as with data(), the
+     * first one installed is the one everybody uses.
+     */
+    const CharT *c_str() const {
+      const CharT *p = data();
+      if (is_null_terminated()) {
+        return p;
+      }
+      chars_ptr terminated = _terminated.load();
+      if (terminated == nullptr) {
+        chars_ptr copy = new_chars(_length);
+        std::copy_n(p, _length, &(*copy)[0]);
+        terminated = _terminated.compare_exchange_strong(terminated, copy) ? copy : terminated;
+      }
+      return &(*terminated)[0];
+    }
+
+    static node_ptr from_chars(const CharT *p, size_type n) {
+      if (n == 0) {
+        return nullptr;
+      }
+      chars_ptr chars = new_chars(n);
+      std::copy_n(p, n, &(*chars)[0]);
+      return make_gc<gc_rope_node>(chars, 0, n);
+    }
+
+    static node_ptr slice(const node_ptr &node, size_type pos, size_type count) {
+      if (count == 0) {
+        return nullptr;
+      }
+      if (pos == 0 && count == node->length()) {
+        return node;
+      }
+      chars_ptr chars = node->_chars.load();
+      if (chars != nullptr) {
+        return make_gc<gc_rope_node>(chars, node->_offset+pos, count);
+      }
+      const node_ptr &left = node->_left;
+      size_type left_len = left->length();
+      if (pos+count <= left_len) {
+        return slice(left, pos, count);
+      }
+      if (pos >= left_len) {
+        return slice(node->_right, pos-left_len, count);
+      }
+      return concat(slice(left, pos, left_len-pos),
+                    slice(node->_right, 0, pos+count-left_len));
+    }
+
+    static node_ptr concat(const node_ptr &left, const node_ptr &right) {
+      if (left == nullptr) {
+        return right;
+      }
+      if (right == nullptr) {
+        return left;
+      }
+      size_type len = left->length()+right->length();
+      if (len >= min_link_length
+          && std::max(left->depth(), right->depth()) < max_depth)
+      {
+        return make_gc<gc_rope_node>(left, right);
+      }
+      chars_ptr chars = new_chars(len);
+      CharT *p = &(*chars)[0];
+      left->copy_to(p, 0, left->length());
+      right->copy_to(p+left->length(), 0, right->length());
+      return make_gc<gc_rope_node>(chars, 0, len);
+    }
+  };
+
+  template <typename CharT, typename Traits = std::char_traits<CharT>, typename PC = internal_pointers>
+  class gc_basic_rope {
+    template <typename C,typename T,typename P> friend class gc_basic_rope;
+    using node_type = gc_rope_node<CharT>;
+    using node_ptr = typename node_type::node_ptr;
+    template <typename Alloc> using std_string = std::basic_string<CharT, Traits, Alloc>;
+  public:
+    using traits_type = Traits;
+    using value_type = CharT;
+    using size_type = long;
+    constexpr static size_type npos = -1;
+  private:
+    /*
+     * Null for the empty string.
+     */
+    typename PC::template ptr_t<const node_type> _node;
+
+    explicit gc_basic_rope(const node_ptr &node) : _node{node} {}
+
+    node_ptr node() const {
+      return _node;
+    }
+
+    [[noreturn]] void throw_out_of_range(size_type pos, size_type n) const {
+      throw std::out_of_range("Pos: " + std::to_string(pos) + "; len: " + std::to_string(n));
+    }
+
+    size_type range_length(size_type pos, size_type count) const {
+      size_type n = size();
+      if (pos < 0 || pos > n) {
+        throw_out_of_range(pos, n);
+      }
+      if (count == npos || pos+count > n) {
+        count = n-pos;
+      }
+      return count;
+    }
+
+  public:
+    gc_basic_rope() noexcept {}
+    gc_basic_rope(const value_type *s, size_type count)
+      : _node{node_type::from_chars(s, count)}
+    {}
+    gc_basic_rope(const value_type *s)
+      : gc_basic_rope(s, traits_type::length(s))
+    {}
+    template <typename Alloc>
+    gc_basic_rope(const std_string<Alloc> &s)
+      : gc_basic_rope(s.data(), s.size())
+    {}
+    template <typename PC2>
+    gc_basic_rope(const gc_basic_string<CharT,Traits,PC2> &s)
+      : gc_basic_rope(s.cbegin().as_bare_pointer(), s.size())
+    {}
+    template <typename PC2>
+    gc_basic_rope(const gc_basic_rope<CharT,Traits,PC2> &other)
+      : _node{other.node()}
+    {}
+    template <typename PC2>
+    gc_basic_rope(const gc_basic_rope<CharT,Traits,PC2> &other,
+                  size_type pos, size_type count = npos)
+      : gc_basic_rope(other.substr(pos, count))
+    {}
+
+    static const auto &descriptor() {
+      static gc_descriptor d =
+	GC_DESC(gc_basic_rope)
+	.template WITH_FIELD(&gc_basic_rope::_node);
+      return d;
+    }
+
+    size_type size() const {
+      node_ptr n = node();
+      return n == nullptr ? 0 : n->length();
+    }
+    size_type length() const {
+      return size();
+    }
+    bool empty() const {
+      return _node == nullptr;
+    }
+
+    value_type operator[](size_type pos) const {
+      return node()->at(pos);
+    }
+    value_type at(size_type pos) const {
+      if (pos < 0 || pos >= size()) {
+        throw_out_of_range(pos, size());
+      }
+      return (*this)[pos];
+    }
+
+    /*
+     * Shares the characters with this string.
+     */
+    gc_basic_rope substr(size_type pos = 0, size_type count = npos) const {
+      size_type n = range_length(pos, count);
+      return gc_basic_rope{n == 0 ? nullptr : node_type::slice(node(), pos, n)};
+    }
+
+    template <typename PC2>
+    gc_basic_rope &append(const gc_basic_rope<CharT,Traits,PC2> &other) {
+      _node = node_type::concat(node(), other.node());
+      return *this;
+    }
+    gc_basic_rope &append(const value_type *s, size_type count) {
+      return append(gc_basic_rope{s, count});
+    }
+    gc_basic_rope &append(const value_type *s) {
+      return append(gc_basic_rope{s});
+    }
+
+    template <typename PC2>
+    gc_basic_rope &operator +=(const gc_basic_rope<CharT,Traits,PC2> &other) {
+      return append(other);
+    }
+    gc_basic_rope &operator +=(const value_type *s) {
+      return append(s);
+    }
+    template <typename Alloc>
+    gc_basic_rope &operator +=(const std_string<Alloc> &s) {
+      return append(gc_basic_rope{s});
+    }
+
+    /*
+     * WARNING: As with gc_basic_string, the pointers handed out by
+     * data() and c_str() are not anchored.  They're good as long as
+     * this rope is (and isn't assigned to).
+     *
+     * data() flattens a concatenation, but a slice is already
+     * contiguous.  c_str() also needs the null, so a slice that stops
+     * short of the end of its array is copied (once, and the copy is
+     * kept in the node) into one that doesn't.
+     */
+    const value_type *data() const {
+      node_ptr n = node();
+      if (n == nullptr) {
+        static const value_type empty{};
+        return &empty;
+      }
+      return n->data();
+    }
+
+    const value_type *c_str() const {
+      node_ptr n = node();
+      return n == nullptr ? data() : n->c_str();
+    }
+
+    template <typename Fn>
+    void for_each_chunk(Fn &&fn) const {
+      node_ptr n = node();
+      if (n != nullptr) {
+        n->for_each_chunk(0, n->length(), std::forward<Fn>(fn));
+      }
+    }
+
+    template <typename Iter>
+    size_type copy(Iter dest, size_type count, size_type pos = 0) const {
+      size_type n = range_length(pos, count);
+      if (n > 0) {
+        node()->for_each_chunk(pos, n, [&dest](const value_type *p, std::size_t k) {
+            dest = std::copy_n(p, k, dest);
+          });
+      }
+      return n;
+    }
+
+    size_type find(value_type ch, size_type pos = 0) const {
+      size_type n = size();
+      if (pos >= n) {
+        return npos;
+      }
+      size_type found = npos;
+      size_type chunk_pos = pos;
+      node()->for_each_chunk(pos, n-pos, [&](const value_type *p, std::size_t k) {
+          if (found != npos) {
+            return;
+          }
+          const value_type *hit = traits_type::find(p, k, ch);
+          if (hit != nullptr) {
+            found = chunk_pos + (hit-p);
+          }
+          chunk_pos += k;
+        });
+      return found;
+    }
+
+    size_type find(const value_type *s, size_type pos, size_type count) const {
+      size_type n = size();
+      if (count == 0) {
+        return pos <= n ? pos : npos;
+      }
+      if (pos > n || count > n-pos) {
+        return npos;
+      }
+      const value_type *p = data();
+      for (size_type i = pos; i <= n-count; i++) {
+        if (traits_type::compare(p+i, s, count) == 0) {
+          return i;
+        }
+      }
+      return npos;
+    }
+    size_type find(const value_type *s, size_type pos = 0) const {
+      return find(s, pos, traits_type::length(s));
+    }
+
+    template <typename PC2>
+    int compare(const gc_basic_rope<CharT,Traits,PC2> &other) const {
+      if (node() == other.node()) {
+        return 0;
+      }
+      size_type n1 = size();
+      size_type n2 = other.size();
+      int cmp = traits_type::compare(data(), other.data(), std::min(n1, n2));
+      return cmp != 0 ? cmp : (n1 < n2 ? -1 : n1 > n2 ? 1 : 0);
+    }
+    /*
+     * Walks the chunks against s, so neither side gets flattened or
+     * copied.
+     */
+    int compare(const value_type *s) const {
+      size_type n1 = size();
+      size_type n2 = traits_type::length(s);
+      size_type n = std::min(n1, n2);
+      int cmp = 0;
+      if (n > 0) {
+        node()->for_each_chunk(0, n, [&](const value_type *p, std::size_t k) {
+            if (cmp == 0) {
+              cmp = traits_type::compare(p, s, k);
+              s += k;
+            }
+          });
+      }
+      return cmp != 0 ? cmp : (n1 < n2 ? -1 : n1 > n2 ? 1 : 0);
+    }
+
+    gc_basic_string<CharT,Traits,PC> str() const {
+      return gc_basic_string<CharT,Traits,PC>(data(), size());
+    }
+  };
+
+  template <typename C, typename T, typename PC, typename PC2>
+  inline
+  gc_basic_rope<C,T,PC>
+  operator +(const gc_basic_rope<C,T,PC> &lhs,
+             const gc_basic_rope<C,T,PC2> &rhs)
+  {
+    gc_basic_rope<C,T,PC> res(lhs);
+    res += rhs;
+    return res;
+  }
+
+  template <typename C, typename T, typename PC>
+  inline
+  gc_basic_rope<C,T,PC>
+  operator +(const gc_basic_rope<C,T,PC> &lhs, const C *rhs)
+  {
+    gc_basic_rope<C,T,PC> res(lhs);
+    res += rhs;
+    return res;
+  }
+
+  template <typename C, typename T, typename PC>
+  inline
+  gc_basic_rope<C,T,PC>
+  operator +(const C *lhs, const gc_basic_rope<C,T,PC> &rhs)
+  {
+    gc_basic_rope<C,T,PC> res(lhs);
+    res += rhs;
+    return res;
+  }
+
+  template <typename C, typename T, typename PC, typename PC2>
+  inline
+  bool operator ==(const gc_basic_rope<C,T,PC> &lhs,
+                   const gc_basic_rope<C,T,PC2> &rhs)
+  {
+    return lhs.size() == rhs.size() && lhs.compare(rhs) == 0;
+  }
+  template <typename C, typename T, typename PC, typename PC2>
+  inline
+  bool operator !=(const gc_basic_rope<C,T,PC> &lhs,
+                   const gc_basic_rope<C,T,PC2> &rhs)
+  {
+    return !(lhs == rhs);
+  }
+  template <typename C, typename T, typename PC, typename PC2>
+  inline
+  bool operator <(const gc_basic_rope<C,T,PC> &lhs,
+                  const gc_basic_rope<C,T,PC2> &rhs)
+  {
+    return lhs.compare(rhs) < 0;
+  }
+  template <typename C, typename T, typename PC>
+  inline
+  bool operator ==(const gc_basic_rope<C,T,PC> &lhs, const C *rhs)
+  {
+    return lhs.compare(rhs) == 0;
+  }
+  template <typename C, typename T, typename PC>
+  inline
+  bool operator !=(const gc_basic_rope<C,T,PC> &lhs, const C *rhs)
+  {
+    return lhs.compare(rhs) != 0;
+  }
+
+  template <typename C, typename T, typename PC, typename SC, typename ST>
+  inline
+  std::basic_ostream<SC,ST> &
+  operator <<(std::basic_ostream<SC,ST> &os,
+              const gc_basic_rope<C,T,PC> &r)
+  {
+    r.for_each_chunk([&os](const C *p, std::size_t n) {
+        os.write(p, n);
+      });
+    return os;
+  }
+
+  using gc_rope = gc_basic_rope<char, std::char_traits<char>, internal_pointers>;
+  using gc_wrope = gc_basic_rope<wchar_t, std::char_traits<wchar_t>, internal_pointers>;
+  using gc_uc16rope = gc_basic_rope<char16_t, std::char_traits<char16_t>, internal_pointers>;
+  using gc_uc32rope = gc_basic_rope<char32_t, std::char_traits<char32_t>, internal_pointers>;
+
+  using external_gc_rope = gc_basic_rope<char, std::char_traits<char>, external_pointers>;
+  using external_gc_wrope = gc_basic_rope<wchar_t, std::char_traits<wchar_t>, external_pointers>;
+  using external_gc_uc16rope = gc_basic_rope<char16_t, std::char_traits<char16_t>, external_pointers>;
+  using external_gc_uc32rope = gc_basic_rope<char32_t, std::char_traits<char32_t>, external_pointers>;
+}
+
+#endif /* GC_ROPE_H_ */
@@ -33,6 +33,7 @@
 #include <map>
 #include <stack>
 #include <atomic>
+#include <array>
 #include "mpgc/gc_fwd.h"
 #include "mpgc/offset_ptr.h"
 
@@ -82,18 +83,25 @@ namespace mpgc {
 
     class local_chunk {
       std::size_t _size;
-      local_chunk* _next;
+      /* The low bit of _next says that everything in the chunk after
+       * these two words is known to be zero.
+       */
+      std::uintptr_t _next;
+      constexpr static std::uintptr_t zeroed_bit = 1;
 
      public:
       local_chunk() = delete;
       local_chunk(const local_chunk&) = default;
-      local_chunk(std::size_t size, local_chunk* other) : _size(size), _next(other)
+      local_chunk(std::size_t size, local_chunk* other, bool zeroed = false)
+        : _size(size), _next(reinterpret_cast<std::uintptr_t>(other) | (zeroed ? zeroed_bit : 0))
       {}
 
-      local_chunk* &next() { return _next;}
-      local_chunk* next() const { return _next;}
+      local_chunk* next() const { return reinterpret_cast<local_chunk*>(_next & ~zeroed_bit);}
       std::size_t size() const { return _size; }
-      void set_next(local_chunk* n) { _next = n; }
+      bool zeroed() const { return _next & zeroed_bit; }
+      void set_next(local_chunk* n) {
+        _next = reinterpret_cast<std::uintptr_t>(n) | (_next & zeroed_bit);
+      }
     };
 
     class global_chunk {
@@ -219,6 +227,27 @@ namespace mpgc {
       offset_ptr<skip_node> fast_lookup_cache[nr_slots];
       ruts::atomic16B<chunk_expansion_slot> chunk_expansion_slots[nr_slots];
 
+      /* Two-level bitmap of the fast_lookup_cache entries whose nodes have
+       * chunks, as in TLSF: bit i of cache_bins is set while slot i's node
+       * has chunks, and bit w of cache_groups while cache_bins[w] is
+       * non-zero. A best-fit lookup that misses its exact slot then needs
+       * two bit scans rather than a walk over the rest of the cache. The
+       * bits are hints: a chunk pushed onto a node sets its bit, taking a
+       * node's last chunk clears it, and a lookup that still lands on an
+       * empty node moves on to the next set bit.
+       */
+      constexpr static std::size_t nr_cache_bin_words = nr_slots / bits_in_word();
+      static_assert(nr_cache_bin_words <= bits_in_word(), "cache_groups must fit in a word");
+      std::atomic<std::size_t> cache_bins[nr_cache_bin_words];
+      std::atomic<std::size_t> cache_groups;
+
+      /* True while the bump chunk is still the one set up when the heap
+       * was created. That space has never been handed out, so it is still
+       * zero from the file. It is cleared before any other chunk can be
+       * installed as the bump chunk.
+       */
+      std::atomic<bool> pristine_tail;
+
       uint8_t choose_top_level(std::mt19937 &rand) const {
         uint8_t ret;
         do {
@@ -231,6 +260,49 @@ namespace mpgc {
         return node == &tail;
       }
 
+      void mark_cached_slot(std::size_t i) {
+        const std::size_t w = i / bits_in_word();
+        cache_bins[w].fetch_or(std::size_t(1) << (i % bits_in_word()));
+        cache_groups.fetch_or(std::size_t(1) << w);
+      }
+
+      /* Called when slot i's node may have run out of chunks. A racing
+       * insert_chunk() marks the slot after its push, so the bit is cleared
+       * first and then put back if the node has chunks after all.
+       */
+      void unmark_cached_slot(std::size_t i) {
+        const std::size_t w = i / bits_in_word();
+        const std::size_t bit = std::size_t(1) << (i % bits_in_word());
+        if ((cache_bins[w].fetch_and(~bit) & ~bit) == 0) {
+          cache_groups.fetch_and(~(std::size_t(1) << w));
+          if (cache_bins[w] != 0) {
+            cache_groups.fetch_or(std::size_t(1) << w);
+          }
+        }
+        offset_ptr<skip_node> node = fast_lookup_cache[i];
+        if (node != nullptr && node->val_next.val.load() != nullptr) {
+          mark_cached_slot(i);
+        }
+      }
+
+      //Returns the first fast_lookup_cache slot at or after i whose node has chunks, or nr_slots.
+      std::size_t next_cached_slot(std::size_t i) const {
+        std::size_t w = i / bits_in_word();
+        if (w >= nr_cache_bin_words) {
+          return nr_slots;
+        }
+        const std::size_t bins = cache_bins[w] & (~std::size_t(0) << (i % bits_in_word()));
+        if (bins) {
+          return w * bits_in_word() + __builtin_ctzl(bins);
+        }
+        const std::size_t groups = cache_groups & (~std::size_t(0) << (w + 1));
+        if (!groups) {
+          return nr_slots;
+        }
+        w = __builtin_ctzl(groups);
+        return w * bits_in_word() + __builtin_ctzl(cache_bins[w]);
+      }
+
       offset_ptr<skip_node> search(const std::size_t size,
                                    offset_ptr<skip_node> *preds = nullptr,
                                    offset_ptr<skip_node> *succs = nullptr) {
@@ -242,8 +314,9 @@ namespace mpgc {
           if (node != nullptr) {
             return node;
           } else if (preds == nullptr) {
-            for (uint16_t i = size - 2; i < nr_slots; i++) {
-              offset_ptr<skip_node> &n = fast_lookup_cache[i];
+            const std::size_t i = next_cached_slot(size - 2);
+            if (i < nr_slots) {
+              offset_ptr<skip_node> n = fast_lookup_cache[i];
               if (n != nullptr) {
                 return n;
               }
@@ -271,6 +344,31 @@ namespace mpgc {
         do {
           chunk->set_next(expected);
         } while (!node->val_next.val.compare_exchange_weak(expected, chunk));
+        const std::size_t size = key_fld.decode(node->level_key);
+        if (size >= 3 && size - 3 < nr_slots) {
+          mark_cached_slot(size - 3);
+        }
+      }
+
+      /* Where to look after finding node empty. Within the cache, that's
+       * the next slot whose node has chunks, or else the first node past
+       * the cache, so the empty nodes in between aren't walked one by one.
+       */
+      offset_ptr<skip_node> next_after_empty(offset_ptr<skip_node> node) {
+        const std::size_t size = key_fld.decode(node->level_key);
+        if (size > nr_slots + 2) {
+          return node->val_next.next[0];
+        }
+        if (size >= 3) {
+          unmark_cached_slot(size - 3);
+        }
+        const std::size_t i = next_cached_slot(size - 2);
+        if (i == nr_slots) {
+          return search(nr_slots + 3);
+        }
+        offset_ptr<skip_node> n = fast_lookup_cache[i];
+        //The slot's bit can be set just before the slot itself is.
+        return n != nullptr ? n : node->val_next.next[0].load();
       }
 
       constexpr static auto     slot_fld = bits::field<uint16_t, uint64_t>(49, 15);
@@ -438,17 +536,23 @@ namespace mpgc {
 
       offset_ptr<global_chunk> bump_pointer_allocate(gc_control_block&,
                                                      slot_number&,
-                                                     const std::size_t);
+                                                     const std::size_t,
+                                                     bool&);
      public:
       /* head node keeps list of 2-word chunks. Smaller than that
        * are dropped on the floor with word count written in first
        * word.
        */
       skiplist() : head(max_level, 2, &tail),
-                   tail(level_fld.max_val(), 0, nullptr) {
+                   tail(level_fld.max_val(), 0, nullptr),
+                   cache_groups(0),
+                   pristine_tail(false) {
         for (int i = 0; i < max_level; i++) {
           higher_levels[i] = &tail;
         }
+        for (std::size_t w = 0; w < nr_cache_bin_words; w++) {
+          cache_bins[w] = 0;
+        }
       }
 
       ruts::atomic16B<chunk_expansion_slot>& expansion_slot_ref(uint16_t i) {
@@ -461,13 +565,39 @@ namespace mpgc {
         chunk.end = chunk.begin + size - 1;
         tail.level_orig_end = level_fld.encode(level_fld.max_val()) | key_fld.encode(chunk.end);
         tail.atomic_bump_ptr = chunk;
+        pristine_tail = true;
+      }
+
+      /* Empties the bump chunk and returns its first word, provided it
+       * still ends at end_word (so no skip node has been carved from its
+       * end) and no allocation from it is in flight; otherwise returns 0.
+       * The caller owns the words from there through end_word. The tail
+       * is left as it is once a chunk has been moved out for expansion,
+       * so the next chunk put in the list is installed as usual.
+       */
+      std::size_t take_bump_chunk(std::size_t end_word, bool &zeroed) {
+        bump_chunk exp{bump_chunk::from_volatile, tail.bump_ptr};
+        if (exp.end != end_word || exp.begin == 0 || exp.begin >= exp.end) {
+          //Compares the raw words, so a slot field set on either fails too.
+          return 0;
+        }
+        zeroed = pristine_tail;
+        if (!tail.atomic_bump_ptr.compare_exchange_strong(exp, bump_chunk{})) {
+          return 0;
+        }
+        return exp.begin;
       }
 
       void reset() {
+       pristine_tail = false;
        head.clear_val();
        head.set_next(&tail);
        tail.clear_val();
        std::memset(fast_lookup_cache, 0x0, sizeof(fast_lookup_cache));
+       for (std::size_t w = 0; w < nr_cache_bin_words; w++) {
+         cache_bins[w] = 0;
+       }
+       cache_groups = 0;
        std::memset(chunk_expansion_slots, 0x0, sizeof(chunk_expansion_slots));
        /*std::cout << std::endl
                  << "# OF SKIP NODES LAST TIME: "
@@ -500,6 +630,7 @@ namespace mpgc {
           return false;
         }
         std::size_t end_word = beg_word + chunk->size() - 1;
+        pristine_tail = false;
         if (exp1.begin == 0 && tail.atomic_bump_ptr.compare_exchange_strong(exp, des)) {
           //cas key to end word, and then cas to set end in bump ptr
           tail.level_orig_end.compare_exchange_strong(expected_level_key,
@@ -547,6 +678,7 @@ namespace mpgc {
             //Add node in the dast lookup cache.
             if (size - 3 < nr_slots) {
               fast_lookup_cache[size - 3] = node;
+              mark_cached_slot(size - 3);
             }
             for (uint8_t level = 1; level <= toplevel; level++) {
               pred = preds[level];
@@ -564,17 +696,22 @@ namespace mpgc {
         }
       }
 
+      /* zeroed is set if everything in the returned chunk after the
+       * global_chunk header is known to be zero.
+       */
       offset_ptr<global_chunk> allocate(gc_control_block &cb,
                                         slot_number &sn,
                                         const std::size_t req_size,
                                         const std::size_t max,
-                                        std::mt19937 &rand) {
+                                        std::mt19937 &rand,
+                                        bool &zeroed) {
         //First search for the size-sized chunk in the skiplist
         offset_ptr<skip_node> node = search(req_size);
         offset_ptr<global_chunk> chunk;
+        zeroed = false;
         while(true) {
           if (is_last_node(node)) {
-            chunk = bump_pointer_allocate(cb, sn, req_size);
+            chunk = bump_pointer_allocate(cb, sn, req_size, zeroed);
             break;
           } else {
             chunk = node->val_next.val;
@@ -582,8 +719,15 @@ namespace mpgc {
               //Do Nothing.
             }
             if (!chunk) {
-              node = node->val_next.next[0];
+              node = next_after_empty(node);
             } else {
+              if (chunk->next() == nullptr) {
+                //We took the node's last chunk.
+                const std::size_t size = key_fld.decode(node->level_key);
+                if (size >= 3 && size - 3 < nr_slots) {
+                  unmark_cached_slot(size - 3);
+                }
+              }
               const std::size_t chunk_size = chunk->size();
               if (chunk_size > max && (chunk_size - max) >= min_global_chunk_size()) {
                 //Chunk is too big. We need to chop out what we need and put rest back to list.
@@ -618,7 +762,8 @@ namespace mpgc {
         return chunk;
       }
 
-      static offset_ptr<global_chunk> get_from_global(gc_handshake::in_memory_thread_struct &, const std::size_t);
+      static offset_ptr<global_chunk> get_from_global(gc_handshake::in_memory_thread_struct &, const std::size_t,
+                                                      bool&);
 
       template <typename Continue, typename Func>
       void iterate_skipnodes(Continue &&cont, Func &&func) {
@@ -664,8 +809,192 @@ namespace mpgc {
       }
     };
 
+    /* The global free space of one GC cycle is split into shards, each a
+     * skiplist with its own bump chunk, so that allocating threads only
+     * contend (on the bump chunk in particular) with the other threads
+     * homed on the same shard. Sweep hands out freed chunks to shards by
+     * address, and a thread whose home shard can't satisfy a request
+     * steals from the others before giving up.
+     */
+    constexpr static std::size_t nr_shards = 4;
+
+    class sharded_skiplist {
+      std::array<skiplist, nr_shards> _shards;
+      /* The words each shard's part of the fresh space runs from and to
+       * (inclusive, as a bump chunk's end is), or zero. The parts are
+       * laid out one after another, in shard order.
+       */
+      std::array<std::size_t, nr_shards> _part_begin{};
+      std::array<std::size_t, nr_shards> _part_end{};
+
+      static std::size_t home_shard(const slot_number &sn) {
+        return (sn.sentinel_idx + sn.block_idx) % nr_shards;
+      }
+
+     public:
+      //The shards' chunk expansion slots, taken one shard after the other.
+      constexpr static std::size_t nr_expansion_slots = nr_shards * nr_slots;
+
+      skiplist& shard(std::size_t i) {
+        return _shards[i];
+      }
+
+      skiplist& shard_for(offset_ptr<global_chunk> chunk) {
+        const std::size_t offset = reinterpret_cast<uint8_t*>(chunk.as_bare_pointer()) - base_offset_ptr::base();
+        return _shards[((offset >> alignment_log) / slab_size) % nr_shards];
+      }
+
+      ruts::atomic16B<chunk_expansion_slot>& expansion_slot_ref(uint16_t i) {
+        return _shards[i / nr_slots].expansion_slot_ref(i % nr_slots);
+      }
+
+      //Give each shard an equal part of the free space, unless there's too little to bother.
+      void set_tail(offset_ptr<global_chunk> p, std::size_t size) {
+        _part_begin.fill(0);
+        _part_end.fill(0);
+        const std::size_t first_word =
+          (reinterpret_cast<uint8_t*>(p.as_bare_pointer()) - base_offset_ptr::base()) >> alignment_log;
+        if (size < nr_shards * slab_size) {
+          _shards[0].set_tail(p, size);
+          _part_begin[0] = first_word;
+          _part_end[0] = first_word + size - 1;
+          return;
+        }
+        const std::size_t part = size / nr_shards;
+        std::size_t *begin = reinterpret_cast<std::size_t*>(p.as_bare_pointer());
+        for (std::size_t i = 0; i < nr_shards; i++) {
+          const std::size_t n = i == nr_shards - 1 ? size - i * part : part;
+          _shards[i].set_tail(reinterpret_cast<global_chunk*>(begin + i * part), n);
+          _part_begin[i] = first_word + i * part;
+          _part_end[i] = _part_begin[i] + n - 1;
+        }
+      }
+
+      void reset() {
+        for (skiplist &s : _shards) {
+          s.reset();
+        }
+        _part_begin.fill(0);
+        _part_end.fill(0);
+      }
+
+      void help_unfinished_bump_alloc() {
+        for (skiplist &s : _shards) {
+          s.help_unfinished_bump_alloc();
+        }
+      }
+
+      void insert(gc_control_block &cb,
+                  offset_ptr<global_chunk> chunk,
+                  std::mt19937 &rand) {
+        shard_for(chunk).insert(cb, chunk, rand);
+      }
+
+      offset_ptr<global_chunk> allocate(gc_control_block &cb,
+                                        slot_number &sn,
+                                        const std::size_t req_size,
+                                        const std::size_t max,
+                                        std::mt19937 &rand,
+                                        bool &zeroed) {
+        const std::size_t home = home_shard(sn);
+        for (std::size_t i = 0; i < nr_shards; i++) {
+          offset_ptr<global_chunk> chunk = _shards[(home + i) % nr_shards].allocate(cb, sn, req_size, max,
+                                                                                      rand, zeroed);
+          if (chunk) {
+            return chunk;
+          }
+        }
+        return allocate_across_parts(cb, req_size, max, rand, zeroed);
+      }
+
+     private:
+      void give_back(gc_control_block &cb, std::size_t from, std::size_t to, std::mt19937 &rand) {
+        global_chunk *c = new (base_offset_ptr::base() + (from << alignment_log)) global_chunk(to - from + 1);
+        shard_for(c).insert(cb, c, rand);
+      }
+
+      /* A request too big for any one shard's bump chunk can still fit
+       * in the fresh space, as long as it hasn't all been touched. What's
+       * left of one shard's bump chunk runs straight into the next
+       * shard's part, if that part is untouched, and so on. This looks
+       * for such a run that's big enough and claims its pieces in order,
+       * giving them back if any has been used in the meantime.
+       */
+      offset_ptr<global_chunk> allocate_across_parts(gc_control_block &cb,
+                                                     const std::size_t req_size,
+                                                     const std::size_t max,
+                                                     std::mt19937 &rand,
+                                                     bool &zeroed) {
+        for (std::size_t first = 0; first < nr_shards && _part_end[first] != 0; first++) {
+          bump_chunk bc{bump_chunk::from_volatile, _shards[first].tail_node().bump_ptr};
+          if (bc.end != _part_end[first] || bc.begin == 0 || bc.begin >= bc.end) {
+            continue;
+          }
+          std::size_t have = bc.end - bc.begin + 1;
+          std::size_t last = first;
+          while (have < req_size && last + 1 < nr_shards && _part_end[last + 1] != 0) {
+            bump_chunk next{bump_chunk::from_volatile, _shards[last + 1].tail_node().bump_ptr};
+            if (next.begin != _part_begin[last + 1] || next.end != _part_end[last + 1]) {
+              break;
+            }
+            have += next.end - next.begin + 1;
+            last++;
+          }
+          if (have < req_size) {
+            continue;
+          }
+          bool all_zero = true;
+          const std::size_t start = _shards[first].take_bump_chunk(_part_end[first], all_zero);
+          if (start == 0) {
+            continue;
+          }
+          std::size_t end = _part_end[first];
+          for (std::size_t i = first + 1; i <= last; i++) {
+            bool z = true;
+            const std::size_t b = _shards[i].take_bump_chunk(_part_end[i], z);
+            if (b != _part_begin[i]) {
+              if (b != 0) {
+                give_back(cb, b, _part_end[i], rand);
+              }
+              break;
+            }
+            all_zero &= z;
+            end = _part_end[i];
+          }
+          if (end - start + 1 < req_size) {
+            give_back(cb, start, end, rand);
+            continue;
+          }
+          const std::size_t size = end - start + 1;
+          std::size_t * const c = reinterpret_cast<std::size_t*>(base_offset_ptr::base() + (start << alignment_log));
+          offset_ptr<global_chunk> chunk = new (c) global_chunk(size);
+          if (size > max && size - max >= min_global_chunk_size()) {
+            //As in skiplist::allocate(), the put-back size goes in first.
+            offset_ptr<global_chunk> put_back = new (c + max) global_chunk(size - max);
+            std::atomic_signal_fence(std::memory_order_release);
+            chunk->set_size(max);
+            shard_for(put_back).insert(cb, put_back, rand);
+          }
+          //The pieces after the first had no header, so their first words are still zero.
+          zeroed = all_zero;
+          return chunk;
+        }
+        return nullptr;
+      }
+    };
+
     using localPoolType = std::map<std::size_t, local_chunk*>;
-   extern void* alloc (gc_handshake::in_memory_thread_struct&, std::size_t, std::size_t);
+   /* Unless zero is false, the returned memory (past the first word) is
+    * all zero. Callers may only pass false if the object has no fields the
+    * GC traces, as it can be scanned before its constructor has run.
+    */
+   extern void* alloc (gc_handshake::in_memory_thread_struct&, std::size_t, std::size_t, bool zero = true);
+   /* If the thread's local free list has a chunk starting at p with at
+    * least size words, carve size words off its front and return true.
+    * The words are zero, except the first, which holds size (as for
+    * alloc()).
+    */
+   extern bool extend(gc_handshake::in_memory_thread_struct&, std::size_t *p, std::size_t size);
   }//gc_allocator
 }//mpgc
 
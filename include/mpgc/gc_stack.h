@@ -38,6 +38,7 @@
 #include "mpgc/gc.h"
 #include "mpgc/gc_versioned.h"
 #include <atomic>
+#include <cstdint>
 
 namespace mpgc {
 
@@ -142,23 +143,122 @@ namespace mpgc {
 
   };
 
+  template <typename T> class gc_threaded_list;
+  template <typename S> struct gc_stack_test_access;
+
   template <typename T>
   class gc_atomic_stack {
   public:
       using value_type = T;
   private:
+    // Lets tests drive the exchangers, which are hard to reach by contention alone.
+    friend struct gc_stack_test_access<gc_atomic_stack>;
     using node = gc_threaded_node<T>;
-
+    using exchanger = std::atomic<gc_ptr<node>>;
+
+    /*
+     * When a CAS on _head fails, a pusher and a popper can meet in
+     * one of the exchangers instead: the pusher parks its node there
+     * for a little while, and a popper that finds it takes it,
+     * leaving _head alone.  The exchangers are only allocated the
+     * first time there's contention.
+     */
+    constexpr static std::size_t n_exchangers = 16;
+    constexpr static unsigned exchange_spins = 128;
 
     atomic_versioned_gc_ptr<node> _head;
+    std::atomic<gc_array_ptr<exchanger>> _exchangers;
+
+    exchanger &some_exchanger() {
+      gc_array_ptr<exchanger> ex = _exchangers.load();
+      if (ex == nullptr) {
+        gc_array_ptr<exchanger> fresh = make_gc_array<exchanger>(n_exchangers);
+        ex = _exchangers.compare_exchange_strong(ex, fresh) ? fresh : ex;
+      }
+      static thread_local std::uint32_t x = 
+        static_cast<std::uint32_t>(reinterpret_cast<std::uintptr_t>(&x)) | 1;
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      return (*ex)[x % n_exchangers];
+    }
+
+    bool eliminate_push(const gc_ptr<node> &new_node) {
+      exchanger &slot = some_exchanger();
+      gc_ptr<node> expected = nullptr;
+      if (!slot.compare_exchange_strong(expected, new_node)) {
+        return false;
+      }
+      for (unsigned i = 0; i < exchange_spins; i++) {
+        if (slot.load() != new_node) {
+          return true;
+        }
+      }
+      expected = new_node;
+      // If we can't take it back, a popper got it.
+      return !slot.compare_exchange_strong(expected, nullptr);
+    }
+
+    gc_ptr<node> eliminate_pop() {
+      exchanger &slot = some_exchanger();
+      gc_ptr<node> n = slot.load();
+      if (n != nullptr && slot.compare_exchange_strong(n, nullptr)) {
+        return n;
+      }
+      return nullptr;
+    }
+
+    /*
+     * Makes first..last the top of the stack.  The nodes must not be
+     * reachable from anywhere else.  A fresh node is only written
+     * (and so only goes through the write barrier) when the head
+     * changed under us.
+     */
+    void splice(const gc_ptr<node> &first, const gc_ptr<node> &last) {
+      auto link = [&](auto current) {
+        gc_ptr<node> below = current.pointer();
+        if (last->next != below) {
+          last->next = below;
+        }
+        current.inc_and_set(first);
+        return current;
+      };
+      while (!_head.try_update(1, [](const auto &) { return true; }, link)) {
+        if (first == last && eliminate_push(first)) {
+          return;
+        }
+      }
+    }
+
+    gc_ptr<node> pop_node() {
+      for (;;) {
+        auto rr = _head.try_update(1, [](const auto &current) {
+            return current != nullptr;
+          }, [](auto current) {
+            current.inc_and_set(current->next);
+            return current;
+          });
+        if (rr) {
+          return rr.prior_value.pointer();
+        }
+        if (rr.prior_value.pointer() == nullptr) {
+          return nullptr;
+        }
+        gc_ptr<node> n = eliminate_pop();
+        if (n != nullptr) {
+          return n;
+        }
+      }
+    }
   public:
 
-    gc_atomic_stack() : _head{nullptr} {}
+    gc_atomic_stack() : _head{nullptr}, _exchangers{nullptr} {}
 
     static const auto &descriptor() {
       static gc_descriptor d =
         GC_DESC(gc_atomic_stack)
-        .template WITH_FIELD(&gc_atomic_stack::_head);
+        .template WITH_FIELD(&gc_atomic_stack::_head)
+        .template WITH_FIELD(&gc_atomic_stack::_exchangers);
       return d;
     }
     void clear() {
@@ -170,19 +270,77 @@ namespace mpgc {
     }
 
     void push(const gc_ptr<node> &new_node) {
-      _head.update([&](auto current) {
-          new_node->next = current;
-          current.inc_and_set(new_node);
-          return current;
-        });
+      splice(new_node, new_node);
     }
 
     void push(const value_type &v) {
-      push(make_gc<node>(v));
+      push(make_gc<node>(v, _head.pointer()));
     }
 
     void push(value_type &&v) {
-      push(make_gc<node>(std::move(v)));
+      push(make_gc<node>(std::move(v), _head.pointer()));
+    }
+
+    /*
+     * Pushes the chain of nodes from first through last (linked by
+     * next) with a single CAS, so first ends up on top.  The chain
+     * must be the caller's own; last->next is overwritten.
+     */
+    void push_all(const gc_ptr<node> &first, const gc_ptr<node> &last) {
+      splice(first, last);
+    }
+
+    /*
+     * Pushes the values in [from, to) as if one at a time (so the
+     * last is on top), but with a single CAS.
+     */
+    template <typename Iter>
+    void push_all(Iter from, Iter to) {
+      if (from == to) {
+        return;
+      }
+      gc_ptr<node> last = make_gc<node>(*from, _head.pointer());
+      gc_ptr<node> first = last;
+      for (++from; from != to; ++from) {
+        first = make_gc<node>(*from, first);
+      }
+      splice(first, last);
+    }
+
+    /*
+     * Pushes the values in the list so that the list's first value is
+     * on top, with a single CAS.  The list's nodes may be shared, so
+     * they're copied.
+     */
+    void push_all(const gc_threaded_list<T> &list) {
+      gc_ptr<node> first = nullptr;
+      gc_ptr<node> last = nullptr;
+      list.for_each([&](const value_type &v) {
+          gc_ptr<node> n = make_gc<node>(v);
+          if (last == nullptr) {
+            first = n;
+          } else {
+            last->next = n;
+          }
+          last = n;
+        });
+      if (first != nullptr) {
+        splice(first, last);
+      }
+    }
+
+    /*
+     * Takes everything on the stack with a single CAS, returning it
+     * as a list, top first.
+     */
+    gc_threaded_list<T> pop_all() {
+      auto rr = _head.try_update([](const auto &current) {
+          return current != nullptr;
+        }, [](auto current) {
+          current.inc_and_set(gc_ptr<node>{});
+          return current;
+        });
+      return rr ? gc_threaded_list<T>{rr.prior_value.pointer()} : gc_threaded_list<T>{};
     }
 
     template <typename...Args>
@@ -214,14 +372,9 @@ namespace mpgc {
     }
 
     std::pair<bool, value_type> pop() {
-      auto rr = _head.try_update([&](const auto &current) {
-          return current != nullptr;
-        }, [&](auto current) {
-          current.inc_and_set(current->next);
-          return current;
-        });
-      if (rr) {
-        return std::make_pair(true, rr.prior_value->value);
+      gc_ptr<node> n = pop_node();
+      if (n != nullptr) {
+        return std::make_pair(true, n->value);
       } else {
         return std::make_pair(false, value_type{});
       }
@@ -306,6 +459,7 @@ namespace mpgc {
   template <typename T>
   class gc_threaded_list {
     using node = gc_threaded_node<T>;
+    friend class gc_atomic_stack<T>;
 
     gc_ptr<node> _head;
     explicit gc_threaded_list(const gc_ptr<node> &h) : _head{h} {}
@@ -29,6 +29,7 @@
 
 #include "mpgc/gc.h"
 #include "mpgc/gc_vector.h"
+#include <cstdint>
 #include <string>
 #include <ostream>
 #include <istream>
@@ -48,21 +49,219 @@ namespace mpgc {
     using value_type = typename Traits::char_type;
     using size_type = long;
     using difference_type = std::ptrdiff_t;
-    using reference = typename rep_type::reference;
-    using const_reference = typename rep_type::const_reference;
-    using iterator = typename rep_type::iterator;
-    using const_iterator = typename rep_type::const_iterator;
-    using reverse_iterator = typename rep_type::reverse_iterator;
-    using const_reverse_iterator = typename rep_type::const_reverse_iterator;
+    using reference = value_type &;
+    using const_reference = const value_type &;
+
+    /*
+     * An iterator is a bare pointer to a character, plus (for
+     * strings whose characters are in a heap rep) an iterator on the
+     * rep to hold onto it.  For a string whose characters are inline,
+     * the pointer is into the string itself, so the iterator is only
+     * good as long as the string is where it was.
+     */
+    template <bool IsConst>
+    class iter_ {
+      template <bool> friend class iter_;
+      friend class gc_basic_string;
+    public:
+      constexpr static bool is_const = IsConst;
+      using value_type = std::conditional_t<is_const, const CharT, CharT>;
+      using reference = value_type &;
+      using pointer = value_type *;
+      using difference_type = std::ptrdiff_t;
+      using iterator_category = std::random_access_iterator_tag;
+    private:
+      using anchor_type = typename rep_type::const_iterator;
+      anchor_type _anchor;
+      pointer _ptr;
+      iter_(const anchor_type &anchor, pointer p)
+        : _anchor{anchor}, _ptr{p}
+      {}
+    public:
+      iter_() : _ptr{nullptr} {}
+      iter_(const iter_ &) = default;
+      iter_(iter_ &&) = default;
+      /* A const iter can be constructed from a non-const iter */
+      template <bool B = is_const, typename E=std::enable_if_t<B> >
+      iter_(const iter_<false> &other)
+        : _anchor{other._anchor}, _ptr{other._ptr}
+      {}
+
+      static const auto &descriptor() {
+        static gc_descriptor d =
+          GC_DESC(iter_)
+          .template WITH_FIELD(&iter_::_anchor)
+          .template WITH_FIELD(&iter_::_ptr);
+        return d;
+      }
+      iter_ &operator =(const iter_ &) = default;
+      iter_ &operator =(iter_ &&) = default;
+
+      pointer operator ->() const {
+        return _ptr;
+      }
+      reference operator *() const {
+        return *_ptr;
+      }
+      reference operator[](difference_type i) const {
+        return _ptr[i];
+      }
+      /*
+       * This pointer should only be used while you're holding onto the iterator.
+       */
+      value_type *as_bare_pointer() const {
+        return _ptr;
+      }
+
+      template <bool C>
+      bool operator==(const iter_<C> &rhs) const {
+        return _ptr == rhs._ptr;
+      }
+      template <bool C>
+      bool operator!=(const iter_<C> &rhs) const {
+        return _ptr != rhs._ptr;
+      }
+      template <bool C>
+      bool operator<(const iter_<C> &rhs) const {
+        return _ptr < rhs._ptr;
+      }
+      template <bool C>
+      bool operator>(const iter_<C> &rhs) const {
+        return _ptr > rhs._ptr;
+      }
+      template <bool C>
+      bool operator<=(const iter_<C> &rhs) const {
+        return _ptr <= rhs._ptr;
+      }
+      template <bool C>
+      bool operator>=(const iter_<C> &rhs) const {
+        return _ptr >= rhs._ptr;
+      }
+
+      iter_ &operator +=(difference_type delta) {
+        _ptr += delta;
+        return *this;
+      }
+      iter_ &operator -=(difference_type delta) {
+        _ptr -= delta;
+        return *this;
+      }
+      iter_ &operator ++() {
+        return (*this) += 1;
+      }
+      iter_ &operator --() {
+        return (*this) -= 1;
+      }
+      iter_ operator ++(int) {
+        iter_ old{*this};
+        ++(*this);
+        return old;
+      }
+      iter_ operator --(int) {
+        iter_ old{*this};
+        --(*this);
+        return old;
+      }
+      iter_ operator +(difference_type delta) const {
+        return iter_{_anchor, _ptr+delta};
+      }
+      iter_ operator -(difference_type delta) const {
+        return iter_{_anchor, _ptr-delta};
+      }
+      template <bool C>
+      difference_type operator -(const iter_<C> &rhs) const {
+        return _ptr - rhs._ptr;
+      }
+    };
+
+    using iterator = iter_<false>;
+    using const_iterator = iter_<true>;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
     constexpr static size_type npos = -1;
+    /*
+     * Strings this short are kept inline, with no heap rep.
+     */
+    constexpr static size_type small_capacity = 15/sizeof(value_type);
   private:
     /*
-     * An empty _rep indicates an empty string.  Otherwise, _rep
-     * contains all of the characters in the string, plus a null at
-     * the end.  We only actually create the single null for an empty
-     * string if somebody calls data() or c_str();
+     * The characters of a short string, plus a null at the end.  The
+     * last element holds small_capacity less the size, so for a full
+     * string it's the null, and the whole thing fits in two words.
+     */
+    struct alignas(sizeof(std::size_t)) small_rep {
+      value_type chars[small_capacity+1]{};
+
+      small_rep() {
+        set_size(0);
+      }
+      size_type size() const {
+        return small_capacity - static_cast<size_type>(chars[small_capacity]);
+      }
+      void set_size(size_type n) {
+        chars[small_capacity] = static_cast<value_type>(small_capacity - n);
+      }
+
+      static const auto &descriptor() {
+        static gc_descriptor d = gc_descriptor::blob(gc_descriptor::size_in_words<small_rep>());
+        return d;
+      }
+    };
+    /*
+     * If _rep is empty, the string is inline, in _small.  Otherwise,
+     * _rep contains all of the characters in the string, plus a null
+     * at the end, and _small's size is zero.  We only move a string
+     * into _rep when it gets too long for _small, and once there it
+     * stays there (reusing the rep's capacity) until it's cleared or
+     * shrunk to fit.  The rep's own words can't double as the inline
+     * buffer: its pointer has to be one the collector can trace, and
+     * its size belongs to gc_basic_vector.
      */
     rep_type _rep;
+    small_rep _small{};
+
+    bool is_small() const {
+      return _rep.empty();
+    }
+
+    value_type *chars() {
+      return is_small() ? _small.chars : _rep.begin().as_bare_pointer();
+    }
+    const value_type *chars() const {
+      return is_small() ? _small.chars : _rep.cbegin().as_bare_pointer();
+    }
+
+    iterator iter_at(size_type i) {
+      return is_small()
+        ? iterator{typename iterator::anchor_type{}, _small.chars+i}
+        : iterator{_rep.cbegin(), _rep.begin().as_bare_pointer()+i};
+    }
+    const_iterator iter_at(size_type i) const {
+      return is_small()
+        ? const_iterator{typename const_iterator::anchor_type{}, _small.chars+i}
+        : const_iterator{_rep.cbegin(), _rep.cbegin().as_bare_pointer()+i};
+    }
+
+    void clear_small() {
+      _small.chars[0] = value_type{};
+      _small.set_size(0);
+    }
+
+    /*
+     * Move an inline string into _rep, with room for at least count
+     * characters.  The inline characters are left where they were,
+     * since they may be the source of what's being added.  Only the
+     * size is cleared; whatever makes the string inline again resets
+     * the rest.
+     */
+    void spill(size_type count) {
+      if (!is_small()) {
+        return;
+      }
+      _rep.reserve(count+1);
+      _rep.assign(_small.chars, _small.chars+_small.size()+1);
+      _small.set_size(0);
+    }
 
     [[noreturn]] void throw_out_of_range(size_type pos, size_type n = size()) const;
 
@@ -87,20 +286,40 @@ namespace mpgc {
     template <typename Iter>
     gc_basic_string &assign_n(Iter from, size_type n) {
       resize(n);
-      std::copy_n(from, n, _rep.begin());
+      std::copy_n(from, n, chars());
       return *this;
     }
+    /*
+     * Called after moving other's _rep into ours.  If it was inline,
+     * the characters are still in other.
+     */
+    template <typename PC2>
+    void take_small(gc_basic_string<CharT,Traits,PC2> &other) {
+      if (is_small()) {
+        assign_n(other._small.chars, other._small.size());
+      } else {
+        clear_small();
+      }
+      other.clear_small();
+    }
   public:
     gc_basic_string() noexcept {}
+    gc_basic_string(const gc_basic_string &) = default;
+    gc_basic_string(gc_basic_string &&other)
+      : _rep(std::move(other._rep)), _small(other._small)
+    {
+      other.clear_small();
+    }
     template <typename PC2>
     gc_basic_string(const gc_basic_string<CharT,Traits,PC2> &other)
-      : _rep(other._rep)
     {
+      assign(other);
     }
     template <typename PC2>
     gc_basic_string(gc_basic_string<CharT,Traits,PC2> &&other)
       : _rep(std::move(other._rep))
     {
+      take_small(other);
     }
     gc_basic_string(size_type count, value_type ch)
     {
@@ -139,13 +358,14 @@ namespace mpgc {
     static const auto &descriptor() {
       static gc_descriptor d =
 	GC_DESC(gc_basic_string)
-	.template WITH_FIELD(&gc_basic_string::_rep);
+	.template WITH_FIELD(&gc_basic_string::_rep)
+	.template WITH_FIELD(&gc_basic_string::_small);
       return d;
     }
 
     gc_basic_string &assign(size_type count, value_type ch) {
       resize(count);
-      std::fill(_rep.begin(), _rep.end()-1, ch);
+      traits_type::assign(chars(), count, ch);
       return *this;
     }
     
@@ -191,6 +411,14 @@ namespace mpgc {
       return assign(ilist.begin(), ilist.size());
     }
 
+    gc_basic_string &operator =(const gc_basic_string &) = default;
+    gc_basic_string &operator =(gc_basic_string &&str) {
+      _rep = std::move(str._rep);
+      _small = str._small;
+      str.clear_small();
+      return *this;
+    }
+
     template <typename PC2>
     gc_basic_string &operator =(const gc_basic_string<CharT,Traits,PC2> &str) {
       return assign(str);
@@ -199,6 +427,7 @@ namespace mpgc {
     template <typename PC2>
     gc_basic_string &operator =(gc_basic_string<CharT,Traits,PC2> &&str) {
       _rep = std::move(str._rep);
+      take_small(str);
       return *this;
     }
 
@@ -221,8 +450,7 @@ namespace mpgc {
         
     
     size_type size() const {
-      size_type n = _rep.size();
-      return n == 0 ? 0 : n-1;
+      return is_small() ? _small.size() : _rep.size()-1;
     }
 
     size_type length() const {
@@ -237,111 +465,121 @@ namespace mpgc {
      * We don't currently implement the shrinking here.
      */
     void reserve(size_type new_cap = 0) {
+      if (new_cap <= capacity()) {
+        return;
+      }
+      spill(new_cap);
       _rep.reserve(new_cap+1);
     }
 
     size_type capacity() const {
-      size_type n = _rep.capacity();
-      return n == 0 ? 0 : n-1;
+      return is_small() ? small_capacity : _rep.capacity()-1;
     }
 
+    /*
+     * A string in a heap rep that now fits inline is moved back.
+     */
     void shrink_to_fit() {
-      _rep.shrink_to_fit();
+      if (is_small()) {
+        return;
+      }
+      size_type n = size();
+      if (n <= small_capacity) {
+        traits_type::copy(_small.chars, chars(), n+1);
+        _small.set_size(n);
+        _rep = rep_type{};
+      } else {
+        _rep.shrink_to_fit();
+      }
     }
 
     iterator begin() {
-      return _rep.begin();
+      return iter_at(0);
     }
     const_iterator begin() const {
-      return _rep.cbegin();
+      return iter_at(0);
     }
     const_iterator cbegin() const {
       return begin();
     }
 
     iterator end() {
-      return empty() ? iterator{} : _rep.end()-1;
+      return iter_at(size());
     }
     const_iterator end() const {
-      return empty() ? const_iterator() : _rep.end()-1;
+      return iter_at(size());
     }
     const_iterator cend() const {
       return end();
     }
 
-    iterator rbegin() {
+    reverse_iterator rbegin() {
       return reverse_iterator(end());
     }
-    const_iterator rbegin() const {
-      return reverse_iterator(end());
+    const_reverse_iterator rbegin() const {
+      return const_reverse_iterator(end());
     }
-    const_iterator crbegin() const {
+    const_reverse_iterator crbegin() const {
       return rbegin();
     }
 
-    iterator rend() {
-      return _rep.rend();
+    reverse_iterator rend() {
+      return reverse_iterator(begin());
     }
-    const_iterator rend() const {
-      return _rep.rend();
+    const_reverse_iterator rend() const {
+      return const_reverse_iterator(begin());
     }
-    const_iterator crend() const {
-      return _rep.crend();
+    const_reverse_iterator crend() const {
+      return rend();
     }
 
     reference at(size_type pos) {
       check_pos(pos);
-      return _rep.at(pos);
+      return chars()[pos];
     }
 
     const_reference at(size_type pos) const {
       check_pos(pos);
-      return _rep.at(pos);
+      return chars()[pos];
     }
 
     reference operator[](size_type pos) {
-      return _rep[pos];
+      return chars()[pos];
     }
       
     const_reference operator[](size_type pos) const {
-      return _rep[pos];
+      return chars()[pos];
     }
 
     reference front() {
       assert(!empty());
-      return _rep.front();
+      return chars()[0];
     }
 
     const_reference front() const {
-      return _rep.front();
+      return chars()[0];
     }
 
     reference back() {
-      return _rep[size()-1];
+      return chars()[size()-1];
     }
 
     const_reference back() const {
-      return _rep[size()-1];
+      return chars()[size()-1];
     }
 
     /*
      * WARNING: The pointers handed out by data() and c_str() are
-     * not anchored.  They must be used with care!
+     * not anchored.  They must be used with care!  For an inline
+     * string, they point into the string itself.
      */
 
     value_type *data() {
-      if (_rep.empty()) {
-        _rep = {value_type{}};
-      }
-      return begin().as_bare_pointer();
+      return chars();
     }
       
     const value_type *data() const {
-      if (_rep.empty()) {
-        gc_basic_string *nc_this = const_cast<gc_basic_string*>(this);
-        nc_this->_rep = {value_type{}};
-      }
-      return &(*cbegin());
+      return chars();
     }
 
     value_type *c_str() {
@@ -354,6 +592,7 @@ namespace mpgc {
 
     void clear() {
       _rep.clear();
+      clear_small();
     }
 
     gc_basic_string &insert(size_type index, size_type count, value_type ch) {
@@ -399,26 +638,24 @@ namespace mpgc {
     }
 
     iterator insert(const_iterator pos, size_type count, value_type ch) {
+      size_type i = pos-cbegin();
+      size_type n = size();
       if (count == 0) {
-        return begin()+(pos-cbegin());
+        return begin()+i;
       }
-      if (empty()) {
-        assert(pos == cend());
-        assign(count, ch);
-        return begin();
+      if (is_small() && n+count <= small_capacity) {
+        traits_type::move(_small.chars+i+count, _small.chars+i, n-i+1);
+        traits_type::assign(_small.chars+i, count, ch);
+        _small.set_size(n+count);
       } else {
-        return _rep.insert(pos, count, ch);
+        spill(n+count);
+        _rep.insert(_rep.cbegin()+i, count, ch);
       }
+      return begin()+i;
     }
 
     iterator insert(const_iterator pos, value_type ch) {
-      if (empty()) {
-        assert(pos == cend());
-        assign(1, ch);
-        return begin();
-      } else {
-        return _rep.insert(pos, 1, ch);
-      }
+      return insert(pos, 1, ch);
     }
 
     iterator insert(const_iterator pos, std::initializer_list<value_type> init) {
@@ -428,45 +665,74 @@ namespace mpgc {
 
     template <typename Iter>
     iterator insert(const_iterator pos, Iter first, Iter last) {
-      if (first == last) {
-        return begin()+(pos-cbegin());
+      size_type i = pos-cbegin();
+      size_type n = size();
+      size_type count = std::distance(first, last);
+      if (count == 0) {
+        return begin()+i;
       }
-      if (empty()) {
-        assert(pos == cend());
-        assign(first, last);
-        return begin();
+      if (is_small() && n+count <= small_capacity) {
+        /*
+         * The source may be this string, so we copy it out before
+         * making the hole.
+         */
+        value_type buf[small_capacity];
+        std::copy(first, last, buf);
+        traits_type::move(_small.chars+i+count, _small.chars+i, n-i+1);
+        traits_type::copy(_small.chars+i, buf, count);
+        _small.set_size(n+count);
       } else {
-        return _rep.insert(pos, first, last);
+        spill(n+count);
+        _rep.insert(_rep.cbegin()+i, first, last);
       }
+      return begin()+i;
     }
 
     gc_basic_string &erase(size_type index = 0, size_type count = npos) {
       size_type n = range_length(index, count);
       const_iterator from = cbegin()+index;
-      const_iterator to = from+count;
-      erase(from, to);
+      erase(from, from+n);
       return *this;
     }
 
     iterator erase(const_iterator position) {
-      return _rep.erase(position);
+      return erase(position, position+1);
     }
 
     iterator erase(const_iterator from, const_iterator to) {
-      return _rep.erase(from, to);
+      size_type i = from-cbegin();
+      size_type count = to-from;
+      if (is_small()) {
+        traits_type::move(_small.chars+i, _small.chars+i+count, _small.size()-(i+count)+1);
+        _small.set_size(_small.size()-count);
+      } else {
+        _rep.erase(_rep.cbegin()+i, _rep.cbegin()+i+count);
+      }
+      return begin()+i;
     }
 
     void push_back(value_type ch) {
-      if (empty()) {
-        assign(1, ch);
+      size_type n = size();
+      if (is_small() && n < small_capacity) {
+        _small.chars[n] = ch;
+        _small.chars[n+1] = value_type{};
+        _small.set_size(n+1);
       } else {
+        spill(n+1);
         _rep.back() = ch;
         _rep.push_back(value_type{});
       }
     }
 
     void pop_back() {
-      if (!empty()) {
+      if (empty()) {
+        return;
+      }
+      if (is_small()) {
+        size_type n = _small.size()-1;
+        _small.chars[n] = value_type{};
+        _small.set_size(n);
+      } else {
         _rep.pop_back();
         _rep.back() = value_type{};
       }
@@ -726,25 +992,30 @@ namespace mpgc {
     }
     
     void resize(size_type count) {
-      if (count == 0) {
-        _rep.clear();
-      } else {
-        _rep.resize(count+1);
-        _rep[count] = value_type{};
-      }
+      resize(count, value_type{});
     }
 
     void resize(size_type count, value_type ch) {
+      size_type n = size();
       if (count == 0) {
-        _rep.clear();
+        clear();
+        return;
+      }
+      if (is_small() && count <= small_capacity) {
+        _small.set_size(count);
       } else {
-        _rep.resize(count+1, ch);
-        _rep[count] = value_type{};
+        spill(count);
+        _rep.resize(count+1);
+      }
+      if (count > n) {
+        traits_type::assign(chars()+n, count-n, ch);
       }
+      chars()[count] = value_type{};
     }
 
     void swap(gc_basic_string &other) noexcept {
       _rep.swap(other._rep);
+      std::swap(_small, other._small);
     }
 
 
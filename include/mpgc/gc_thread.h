@@ -359,7 +359,29 @@ namespace mpgc {
     }
   };
 
-  class mark_bitmap {
+  /* Where the begin and end mark bitmaps sit within the bitmap block.
+   * Each bitmap word covers 64 heap words. The separate layout keeps the
+   * begin and end words in two arrays. The interleaved layout stores the
+   * begin and end words of each 64-word group side by side, so marking an
+   * object or finding where a marked object ends usually touches one cache
+   * line instead of two. The weak bitmap is a separate array in both.
+   */
+  struct separate_bitmap_layout {
+    static constexpr std::size_t stride = 1;
+    static constexpr std::size_t end_offset(const std::size_t n_words) {
+      return n_words;
+    }
+  };
+
+  struct interleaved_bitmap_layout {
+    static constexpr std::size_t stride = 2;
+    static constexpr std::size_t end_offset(const std::size_t) {
+      return 1;
+    }
+  };
+
+  template <typename Layout>
+  class basic_mark_bitmap {
     using rep_t = std::size_t;
     using atomic_rep_t = std::atomic<rep_t>;
     using bitmap_idx_t = std::size_t;
@@ -400,9 +422,20 @@ namespace mpgc {
       while (!_logical_chunks.compare_exchange_weak(i, i + 1));
     }
 
+    /* Post-sweep clearing claims sweep-bitmap words in aligned batches
+     * to cut down on CAS traffic. Since every claim is a multiple of the
+     * batch size, the end of a claim can be recovered from any word in it,
+     * which is all the per-process struct records.
+     */
+    static constexpr std::size_t sweep_bitmap_words_per_claim = 4;
+
+    static constexpr std::size_t sweep_bitmap_claim_end(const std::size_t i) {
+      return (i / sweep_bitmap_words_per_claim + 1) * sweep_bitmap_words_per_claim;
+    }
+
     void fetch_sweep_bitmap_word_to_process(std::size_t &i) {
       i = _sweep_bitmap_words;
-      while(!_sweep_bitmap_words.compare_exchange_weak(i, i + 1));
+      while(!_sweep_bitmap_words.compare_exchange_weak(i, i + sweep_bitmap_words_per_claim));
     }
 
     static constexpr rep_t construct_left_mask(const bit_number_t bit) {
@@ -465,17 +498,17 @@ namespace mpgc {
       return compute_bitmap_index(heap_size >> 3);
     }
 
-    atomic_rep_t &lookup_begin(const bitmap_idx_t idx) {
+    atomic_rep_t &lookup_begin(const bitmap_idx_t idx) const {
       assert(idx < _size);
-      return _begin[idx];
+      return _begin[idx * Layout::stride];
     }
 
-    atomic_rep_t &lookup_end(const bitmap_idx_t idx) {
+    atomic_rep_t &lookup_end(const bitmap_idx_t idx) const {
       assert(idx < _size);
-      return _end[idx];
+      return _end[idx * Layout::stride];
     }
 
-    atomic_rep_t &lookup_weak(const bitmap_idx_t idx) {
+    atomic_rep_t &lookup_weak(const bitmap_idx_t idx) const {
       assert(idx < _size);
       return _weak[idx];
     }
@@ -552,11 +585,34 @@ namespace mpgc {
     }
 
     void clear_chunk_begin(const std::size_t nr_chunk) {
-      std::memset(_begin + (nr_chunk << chunk_size_log_bits), 0x0, sizeof(atomic_rep_t) << chunk_size_log_bits);
+      clear_nonzero_lines<Layout::stride>(&lookup_begin(nr_chunk << chunk_size_log_bits));
     }
 
     void clear_chunk_end(const std::size_t nr_chunk) {
-      std::memset(_end + (nr_chunk << chunk_size_log_bits), 0x0, sizeof(atomic_rep_t) << chunk_size_log_bits);
+      clear_nonzero_lines<Layout::stride>(&lookup_end(nr_chunk << chunk_size_log_bits));
+    }
+
+    /* Zero a logical chunk whose words are Stride apart, a cache line's
+     * worth of words at a time, storing only to groups that aren't already
+     * zero. Most of a chunk is typically clean after a sweep, and skipping
+     * the stores keeps those lines (and the control heap pages they live
+     * on) from being dirtied.
+     */
+    template <std::size_t Stride>
+    static void clear_nonzero_lines(atomic_rep_t *chunk) {
+      constexpr std::size_t line_words = 64 / sizeof(rep_t);
+      rep_t *p = reinterpret_cast<rep_t*>(chunk);
+      for (std::size_t i = 0; i < (std::size_t(1) << chunk_size_log_bits); i += line_words) {
+        rep_t any = 0;
+        for (std::size_t j = 0; j < line_words; j++) {
+          any |= p[(i + j) * Stride];
+        }
+        if (any) {
+          for (std::size_t j = 0; j < line_words; j++) {
+            p[(i + j) * Stride] = 0;
+          }
+        }
+      }
     }
 
   public:
@@ -567,34 +623,31 @@ namespace mpgc {
       return sizeof(atomic_rep_t) * (bitmap_size * 3 + sweep_bitmap_size * 2);
     }
 
-    mark_bitmap(std::size_t heap_size, const Allocator &alloc = Allocator()) :
+    basic_mark_bitmap(std::size_t heap_size, const Allocator &alloc = Allocator()) :
                                          _size(compute_bitmap_size(heap_size)),
                                          _total_logical_chunks(compute_logical_chunk_count(_size)),
                                          _sweep_bitmap_size(compute_sweep_bitmap_size(_total_logical_chunks)),
                                          _alloc(alloc),
-                                         _begin(_alloc.allocate(3 * _size + 2 * _sweep_bitmap_size)),
-                                         _end(_begin + _size),
-                                         _weak(_end + _size),
+                                         _begin(_alloc.allocate_zeroed(3 * _size + 2 * _sweep_bitmap_size)),
+                                         _end(_begin + Layout::end_offset(_size)),
+                                         _weak(_begin + 2 * _size),
                                          _sweep_bitmap_begin(_weak + _size),
                                          _sweep_bitmap_end(_sweep_bitmap_begin + _sweep_bitmap_size),
                                          _logical_chunks(0),
                                          _sweep_bitmap_words(0)
   {
-      /* TODO: This is too much of work. We have to come up with a way where we don't need to
-       * clear all the bitmaps because we can come up with a solution where the bitmaps are
-       * allocated on a new file which is already zero-initialized.
+      /* The bitmaps come from the untouched end of the control heap (a freshly created
+       * sparse file) whenever there's room, so they're zero without being cleared.
        */
-      std::memset(_begin, 0x0, 3 * sizeof(atomic_rep_t) * _size +
-                               2 * sizeof(atomic_rep_t) * _sweep_bitmap_size);
   }
 
-    ~mark_bitmap() {
+    ~basic_mark_bitmap() {
       _alloc.deallocate(_begin, 1);
     }
 
     void clear() {
-      std::memset(_begin, 0x0, _size * sizeof(atomic_rep_t));
-      std::memset(_end,   0x0, _size * sizeof(atomic_rep_t));
+      // Begin and end share the first 2 * _size words in either layout.
+      std::memset(_begin, 0x0, 2 * _size * sizeof(atomic_rep_t));
       std::memset(_weak,  0x0, _size * sizeof(atomic_rep_t));
     }
 
@@ -603,7 +656,7 @@ namespace mpgc {
       std::cout << std::setfill('0') << std::hex;
       for (bitmap_idx_t i = 0; i < _size;) {
         std::cout << "[" << std::setw(3) << i << "]";
-        std::cout << std::setw(16) << _begin[i] << ":" << std::setw(16) << _end[i];
+        std::cout << std::setw(16) << lookup_begin(i) << ":" << std::setw(16) << lookup_end(i);
         std::cout << "\t";
         i++;
         if (i % 4 == 0) {
@@ -638,6 +691,11 @@ namespace mpgc {
       return _mark_end_first(beg_word, end_word);
     }
 
+    // The same, given the first and last heap words of the object.
+    bool mark_end_first(const std::size_t beg_word, const std::size_t end_word) {
+      return _mark_end_first(beg_word, end_word);
+    }
+
     void mark_begin_first(const offset_ptr<const gc_allocated> &p) {
       assert(p->get_gc_descriptor().is_valid());
       const std::size_t beg_word = p.offset() >> 3;
@@ -650,13 +708,13 @@ namespace mpgc {
       bitmap_idx_t idx = compute_bitmap_index(word);
       bitmap_idx_t end_idx = compute_bitmap_index(end);
       do {
-        rep_t B = _end[idx] & construct_left_mask(bit);
+        rep_t B = lookup_end(idx) & construct_left_mask(bit);
         while (B == 0) {
           idx++;
           if (idx == end_idx) {
             return idx << value_log_bits;
           }
-          B = _end[idx];
+          B = lookup_end(idx);
         }
         found_set_bit = true;
         if (B == 1) {
@@ -668,7 +726,7 @@ namespace mpgc {
         } else {
           bit = __builtin_clzl(B) + 1;
         }
-      } while (_begin[idx] & construct_bitmap_word(bit));
+      } while (lookup_begin(idx) & construct_bitmap_word(bit));
       return (idx << value_log_bits) + bit;
     }
 
@@ -679,13 +737,13 @@ namespace mpgc {
       if (idx >= end_idx) {
         return idx << value_log_bits;
       }
-      rep_t B = _begin[idx] & construct_left_mask(bit);
+      rep_t B = lookup_begin(idx) & construct_left_mask(bit);
       while (B == 0) {
         idx++;
         if (idx == end_idx) {
           return idx << value_log_bits;
         }
-        B = _begin[idx];
+        B = lookup_begin(idx);
       }
       return (idx << value_log_bits) + __builtin_clzl(B);
     }
@@ -694,13 +752,13 @@ namespace mpgc {
     std::size_t find_prev_used_word(std::size_t word) const {
       bit_number_t bit = compute_bit_number(word);
       bitmap_idx_t idx = compute_bitmap_index(word);
-      rep_t B = _end[idx];
+      rep_t B = lookup_end(idx);
       B &= construct_right_mask(bit);
       while (B == 0) {
         if (idx == 0) {
           return 0;
         }
-        B = _end[--idx];
+        B = lookup_end(--idx);
       }
       return (idx << value_log_bits) + (bits_per_value - __builtin_ctzl(B));
     }
@@ -742,9 +800,9 @@ namespace mpgc {
       }
 
       for(i = 0; i < _size; i++) {
-        assert(_begin[i] == 0);
-        assert(_end[i] == 0);
-        assert(_weak[i] == 0);
+        assert(lookup_begin(i) == 0);
+        assert(lookup_end(i) == 0);
+        assert(lookup_weak(i) == 0);
       }
     }
 
@@ -754,22 +812,32 @@ namespace mpgc {
     void post_sweep_phase(per_process_struct*, const bool);
     bool post_sweep_phase_without_load_balancing(per_process_struct*, const bool);
     void post_sweep_clear(const std::size_t, const bool);
+    void post_sweep_clear_claim(const std::size_t, const bool);
     void process_logical_chunk(gc_control_block&,
-                               gc_allocator::skiplist&,
+                               gc_allocator::sharded_skiplist&,
                                const std::size_t,
                                const bool);
-    void _cleanup_sweep1_phase(per_process_struct*, gc_allocator::skiplist&, const bool);
+    void _cleanup_sweep1_phase(per_process_struct*, gc_allocator::sharded_skiplist&, const bool);
     void cleanup_weak_ptrs(gc_control_block&, std::size_t, const std::size_t);
     void verify_weak_ptrs_cleanup();
     void verify_weak_ptr_cleanup(std::size_t*);
     //void cleanup_weak_ptr(std::size_t*);
     void atomic_cleanup_weak_ptr(gc_control_block&, std::size_t*);
     void set_sweep_bitmap_range(const std::size_t, const std::size_t, const bool);
-    void expand_and_put_chunk(gc_control_block&, gc_allocator::skiplist&, chunk_expansion_slot&, const bool, std::mt19937&);
+    void expand_and_put_chunk(gc_control_block&, gc_allocator::sharded_skiplist&, chunk_expansion_slot&, const bool, std::mt19937&);
     void sweep1_phase(gc_control_block&, chunk_expansion_slot&, std::mt19937&,const uint8_t, const bool, const bool);
     void sweep2_phase(const bool);
     void mark_gc_control_block();
   };
+
+  /* The bitmaps live in the control heap shared by every process, so the
+   * layout is fixed at build time.
+   */
+#ifdef MPGC_INTERLEAVED_MARK_BITMAP
+  using mark_bitmap = basic_mark_bitmap<interleaved_bitmap_layout>;
+#else
+  using mark_bitmap = basic_mark_bitmap<separate_bitmap_layout>;
+#endif
 }
 
 #endif /* GC_GC_THREAD_H_ */
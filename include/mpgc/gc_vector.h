@@ -46,6 +46,13 @@
  */
 
 namespace mpgc {
+  /*
+   * The smallest capacity of the form current*growth_factor^k (with
+   * current at least min_grow_to) that holds needed elements.
+   */
+  extern std::size_t grown_vector_capacity(std::size_t current, std::size_t needed,
+                                           double growth_factor, std::size_t min_grow_to);
+
   template <typename T, typename PC>
   class gc_basic_vector {
     template <typename X,typename P> friend class gc_basic_vector;
@@ -71,7 +78,7 @@ namespace mpgc {
 
     void ensure_capacity(size_type count) {
       size_type c = capacity();
-      if (count < c) {
+      if (count <= c) {
         return;
       }
       /*
@@ -83,20 +90,13 @@ namespace mpgc {
       if (c == 0) {
         c = count;
       } else {
-        if (c < min_grow_to) {
-          c = min_grow_to;
-        }
-        while (c < count) {
-          /*
-           * There must be a faster way.
-           * TODO
-           * Basically, exponent is ceil(log(desired/current)/log(gf))).
-           * Maybe check d/c < gf, and then dispatch. Perhaps with a
-           * check against a constexpr bound.
-           * This should probably all be delegated to a non-inline
-           * (and non-template) function.
-           */
-          c *= growth_factor;
+        c = grown_vector_capacity(c, count, growth_factor, min_grow_to);
+        /*
+         * If the space after the rep is free, we can just take it,
+         * and there's no copy and no garbage.
+         */
+        if (grow_in_place(*_rep, c)) {
+          return;
         }
       }
       /*
@@ -105,20 +105,20 @@ namespace mpgc {
        * the handle on old_rep disappeared during the move (since it
        * was no longer needed).
        *
-       * ERK: I switched around old_rep and new_rep again when I added
-       * the single ctor that does the grow and copy (and this changes
-       * from an after-the-fact move to an uninitialized copy, which
-       * should be more efficient). The iterators involved are
-       * gc_array iterators, so they should hold onto the old rep
-       * throughout the allocation.
+       * The new rep is built directly from the old one (bitwise, if
+       * the elements allow), and _rep holds onto the old rep
+       * throughout the allocation.  Since the new rep is fresh, there
+       * are no write barriers on the elements, and the barrier on
+       * _rep takes care of the old one.
        */
-      auto old_begin = _rep.begin();
-      auto new_rep = make_gc<rep_type>(c, old_begin, old_begin+_size);
+      auto new_rep = _rep == nullptr
+        ? make_gc<rep_type>(c)
+        : make_gc<rep_type>(c, *_rep, _size);
       // std::cout << "Grew vector rep to capacity " << c
       //           << " (from " << capacity() << ")"
       //           << ": " << new_rep << std::endl;
 
-      // TODO: This should probably be atomic.
+      // Not atomic.  For concurrent appends, see gc_concurrent_vector.
       _rep = new_rep;
     }
     [[noreturn]] void throw_out_of_range(size_type pos, size_type n = size()) const;
@@ -350,7 +350,7 @@ namespace mpgc {
 
     void shrink_to_fit() {
       if (_size < capacity()) {
-        _rep = make_gc_array(begin(), end());
+        _rep = make_gc<rep_type>(_size, *_rep, _size);
       }
     }
 
@@ -61,6 +61,7 @@ namespace std {
       mpgc::gc_ptr<T> lhs_ptr = lhs.pointer();
       mpgc::gc_ptr<T> rhs_ptr = rhs.pointer();
       mpgc::write_barrier(lhs_ptr.as_offset_pointer(), rhs_ptr.as_offset_pointer(), func);
+      mpgc::dirty_tracking::note(this);
     }
 
   public:
@@ -54,6 +54,7 @@ namespace mpgc {
   template <typename T> class offset_ptr;
   template <typename T> class gc_ptr;
   template <typename T> class weak_gc_ptr;
+  template <typename Layout> class basic_mark_bitmap;
 
   enum class special_ptr_type : unsigned char {
     Strong = 0,
@@ -89,7 +90,7 @@ namespace mpgc {
      * To allow access to val() and ctor for checking
      */
     friend class gc_descriptor;
-    friend class mark_bitmap;
+    template <typename> friend class basic_mark_bitmap;
     friend class gc_allocator::skiplist;
 
     constexpr static std::size_t offset_mask() {
@@ -257,7 +258,7 @@ namespace mpgc {
     template <typename Fn, typename ...Args> friend void gc_handshake::process_stack(const std::size_t*, const std::size_t*, Fn&&, Args&& ...);
     friend void gc_handshake::process_stack_weak_ptrs(gc_handshake::in_memory_thread_struct&, std::size_t*, std::size_t * const);
     friend class weak_gc_ptr<T>;
-    friend class mark_bitmap;
+    template <typename> friend class basic_mark_bitmap;
 
     constexpr explicit offset_ptr(std::size_t o) : base_offset_ptr(o) {}
     
@@ -35,6 +35,7 @@
 #define GC_WRITE_BARRIER_H_
 
 #include "mpgc/gc_handshake.h"
+#include "mpgc/gc_persist.h"
 
 namespace mpgc {
   /*
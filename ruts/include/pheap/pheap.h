@@ -49,6 +49,7 @@ namespace pheap {
 	class barrier;
 
 	void *in_heap_allocate(in_heap_header *header, barrier &, size_t sz);
+	void *in_heap_allocate_zeroed(in_heap_header *header, barrier &, size_t sz);
 	void in_heap_deallocate(in_heap_header *header, barrier &, void *ptr);
 
 	template <class T>
@@ -114,6 +115,10 @@ namespace pheap {
 		void *allocate(size_t n) const {
 			return in_heap_allocate(header, *_barrier, n);
 		}
+		// The space comes back zeroed, if possible without touching it.
+		void *allocate_zeroed(size_t n) const {
+			return in_heap_allocate_zeroed(header, *_barrier, n);
+		}
 		void deallocate(void *ptr) const {
 			in_heap_deallocate(header, *_barrier, ptr);
 		}
@@ -146,6 +151,9 @@ namespace pheap {
 
 		// TODO: If you call sync() from within a no_sync_region, you deadlock!
 		void sync();
+		// Merges adjacent free blocks, if the heap is filling up.
+		// Meant to be called now and then from a background thread.
+		void coalesce();
 		persistent_heap(std::string name);
 		operator bool() const {
 			return header != nullptr;
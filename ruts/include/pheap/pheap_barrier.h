@@ -38,11 +38,23 @@
 #include "pheap/spin.h"
 #include <atomic>
 #include <thread>
-#include <mutex>
-#include <condition_variable>
+#include <vector>
+#include <cstdint>
 #include <cassert>
 
 namespace pheap {
+    /*
+     * Keeps syncs out while any thread is in a mutate region, and new
+     * mutate regions out while a sync is running.
+     *
+     * Each thread that enters a mutate region registers with the
+     * barrier and gets a counter of its own, on its own cache line,
+     * so entering and leaving a region doesn't touch anything shared
+     * with other mutators.  Nested regions only bump a thread-local
+     * depth.  A sync sets the low bit of _sync_state, after which
+     * threads entering a new (outermost) region back off until it's
+     * done, and waits for all the counters to drain.
+     */
     class barrier {
     public:
     	void enter_for_mutate();
@@ -50,37 +62,70 @@ namespace pheap {
     	bool enter_for_sync();
     	void exit_for_sync(bool did_sync);
 
-    	enum state : char { Idle, Mutating, Allowing, Syncing, Unwinding };
+    	constexpr static std::size_t max_slots = 256;
 
-    	struct compound_state {
-    		uint16_t n_mutate_regions;
-    		uint16_t n_sync_regions;
-    		state _state;
+    	barrier() = default;
+    	barrier(const barrier &) = delete;
+    	barrier &operator =(const barrier &) = delete;
+    private:
+    	struct slot {
+    		std::atomic<uint32_t> active{0};
+    		std::atomic<bool> taken{false};
+    		char _pad[64 - sizeof(std::atomic<uint32_t>) - sizeof(std::atomic<bool>)];
     	};
 
-    	static_assert(sizeof(compound_state) < 32, "Compound state needs to fit in 64-bit integer");
-    	barrier();
-    private:
-    	std::mutex _mutex;
-    	std::condition_variable _mutate_okay;
-    	std::condition_variable _sync_okay;
-    	std::condition_variable _sync_done;
-    	std::atomic<uint64_t> _state;
-    	bool update_state(compound_state &expected, const compound_state &val);
-    	bool update_state(compound_state &expected, state s, int16_t delta_mutators, int16_t delta_syncs) {
-    		compound_state new_state = expected;
-    		new_state.n_mutate_regions += delta_mutators;
-    		new_state.n_sync_regions += delta_syncs;
-    		new_state._state = s;
-    		return update_state(expected, new_state);
-    	}
-    	bool update_state(compound_state &expected, uint16_t delta_mutators, uint16_t delta_syncs) {
-    		return update_state(expected, expected._state, delta_mutators, delta_syncs);
+    	struct registration {
+    		barrier *owner;
+    		slot *s;
+    		std::atomic<uint32_t> *active;
+    		uint32_t depth;
+    	};
+
+    	class thread_registrations {
+    		std::vector<registration> _regs;
+    	public:
+    		registration &find(barrier *b) {
+    			for (registration &r : _regs) {
+    				if (r.owner == b) {
+    					return r;
+    				}
+    			}
+    			_regs.push_back(b->enroll());
+    			return _regs.back();
+    		}
+    		~thread_registrations() {
+    			for (registration &r : _regs) {
+    				if (r.s != nullptr) {
+    					r.s->taken = false;
+    				}
+    			}
+    		}
+    	};
+
+    	slot _slots[max_slots];
+    	// Shared by threads that didn't get a slot of their own
+    	std::atomic<uint32_t> _overflow{0};
+    	char _pad[64 - sizeof(std::atomic<uint32_t>)];
+    	// Twice the number of syncs done, plus one while a sync is running
+    	std::atomic<uint64_t> _sync_state{0};
+
+    	registration enroll();
+    	bool drained() const;
+
+    	static registration &mine(barrier *b) {
+    		static thread_local thread_registrations regs;
+    		return regs.find(b);
     	}
-    	void unwind(compound_state &s, bool did_sync);
 
+    	bool syncing() const {
+    		return (_sync_state.load() & 1) != 0;
+    	}
 
-    	compound_state current();
+    	template <typename Pred>
+    	static void wait_until(Pred &&pred) {
+    		spin_until(std::forward<Pred>(pred), 64, 16, std::chrono::microseconds(50), 1,
+    				std::chrono::hours(24));
+    	}
     };
 
 
@@ -113,86 +158,26 @@ namespace pheap {
 	};
 
 
-	union state_or_int {
-		barrier::compound_state _state;
-		uint64_t _int;
-	};
-
-	inline barrier::barrier() {
-		state_or_int sori;
-		sori._state = { 0, 0, Idle};
-		_state = sori._int;
-	}
-
-	inline bool barrier::update_state(compound_state &expected, const compound_state &val) {
-		state_or_int u_expected;
-		u_expected._state = expected;
-		state_or_int u_val;
-		u_val._state = val;
-		bool res = _state.compare_exchange_strong(u_expected._int, u_val._int);
-		if (!res) {
-			expected = u_expected._state;
-		}
-		return res;
-	}
-
-
-	inline barrier::compound_state barrier::current() {
-		state_or_int u;
-		u._int = _state;
-		return u._state;
-	}
-
-
 	inline void barrier::enter_for_mutate() {
-		compound_state s = current();
-		spin_loop loop;
-		while (loop()) {
-			switch (s._state) {
-			case Idle:
-			case Mutating:
-				if (update_state(s, Mutating, +1, 0)) {
-					return;
-				}
-				break;
-			case Allowing:
-			case Syncing:
-			case Unwinding:
-			{
-				if (update_state(s, +1, 0)) {
-					std::unique_lock<std::mutex> lck(_mutex);
-					// No syncs can now enter or
-					// exit, so either they all
-					// exited in between our
-					// update and our grabbing the
-					// lock or we have to wait.
-					s = current();
-					if (s._state == Mutating) {
-						return;
-					}
-					_mutate_okay.wait(lck, [this](){ return current()._state == Mutating; });
-				}
-				break;
-			}
+		registration &r = mine(this);
+		if (r.depth++ > 0) {
+			return;
+		}
+		while (true) {
+			r.active->fetch_add(1);
+			if (!syncing()) {
+				return;
 			}
+			r.active->fetch_sub(1);
+			wait_until([this](){ return !syncing(); });
 		}
 	}
 
 	inline void barrier::exit_for_mutate() {
-		compound_state s = current();
-		spin_loop loop;
-		while (loop()) {
-			assert(s._state == Mutating);
-			state next = s.n_mutate_regions > 1 ? Mutating
-					: s.n_sync_regions == 0 ? Idle
-							: Allowing;
-			if (update_state(s, next, -1, 0)) {
-				if (next == Allowing) {
-					std::unique_lock<std::mutex> lck(_mutex);
-					_sync_okay.notify_all();
-				}
-				return;
-			}
+		registration &r = mine(this);
+		assert(r.depth > 0);
+		if (--r.depth == 0) {
+			r.active->fetch_sub(1);
 		}
 	}
 
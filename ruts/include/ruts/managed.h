@@ -120,6 +120,10 @@ namespace ruts {
         return static_cast<pointer>(heap().allocate(n * sizeof(T)));
       }
 
+      pointer allocate_zeroed(size_t n) {
+        return static_cast<pointer>(heap().allocate_zeroed(n * sizeof(T)));
+      }
+
       void deallocate(pointer ptr, size_type n)
       {
         heap().deallocate(ptr);
@@ -181,6 +185,10 @@ namespace ruts {
       heap().sync();
     }
 
+    static void coalesce() {
+      heap().coalesce();
+    }
+
     template <typename T>
     static T *lookup(std::size_t which)
     {
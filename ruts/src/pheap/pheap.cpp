@@ -36,29 +36,178 @@
 #include "ruts/util.h"
 #include "pheap_util.h"
 #include <memory>
+#include <cstring>
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <cassert>
 #include <unistd.h>
+#include <signal.h>
+#include <cerrno>
+#include <iostream>
 
 
 
 using namespace pheap;
 using std::string;
 
+namespace {
+  /*
+   * Per-thread magazines of free blocks for the small size classes,
+   * so that most allocations and deallocations touch neither the
+   * shared free list heads nor the barrier.  A magazine refills
+   * (popping a batch from the free list, or carving a run of new
+   * blocks) and flushes (pushing half of itself as one chain) inside
+   * a mutate_region, but a hit only rewrites the header of a block
+   * that no other thread can see.
+   *
+   * Cached blocks are marked free, so a double deallocate is still
+   * caught.  A thread's magazines are flushed when it exits, but the
+   * blocks cached by a process that dies are lost to the heap.
+   */
+  constexpr size_t max_cached_class = size_class_for(4096);
+  constexpr size_t max_cached_heaps = 4;
+
+  inline size_t magazine_limit(size_t size_class) {
+    size_t n = (size_t{16} << 10) / size_class_units(size_class) / 16;
+    return n < 4 ? 4 : n > 64 ? 64 : n;
+  }
+
+  struct magazine {
+    block *top = nullptr;
+    size_t count = 0;
+  };
+
+  class thread_cache {
+    in_heap_header *_header = nullptr;
+    barrier *_barrier = nullptr;
+    magazine _mags[max_cached_class+1];
+
+    void refill(size_t size_class) {
+      magazine &m = _mags[size_class];
+      size_t want = magazine_limit(size_class)/2;
+      mutate_region region(*_barrier);
+      free_list &fl = _header->free_lists[size_class];
+      while (m.count < want) {
+        block *b = fl.pop();
+        if (b == nullptr) {
+          break;
+        }
+        b->_next_free = m.top;
+        m.top = b;
+        m.count++;
+      }
+      if (m.count == 0) {
+        block *b = _header->split_larger(size_class);
+        if (b != nullptr) {
+          b->_next_free = nullptr;
+          m.top = b;
+          m.count = 1;
+          return;
+        }
+        block *run = _header->new_blocks(size_class, want);
+        if (run != nullptr) {
+          m.top = run;
+          m.count = want;
+        }
+      }
+    }
+
+    void flush(size_t size_class, size_t n) {
+      magazine &m = _mags[size_class];
+      if (n == 0 || m.top == nullptr) {
+        return;
+      }
+      block *first = m.top;
+      block *last = first;
+      for (size_t i = 1; i < n && last->_next_free != nullptr; i++) {
+        last = last->_next_free;
+        m.count--;
+      }
+      m.count--;
+      m.top = last->_next_free;
+      mutate_region region(*_barrier);
+      _header->free_lists[size_class].push_chain(first, last);
+    }
+
+  public:
+    ~thread_cache() {
+      if (_header != nullptr) {
+        for (size_t sc = 0; sc <= max_cached_class; sc++) {
+          flush(sc, _mags[sc].count);
+        }
+      }
+    }
+
+    static thread_cache *find(in_heap_header *header, barrier &b) {
+      // The barrier's per-thread state has to outlive the caches,
+      // since they're flushed in a mutate_region at thread exit, so
+      // make sure it's constructed first.
+      static thread_local bool barrier_ready = false;
+      if (!barrier_ready) {
+        mutate_region region(b);
+        barrier_ready = true;
+      }
+      static thread_local thread_cache caches[max_cached_heaps];
+      for (thread_cache &tc : caches) {
+        if (tc._header == header) {
+          return &tc;
+        }
+        if (tc._header == nullptr) {
+          tc._header = header;
+          tc._barrier = &b;
+          return &tc;
+        }
+      }
+      return nullptr;
+    }
+
+    block *pop(size_t size_class) {
+      magazine &m = _mags[size_class];
+      if (m.top == nullptr) {
+        refill(size_class);
+        if (m.top == nullptr) {
+          return nullptr;
+        }
+      }
+      block *b = m.top;
+      m.top = b->_next_free;
+      m.count--;
+      return b;
+    }
+
+    void push(block *b) {
+      size_t size_class = b->_size_class;
+      magazine &m = _mags[size_class];
+      b->_freep = true;
+      b->_next_free = m.top;
+      m.top = b;
+      if (++m.count > magazine_limit(size_class)) {
+        flush(size_class, m.count/2);
+      }
+    }
+  };
+}
+
 void pheap::in_heap_deallocate(in_heap_header *header, barrier &_barrier, void *ptr) {
   if (ptr == nullptr) {
     return;
   }
-  mutate_region region(_barrier);
   block *b = block::from(ptr);
   if (!header->check_pointer(b)) {
     // TODO
     return;
   }
   auto size_class = b->_size_class;
+  if (size_class <= max_cached_class) {
+    thread_cache *tc = thread_cache::find(header, _barrier);
+    if (tc != nullptr) {
+      tc->push(b);
+      return;
+    }
+  }
+  mutate_region region(_barrier);
   header->free_lists[size_class].push(b);
 }
 
@@ -66,22 +215,200 @@ void *pheap::in_heap_allocate(in_heap_header *header, barrier &_barrier, size_t
   if (n == 0) {
     return nullptr;
   }
-  size_t leading_zeroes = __builtin_clzl(n);
-  size_t lg = 63-leading_zeroes;
-  if (n != size_t{1} << lg) {
-    lg++;
+  size_t size_class = size_class_for(n);
+  if (size_class <= max_cached_class) {
+    thread_cache *tc = thread_cache::find(header, _barrier);
+    block *b = tc == nullptr ? nullptr : tc->pop(size_class);
+    if (b != nullptr) {
+      b->_next_free = nullptr;
+      b->_freep = false;
+      return b->data();
+    }
   }
-  size_t size_class = lg < 4 ? 0 : lg - 4;
   mutate_region region(_barrier);
-  block *b = header->free_lists[size_class].pop();
+  free_list &fl = header->free_lists[size_class];
+  block *b = fl.pop();
+  if (b == nullptr) {
+    b = header->split_larger(size_class);
+  }
   if (b == nullptr) {
     b = header->new_block(size_class);
   }
+  if (b == nullptr && header->coalesce(true)) {
+    b = fl.pop();
+    if (b == nullptr) {
+      b = header->split_larger(size_class);
+    }
+  }
+  if (b == nullptr) {
+    size_t bytes = size_class_units(size_class)*sizeof(block);
+    std::cerr << "Failed to allocate " << std::dec << bytes << "-byte (0x" << std::hex << bytes << std::dec << ") block in persistent heap." << std::endl;
+    return nullptr;
+  }
   b->_next_free = nullptr;
   b->_freep = false;
   return b->data();
 }
 
+/*
+ * Makes the n_units units from start into free blocks, as few as
+ * possible.  A single unit can't hold a block, so none is ever left
+ * over.
+ */
+void in_heap_header::release_range(block *start, size_t n_units) {
+  while (n_units >= 2) {
+    size_t sc = largest_class_within(n_units-1);
+    if (n_units - (size_class_units(sc)+1) == 1) {
+      sc--;
+    }
+    block *b = new (start) block{sc};
+    b->_formed.store(true, std::memory_order_release);
+    free_lists[sc].push(b);
+    n_units -= size_class_units(sc)+1;
+    start = b->following();
+  }
+  assert(n_units == 0);
+}
+
+/*
+ * Pops the smallest free block bigger than the size class and, if
+ * what's past the first size_class_units(size_class) units is big
+ * enough to be a block, splits it off and frees it.  Returns the
+ * (possibly still larger) block, or nullptr if no larger one is free.
+ */
+block *in_heap_header::split_larger(size_t size_class) {
+  for (size_t sc = size_class+1; sc < n_size_classes; sc++) {
+    if (free_lists[sc].empty()) {
+      continue;
+    }
+    block *b = free_lists[sc].pop();
+    if (b == nullptr) {
+      continue;
+    }
+    size_t want = size_class_units(size_class)+1;
+    size_t rest = b->n_blocks()+1 - want;
+    if (rest >= 2) {
+      // The remainder's headers have to be in place before b
+      // shrinks, or a coalescing pass walking the heap could step
+      // into the middle of it.
+      release_range(b+want, rest);
+      std::atomic_thread_fence(std::memory_order_release);
+      b->_size_class = size_class;
+    }
+    return b;
+  }
+  return nullptr;
+}
+
+/*
+ * Merges adjacent free blocks.  The pass takes every free list (so
+ * anything freed while it runs is left alone), flags the blocks it
+ * took, walks the heap from the start to the frontier, and releases
+ * each run of flagged blocks as one range.  Blocks cached by threads
+ * and allocated blocks are never flagged.  The walk stops early at a
+ * block that's been carved but whose header isn't written yet;
+ * blocks past it stay flagged (and off the lists) until the next
+ * pass.
+ *
+ * Only one process runs a pass at a time.  If that process dies, the
+ * next one to try takes over, and will pick up whatever it had
+ * flagged.  Unless force is true, there's only a pass once the
+ * frontier is more than halfway through the heap.  Returns true if
+ * anything was merged.
+ *
+ * force is for allocators that have run out of room.  While a pass
+ * is running it has the free lists, so rather than fail for want of
+ * them, a forced call waits for the pass to finish and returns true
+ * so that the caller looks again.
+ */
+bool in_heap_header::coalesce(bool force) {
+  if (!force && first_unallocated_block < first_block_in_mem + (first_impossible_block - first_block_in_mem)/2) {
+    return false;
+  }
+  pid_t me = getpid();
+  for (;;) {
+    pid_t running = 0;
+    if (coalescer.compare_exchange_strong(running, me)) {
+      break;
+    }
+    auto alive = [=]() {
+      return running == me || kill(running, 0) == 0 || errno != ESRCH;
+    };
+    if (!alive()) {
+      if (coalescer.compare_exchange_strong(running, me)) {
+        break;
+      }
+      continue;
+    }
+    if (!force) {
+      return false;
+    }
+    spin_until([&]() { return coalescer.load() != running || !alive(); },
+               64, 16, std::chrono::microseconds(50), 1, std::chrono::hours(24));
+    if (coalescer.load() != running) {
+      return true;
+    }
+  }
+  for (size_t sc = 0; sc < n_size_classes; sc++) {
+    for (block *b = free_lists[sc].take_all(); b != nullptr; b = b->_next_free) {
+      b->_coalescing = true;
+    }
+  }
+  bool merged = false;
+  block *const end = first_unallocated_block;
+  block *b = first_block_in_mem;
+  while (b < end && b->_formed.load(std::memory_order_acquire)) {
+    if (!b->_coalescing) {
+      b = b->following();
+      continue;
+    }
+    block *run = b;
+    size_t n_units = 0;
+    size_t n_merged = 0;
+    while (b < end && b->_formed.load(std::memory_order_acquire) && b->_coalescing) {
+      n_units += b->n_blocks()+1;
+      n_merged++;
+      b = b->following();
+    }
+    release_range(run, n_units);
+    merged |= n_merged > 1;
+  }
+  coalescer = 0;
+  return merged;
+}
+
+void persistent_heap::coalesce() {
+  // A half-merged heap mustn't be synced.
+  mutate_region region(*_barrier);
+  header->coalesce(false);
+}
+
+/*
+ * Space past the frontier has never been handed out, and the heap
+ * file starts out sparse, so a block carved from there is already
+ * zero and its pages needn't be touched.  Only when there's no room
+ * there is a recycled block cleared.
+ */
+void *pheap::in_heap_allocate_zeroed(in_heap_header *header, barrier &_barrier, size_t n) {
+  if (n == 0) {
+    return nullptr;
+  }
+  {
+    mutate_region region(_barrier);
+    block *b = header->new_block(size_class_for(n));
+    if (b != nullptr) {
+      b->_next_free = nullptr;
+      b->_freep = false;
+      return b->data();
+    }
+  }
+  void *p = in_heap_allocate(header, _barrier, n);
+  if (p != nullptr) {
+    std::memset(p, 0, n);
+  }
+  return p;
+}
+
 void persistent_heap::sync() {
 	sync_region region(*_barrier);
 	if (region) {
@@ -92,6 +419,9 @@ void persistent_heap::sync() {
 
 
 
+constexpr std::uint32_t in_heap_header::format_magic;
+constexpr std::uint32_t in_heap_header::format_version;
+
 in_heap_header *in_heap_header::place_at(void *loc, size_t size) {
   //  cerr << "Placing heap at " << loc << std::endl;
   //  cerr << "  Size is " << hex << size << std::endl;
@@ -171,7 +501,13 @@ namespace {
 		return heapsize;
 	}
 
-	void* old_load_location(int fd) {
+	/*
+	 * Returns where the heap was last loaded, or nullptr for a fresh
+	 * (all zero) heap file.  For a heap that has been loaded, also
+	 * checks that it was written in the current format, and if not,
+	 * says so and sets compatible to false.
+	 */
+	void* old_load_location(int fd, const string &name, bool &compatible) {
 		void *loaded_at = mmap(nullptr, sizeof(in_heap_header), PROT_READ,
 				MAP_PRIVATE, fd, 0);
 		assert(loaded_at != MAP_FAILED);
@@ -179,6 +515,14 @@ namespace {
 		dout << "First load at " << std::hex << loaded_at << std::endl;
 		in_heap_header* header = static_cast<in_heap_header*>(loaded_at);
 		void* was_loaded_at = header->loaded_at;
+		compatible = was_loaded_at == nullptr || header->has_current_format();
+		if (!compatible) {
+			ruts::reset_flags_on_exit ef{std::cerr};
+			std::cerr << "Persistent heap " << name << " has format 0x" << std::hex << header->magic
+				  << std::dec << " version " << header->version << ", but this code expects format 0x"
+				  << std::hex << in_heap_header::format_magic << std::dec << " version "
+				  << in_heap_header::format_version << ".  Recreate the heap." << std::endl;
+		}
 		int r = munmap(loaded_at, sizeof(in_heap_header));
 		assert(r == 0);
 		return was_loaded_at;
@@ -211,7 +555,11 @@ namespace {
 		open_fd fd(name);
 
 		size_t heapsize = heap_size(fd);
-		void* was_loaded_at = old_load_location(fd);
+		bool compatible;
+		void* was_loaded_at = old_load_location(fd, name, compatible);
+		if (!compatible) {
+			return nullptr;
+		}
 		if (was_loaded_at == nullptr) {
 			void *hole = find_big_hole(15*TB(), 7*TB(), pagesize());
 			for (int i=0; i<10; i++) {
@@ -30,83 +30,56 @@ using namespace pheap;
 using namespace std;
 
 
+barrier::registration barrier::enroll() {
+	for (slot &s : _slots) {
+		bool expected = false;
+		if (!s.taken && s.taken.compare_exchange_strong(expected, true)) {
+			return registration{this, &s, &s.active, 0};
+		}
+	}
+	return registration{this, nullptr, &_overflow, 0};
+}
 
-
-bool barrier::enter_for_sync() {
-	unique_lock<mutex> lck(_mutex);
-	compound_state s = current();
-	spin_loop loop;
-	while (loop()) {
-		if (s._state == Mutating) {
-			if (update_state(s, 0, +1)) {
-				bool val;
-				_sync_okay.wait(lck, [this, &val](){
-					compound_state s = current();
-					switch (s._state) {
-					case Allowing:
-						val = true;
-						spin_until([this, &s](){
-							// The only other thing that can happen here is
-							// a mutator entry, which doesn't change the state
-							// spin
-							assert(s._state == Allowing);
-							return update_state(s, Syncing, 0, 0);
-						});
-						return true;
-					case Syncing:
-						// Somebody beat us to it.
-						val = false;
-						return true;
-					default:
-						return false;
-					}
-				});
-				return val;
-			}
-		} else {
-			state next = s._state == Unwinding ? Unwinding : Syncing;
-			if (update_state(s, next, 0, +1)) {
-				return s._state == Allowing || s._state == Idle;
-			}
+bool barrier::drained() const {
+	if (_overflow.load() != 0) {
+		return false;
+	}
+	for (const slot &s : _slots) {
+		if (s.active.load() != 0) {
+			return false;
 		}
 	}
-	assert(false);
-	return false;
+	return true;
 }
 
-void barrier::unwind(compound_state &s, bool did_sync) {
-	// mutex must be locked
-	spin_loop loop;
-	while (loop()) {
-		state next = s.n_sync_regions > 1 ? Unwinding : s.n_mutate_regions == 0 ? Idle : Mutating;
-		if (update_state(s, next, 0, -1)) {
-			if (did_sync && next == Unwinding) {
-				_sync_done.notify_all();
-			} else if (next == Mutating) {
-				_mutate_okay.notify_all();
-			}
-			return;
+/*
+ * Returns false, without waiting for mutators, if a sync that
+ * started after this call has already finished by the time this one
+ * could start.
+ */
+bool barrier::enter_for_sync() {
+	uint64_t s = _sync_state.load();
+	// If one is running now, it may have started before our caller's
+	// changes, so it takes the one after it.
+	const uint64_t covered = s + 2 + (s & 1);
+	while (true) {
+		if (s >= covered) {
+			return false;
+		}
+		if ((s & 1) == 0 && _sync_state.compare_exchange_strong(s, s+1)) {
+			wait_until([this](){ return drained(); });
+			return true;
 		}
+		wait_until([this, &s](){
+			s = _sync_state.load();
+			return (s & 1) == 0;
+		});
 	}
 }
 
 void barrier::exit_for_sync(bool did_sync) {
-	unique_lock<mutex> lck(_mutex);
-	compound_state s = current();
 	if (did_sync) {
-		assert(s._state == Syncing);
-		unwind(s, true);
-	} else {
-		if (s._state == Syncing) {
-			_sync_done.wait(lck, [this, &s]() {
-				return (s = current())._state == Unwinding;
-			});
-		}
-		assert(s._state == Unwinding);
-		unwind(s, false);
+		assert(syncing());
+		_sync_state.fetch_add(1);
 	}
 }
-
-
-
-
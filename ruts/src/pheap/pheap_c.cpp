@@ -51,7 +51,7 @@ void pheap_init(const char *const heapfile) {
 }
 
 int pheap_ready() {
-	return heap != nullptr;
+	return heap != nullptr && *heap;
 }
 
 void *pheap_malloc(size_t size) {
@@ -38,21 +38,70 @@
 #include "ruts/versioned_ptr.h"
 #include <string>
 #include <atomic>
+#include <cstdint>
 #include <iostream>
+#include <sys/types.h>
 
 namespace pheap {
+  /*
+   * Size classes are counted in 16-byte units, and there are four to
+   * each power of two: 1, 2, 3 and 4 units, then 5, 6, 7 and 8, then
+   * 10, 12, 14 and 16, and so on, so a block is never more than 25%
+   * bigger than the request it was chosen for.
+   */
+  constexpr std::size_t n_size_classes = 192;
+
+  constexpr std::size_t size_class_units(std::size_t size_class) {
+    return size_class < 4 ? size_class+1
+      : (5 + size_class%4) << (size_class/4 - 1);
+  }
+
+  /*
+   * The biggest size class with no more than n_units (> 0) units.
+   */
+  constexpr std::size_t largest_class_within(std::size_t n_units) {
+    if (n_units <= 4) {
+      return n_units-1;
+    }
+    std::size_t e = (63-__builtin_clzl(n_units)) - 2;
+    std::size_t q = n_units >> e;
+    return q == 4 ? 4*e + 3 : 4*(e+1) + (q-5);
+  }
+
+  /*
+   * The smallest size class that holds n (> 0) bytes.
+   */
+  constexpr std::size_t size_class_for(std::size_t n) {
+    std::size_t n_units = (n+15) >> 4;
+    std::size_t sc = largest_class_within(n_units);
+    return size_class_units(sc) < n_units ? sc+1 : sc;
+  }
+
+  static_assert(size_class_for(16) == 0 && size_class_for(17) == 1, "Bad small size classes");
+  static_assert(size_class_units(size_class_for(4096)) == 256, "Bad size classes");
+  static_assert(size_class_units(size_class_for(4097)) == 320, "Bad size classes");
+
   class /*alignas(16)*/ block {
   public:
     block *_next_free = nullptr;
     uint8_t _size_class;
     bool _freep = true;
+    // Set once the header is written.  Left alone by the constructor,
+    // since unallocated space is known to be zero.
+    std::atomic<bool> _formed;
+    // Taken off its free list by the running coalescing pass
+    bool _coalescing = false;
 
     void *data() {
       return static_cast<void*>(this+1);
     }
 
     std::size_t n_blocks() const {
-      return std::size_t{1} << _size_class;
+      return size_class_units(_size_class);
+    }
+    /* Where the next block in memory starts */
+    block *following() {
+      return this + n_blocks() + 1;
     }
     std::size_t size() const {
       return n_blocks() << 4;
@@ -94,6 +143,18 @@ namespace pheap {
 	});
     }
 
+    /*
+     * Pushes the blocks from first to last, already linked through
+     * _next_free and marked free, with a single CAS.
+     */
+    void push_chain(block *first, block *last) {
+      _head.update([=](ruts::versioned<block *> h) {
+	  last->_next_free = h;
+	  h.inc_and_set(first);
+	  return h;
+	});
+    }
+
     block *pop() {
       auto clrv = _head.try_update([](ruts::versioned<block *> h) {
 	  return h != nullptr;
@@ -108,6 +169,23 @@ namespace pheap {
       }
     }
 
+    /*
+     * Empties the list with a single CAS, returning its blocks.
+     */
+    block *take_all() {
+      block *taken = nullptr;
+      _head.update([&](ruts::versioned<block *> h) {
+	  taken = h;
+	  h.inc_and_set(nullptr);
+	  return h;
+	});
+      return taken;
+    }
+
+    bool empty() const {
+      return _head.pointer() == nullptr;
+    }
+
   };
   class in_heap_header {
   public:
@@ -116,18 +194,40 @@ namespace pheap {
     }
 
     block *new_block(size_t size_class) {
-      size_t s = (size_t{1} << size_class)+1;
+      size_t s = size_class_units(size_class)+1;
       block *fub = first_unallocated_block;
       while (fub+s <= first_impossible_block) {
         if (first_unallocated_block.compare_exchange_weak(fub, fub+s)) {
           new (fub) block{size_class};
+          fub->_formed.store(true, std::memory_order_release);
+          return fub;
+        }
+      }
+      return nullptr;
+    }
+    /*
+     * Carves n free blocks of the size class with a single CAS and
+     * returns them linked through _next_free, or nullptr if there
+     * isn't room for all of them.
+     */
+    block *new_blocks(size_t size_class, size_t n) {
+      size_t s = size_class_units(size_class)+1;
+      block *fub = first_unallocated_block;
+      while (fub+s*n <= first_impossible_block) {
+        if (first_unallocated_block.compare_exchange_weak(fub, fub+s*n)) {
+          for (size_t i = 0; i < n; i++) {
+            block *b = new (fub+s*i) block{size_class};
+            b->_next_free = i+1 < n ? fub+s*(i+1) : nullptr;
+            b->_formed.store(true, std::memory_order_release);
+          }
           return fub;
         }
       }
-      size_t bytes = (s-1)*sizeof(block);
-      std::cerr << "Failed to allocate " << std::dec << bytes << "-byte (0x" << std::hex << bytes << std::dec << ") block in persistent heap." << std::endl;
       return nullptr;
     }
+    void release_range(block *start, size_t n_units);
+    block *split_larger(size_t size_class);
+    bool coalesce(bool force);
     void *allocate(size_t n);
     void deallocate(void *ptr);
 
@@ -136,23 +236,41 @@ namespace pheap {
     }
     bool set_root(void *new_root, pheap::barrier &_barrier);
 
+    /*
+     * A heap file can only be used by code that lays out the header,
+     * the blocks, and the size classes the way it was written.
+     * loaded_at is the first word in every format, so it can be read
+     * before the format is known.  Anything that changes the layout
+     * has to bump format_version.  (Version 1, which had no magic,
+     * used power-of-two size classes.)
+     */
+    constexpr static std::uint32_t format_magic = 0x70686561;
+    constexpr static std::uint32_t format_version = 2;
+
+    bool has_current_format() const {
+      return magic == format_magic && version == format_version;
+    }
 
     void *loaded_at;
+    std::uint32_t magic;
+    std::uint32_t version;
     std::size_t size;
     block *first_block_in_mem;
     block *first_impossible_block;
     void *root_obj;
     std::atomic<block *> first_unallocated_block;
-    free_list free_lists[60];
+    free_list free_lists[n_size_classes];
+    // The process running a coalescing pass, if any
+    std::atomic<pid_t> coalescer;
 
     static in_heap_header *load(const std::string &name);
     void sync();
     static in_heap_header *place_at(void *addr, size_t size);
   private:
     explicit in_heap_header(void *addr)
-    : loaded_at(addr), size(0),
+    : loaded_at(addr), magic(format_magic), version(format_version), size(0),
       first_block_in_mem(nullptr), first_impossible_block(nullptr),
-      root_obj(nullptr), first_unallocated_block{nullptr}
+      root_obj(nullptr), first_unallocated_block{nullptr}, coalescer{0}
     {}
   };
 
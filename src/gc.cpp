@@ -36,10 +36,17 @@
 #include <cstdlib>
 #include <iostream>
 #include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <vector>
 
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/vfs.h>
+#include <sys/syscall.h>
+#include <linux/magic.h>
+#include <linux/mempolicy.h>
 #include <fcntl.h>
 #include <unistd.h>
 
@@ -70,6 +77,113 @@ namespace {
   std::string control_heap_file() {
     return heap_file("MPGC_CONTROL_HEAP", "managed_heap");
   }
+
+  /*
+   * Parses a node list like "0,2-5" into a mask.  Returns false if it
+   * doesn't parse.
+   */
+  bool parse_nodes(const std::string &spec, std::vector<unsigned long> &mask) {
+    constexpr std::size_t bits = 8*sizeof(unsigned long);
+    const char *p = spec.c_str();
+    while (*p != '\0') {
+      char *end;
+      unsigned long from = std::strtoul(p, &end, 10);
+      if (end == p) {
+        return false;
+      }
+      unsigned long to = from;
+      p = end;
+      if (*p == '-') {
+        to = std::strtoul(++p, &end, 10);
+        if (end == p || to < from) {
+          return false;
+        }
+        p = end;
+      }
+      for (unsigned long n = from; n <= to; n++) {
+        if (mask.size() <= n/bits) {
+          mask.resize(n/bits + 1, 0);
+        }
+        mask[n/bits] |= 1UL << (n % bits);
+      }
+      if (*p == ',') {
+        p++;
+      } else if (*p != '\0' && *p != '\n') {
+        return false;
+      } else {
+        break;
+      }
+    }
+    return !mask.empty();
+  }
+
+  void set_numa_policy(uint8_t *p, std::size_t size, const std::string &spec) {
+    std::size_t colon = spec.find(':');
+    std::string kind = spec.substr(0, colon);
+    std::string nodes;
+    if (colon != std::string::npos) {
+      nodes = spec.substr(colon+1);
+    } else {
+      std::ifstream online("/sys/devices/system/node/online");
+      if (!std::getline(online, nodes)) {
+        nodes = "0";
+      }
+    }
+    int mode = kind == "interleave" ? MPOL_INTERLEAVE : kind == "bind" ? MPOL_BIND : -1;
+    std::vector<unsigned long> mask;
+    if (mode == -1 || !parse_nodes(nodes, mask)) {
+      std::cout << "Ignoring bad MPGC_HEAP_NUMA setting '" << spec << "'" << std::endl;
+      return;
+    }
+    if (syscall(SYS_mbind, p, size, mode, mask.data(), 8*sizeof(unsigned long)*mask.size() + 1, 0) != 0) {
+      std::cout << "Could not set NUMA policy for the heap: " << std::strerror(errno) << std::endl;
+    }
+  }
+
+  /*
+   * Maps the heap file, configured by the environment:
+   *
+   *   MPGC_HEAP_HUGEPAGES  Ask for transparent huge pages.  Skipped
+   *                        when the heap file is on hugetlbfs, where
+   *                        it gets huge pages anyway.
+   *   MPGC_HEAP_NUMA       "interleave" or "bind", optionally followed
+   *                        by ":" and a node list like "0,2-3" (the
+   *                        default is every online node).  This only
+   *                        has an effect for heap files on tmpfs or
+   *                        hugetlbfs.
+   *   MPGC_HEAP_POPULATE   Fault the whole heap in up front.
+   */
+  uint8_t *map_heap(int fd, std::size_t size) {
+    const bool populate = ruts::env_flag("MPGC_HEAP_POPULATE");
+    const std::string numa = ruts::env_string("MPGC_HEAP_NUMA");
+    // The NUMA policy has to be in place before anything is faulted in.
+    const int flags = MAP_SHARED | (populate && numa.empty() ? MAP_POPULATE : 0);
+    void *m = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if (m == MAP_FAILED) {
+      std::cout << "Map of heap file '" << gc_heap_file() << "' failed: "
+                << std::strerror(errno) << std::endl;
+      std::abort();
+    }
+    uint8_t *p = static_cast<uint8_t*>(m);
+
+    struct statfs fs;
+    const bool on_hugetlbfs = fstatfs(fd, &fs) == 0 && fs.f_type == HUGETLBFS_MAGIC;
+    if (!on_hugetlbfs && ruts::env_flag("MPGC_HEAP_HUGEPAGES")) {
+      if (madvise(p, size, MADV_HUGEPAGE) != 0) {
+        std::cout << "Could not get huge pages for the heap: " << std::strerror(errno) << std::endl;
+      }
+    }
+    if (!numa.empty()) {
+      set_numa_policy(p, size, numa);
+      if (populate) {
+        const std::size_t page = sysconf(_SC_PAGESIZE);
+        for (std::size_t off = 0; off < size; off += page) {
+          static_cast<volatile uint8_t*>(p)[off];
+        }
+      }
+    }
+    return p;
+  }
 }
 
 std::string ruts::managed_space::name()
@@ -91,6 +205,9 @@ namespace mpgc {
 
   gc_control_block *cblock = nullptr;
 
+  constexpr std::uint32_t gc_control_block::format_magic;
+  constexpr std::uint32_t gc_control_block::format_version;
+
   void initialize() {
     static std::once_flag done;
     std::call_once(done, [] {
@@ -108,18 +225,23 @@ namespace mpgc {
         assert(ret == 0);
       }
 
-      uint8_t* p = static_cast<uint8_t*>(mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+      uint8_t* p = map_heap(fd, st.st_size);
       close(fd);
-      if (p == MAP_FAILED) {
-        std::cout << "Map of heap file '" << gc_heap_file() << "' failed: "
-                  << std::strerror(errno) << std::endl;
-        std::abort();
-      }
 
       base_offset_ptr::initialize(p, st.st_size);
+      dirty_tracking::initialize();
       //gc_control_block &block = ruts::managed_space::find_or_construct<gc_control_block>(42, p, st.st_size);
       //gc_allocator::initialize(st.st_size, block.global_free_list);
       cblock = reinterpret_cast<gc_control_block*>(p);
+      if (!cblock->has_current_format()) {
+        std::cout << "Heap file '" << gc_heap_file() << "' wasn't created by this version of MPGC";
+        if (cblock->magic == gc_control_block::format_magic) {
+          std::cout << " (its format is version " << cblock->version
+                    << ", not " << gc_control_block::format_version << ")";
+        }
+        std::cout << ".  Recreate it with createheap." << std::endl;
+        std::abort();
+      }
       gc_handshake::initialize1();
     });
     gc_handshake::initialize2();
@@ -140,13 +262,8 @@ namespace mpgc {
         assert(ret == 0);
       }
 
-      uint8_t* p = static_cast<uint8_t*>(mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+      uint8_t* p = map_heap(fd, st.st_size);
       close(fd);
-      if (p == MAP_FAILED) {
-        std::cout << "Map of heap file '" << gc_heap_file() << "' failed: "
-                  << std::strerror(errno) << std::endl;
-        std::abort();
-      }
 
       base_offset_ptr::initialize(p, st.st_size);
 
@@ -50,6 +50,7 @@ namespace mpgc {
   constexpr gc_descriptor::size_field gc_descriptor::l1_f1_fld;
   
   constexpr std::size_t gc_descriptor::list_width[];
+  constexpr std::size_t gc_descriptor::max_static_fields;
 
 
   /**
@@ -327,7 +328,8 @@ namespace mpgc {
       std::sort(field_offsets.begin(), field_offsets.end());
     }
 
-    rep_type pos_list = nrefs > 8 ? 0 
+    // The list length has to fit in n_fields_fld.
+    rep_type pos_list = nrefs > gc_descriptor::n_fields_fld.max_val() ? 0 
       : gc_descriptor::list_rep(n_fields, nrefs, true, 
 				field_offsets.cbegin(), field_offsets.cend());
     std::size_t n_missing = n_fields-nrefs;
@@ -161,6 +161,14 @@ namespace mpgc {
         process_stack(reinterpret_cast<std::size_t*>(&stack_addr),
                       reinterpret_cast<std::size_t*>(thread_struct.stack_end),
                       mark_gray, thread_struct);
+        for (const allocation_batch *batch = &thread_struct.pending_batch;
+             batch != nullptr;
+             batch = batch->outer) {
+          for (std::size_t i = 0; i < batch->count; i++) {
+            mark_gray(offset_ptr<const gc_allocated>(
+              reinterpret_cast<const gc_allocated*>(batch->begin + i * batch->stride)), thread_struct);
+          }
+        }
 
         thread_struct.status_idx = gc_status(Signum::sigAsync, thread_struct.status_idx.load().index());
       }
@@ -0,0 +1,177 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the 
+ *  Application containing code generated by the Library and added to the 
+ *  Application during this compilation process under terms of your choice, 
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+/*
+ * gc_persist.cpp
+ */
+
+#include <algorithm>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "mpgc/gc_persist.h"
+#include "ruts/util.h"
+
+namespace mpgc {
+  namespace dirty_tracking {
+    std::atomic<std::uint64_t> *granules = nullptr;
+
+    void initialize() {
+#ifdef MPGC_DIRTY_TRACKING
+      if (!ruts::env_flag("MPGC_TRACK_DIRTY")) {
+        return;
+      }
+      std::size_t n_granules = (base_offset_ptr::heap_size() + (std::size_t{1} << granule_bits) - 1) >> granule_bits;
+      granules = new std::atomic<std::uint64_t>[(n_granules + 63) >> 6]();
+#endif
+    }
+  }
+
+  namespace {
+    using range = std::pair<uint8_t*, std::size_t>;
+
+    inline std::size_t pagesize() {
+      static const std::size_t size = sysconf(_SC_PAGESIZE);
+      return size;
+    }
+
+    bool flush(const range &r) {
+      return msync(r.first, r.second, MS_SYNC) == 0;
+    }
+
+    /*
+     * Takes the dirty granules, as runs.  A granule that's changed
+     * again after its bit is taken is marked again for next time.
+     */
+    std::vector<range> take_dirty() {
+      using namespace dirty_tracking;
+      uint8_t * const base = base_offset_ptr::base();
+      const std::size_t n_granules = (base_offset_ptr::heap_size() + (std::size_t{1} << granule_bits) - 1) >> granule_bits;
+      std::vector<range> runs;
+      std::size_t run_start = n_granules;
+      auto close_run = [&](std::size_t end) {
+        if (run_start < end) {
+          // A page can be bigger than a granule, and msync() wants
+          // the start on a page boundary.
+          std::size_t from = (run_start << granule_bits) & ~(pagesize() - 1);
+          std::size_t size = std::min(end << granule_bits, base_offset_ptr::heap_size()) - from;
+          runs.emplace_back(base + from, size);
+        }
+        run_start = n_granules;
+      };
+      for (std::size_t w = 0; w < (n_granules + 63) >> 6; w++) {
+        std::uint64_t bits = granules[w].load(std::memory_order_relaxed) == 0 ? 0 : granules[w].exchange(0);
+        if (bits == 0) {
+          close_run(w << 6);
+          continue;
+        }
+        for (std::size_t b = 0; b < 64; b++) {
+          std::size_t g = (w << 6) + b;
+          if (g >= n_granules) {
+            break;
+          }
+          if (bits & (std::uint64_t{1} << b)) {
+            if (run_start == n_granules) {
+              run_start = g;
+            }
+          } else {
+            close_run(g);
+          }
+        }
+      }
+      close_run(n_granules);
+      return runs;
+    }
+
+    /*
+     * The whole heap, in one piece per thread.
+     */
+    std::vector<range> whole_heap(std::size_t n_pieces) {
+      const std::size_t heap_size = base_offset_ptr::heap_size();
+      std::size_t piece = (heap_size / n_pieces + pagesize() - 1) & ~(pagesize() - 1);
+      std::vector<range> pieces;
+      for (std::size_t off = 0; off < heap_size; off += piece) {
+        pieces.emplace_back(base_offset_ptr::base() + off, std::min(piece, heap_size - off));
+      }
+      return pieces;
+    }
+  }
+
+  bool persist(const void *p, std::size_t n) {
+    if (n == 0) {
+      return true;
+    }
+    std::uintptr_t start = reinterpret_cast<std::uintptr_t>(p) & ~(pagesize() - 1);
+    std::uintptr_t end = reinterpret_cast<std::uintptr_t>(p) + n;
+    return flush(range(reinterpret_cast<uint8_t*>(start), end - start));
+  }
+
+  bool sync_dirty(std::size_t *n_bytes) {
+    constexpr std::size_t max_threads = 8;
+    std::size_t n_threads = std::max(1u, std::min<unsigned>(std::thread::hardware_concurrency(), max_threads));
+    std::vector<range> runs = dirty_tracking::granules == nullptr ? whole_heap(n_threads) : take_dirty();
+    std::size_t total = 0;
+    for (const range &r : runs) {
+      total += r.second;
+    }
+    if (n_bytes != nullptr) {
+      *n_bytes = total;
+    }
+    std::atomic<bool> ok{true};
+    auto flush_or_remark = [&ok](const range &r) {
+      if (!flush(r)) {
+        ok = false;
+        dirty_tracking::note(r.first, r.second);
+      }
+    };
+    n_threads = std::min(n_threads, runs.size());
+    std::sort(runs.begin(), runs.end(), [](const range &a, const range &b) {
+        return a.second > b.second;
+      });
+    if (n_threads <= 1) {
+      std::for_each(runs.begin(), runs.end(), flush_or_remark);
+      return ok;
+    }
+    // Deal the runs out round-robin, so each thread gets a share of
+    // the big ones.
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < n_threads; t++) {
+      threads.emplace_back([&runs, &flush_or_remark, t, n_threads] {
+        for (std::size_t i = t; i < runs.size(); i += n_threads) {
+          flush_or_remark(runs[i]);
+        }
+      });
+    }
+    for (std::thread &t : threads) {
+      t.join();
+    }
+    return ok;
+  }
+}
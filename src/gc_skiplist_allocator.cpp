@@ -72,7 +72,8 @@ namespace mpgc {
 
       offset_ptr<global_chunk> skiplist::bump_pointer_allocate(gc_control_block &cb,
                                                      slot_number &myslot,
-                                                     const std::size_t size) {
+                                                     const std::size_t size,
+                                                     bool &zeroed) {
         bump_chunk exp{bump_chunk::from_volatile, tail.bump_ptr}, exp1;
         slot_number curr_slot(slot_fld.decode(exp.begin), slot_fld.decode(exp.end)),
                                            curr_slot1(0, 0);
@@ -97,6 +98,8 @@ namespace mpgc {
               desired.end = slot_fld.replace(exp.end, myslot.block_idx);
               if (tail.atomic_bump_ptr.compare_exchange_strong(exp, desired)) {
                 global_chunk* ret = new (base_offset_ptr::base() + (myslot_ref.ptr_offset << alignment_log)) global_chunk(size);
+                //Our CAS succeeded, so if the flag is still set, it was on the original bump chunk.
+                zeroed = pristine_tail;
                 do {
                   exp.begin = slot_fld.replace(desired.begin, 0);
                   exp.end = slot_fld.replace(desired.end, 0);
@@ -135,7 +138,8 @@ namespace mpgc {
       }
 
       offset_ptr<global_chunk> skiplist::get_from_global(gc_handshake::in_memory_thread_struct &tstruct,
-                                                         const std::size_t req_size) {
+                                                         const std::size_t req_size,
+                                                         bool &zeroed) {
       gc_control_block &cb = control_block();
       const std::size_t max_size = req_size > slab_size ? req_size : slab_size;
       do {
@@ -147,7 +151,8 @@ namespace mpgc {
          */
         offset_ptr<global_chunk> c =
              cb.global_free_lists[tstruct.status_idx.load().index()].allocate(cb, tstruct.persist_data->slot,
-                                                                              req_size, max_size, tstruct.rand);
+                                                                              req_size, max_size, tstruct.rand,
+                                                                              zeroed);
         if (c) {
           return c;
         }
@@ -168,7 +173,7 @@ namespace mpgc {
     }
 
     inline
-    std::tuple<local_chunk*, std::size_t, std::size_t>
+    std::tuple<local_chunk*, std::size_t, std::size_t, bool>
     get_from_local(std::size_t size, std::size_t algn,
                    localPoolType &local_chunks)
     {
@@ -178,31 +183,31 @@ namespace mpgc {
            it++)
         {
           std::size_t chunk_size = it->first;
-          bool first_time = true;
-          for (local_chunk **ppChunk = &(it->second);
-               *ppChunk != nullptr;
-               ppChunk = &(*ppChunk)->next())
+          for (local_chunk *prev = nullptr, *chunk = it->second;
+               chunk != nullptr;
+               prev = chunk, chunk = chunk->next())
             {
-              local_chunk *chunk = (*ppChunk);
               std::size_t padding = required_padding(chunk, algn);
               if (size+padding <= chunk_size) {
                 local_chunk *next = chunk->next();
-              
-                (*ppChunk) = next;
-                if (first_time && next == nullptr) {
+
+                if (prev != nullptr) {
+                  prev->set_next(next);
+                } else if (next != nullptr) {
+                  it->second = next;
+                } else {
                   local_chunks.erase(it);
                 }
-                first_time = false;
                 std::size_t leftover_size = chunk_size - size - padding;
-                return std::make_tuple(chunk, leftover_size, padding);
+                return std::make_tuple(chunk, leftover_size, padding, chunk->zeroed());
               }
             }
         }
-      return std::make_tuple(nullptr, 0, 0);
+      return std::make_tuple(nullptr, 0, 0, false);
     }
 
     inline
-    std::tuple<local_chunk*, std::size_t, std::size_t>
+    std::tuple<local_chunk*, std::size_t, std::size_t, bool>
     get_from_global(std::size_t size, std::size_t algn,
                     gc_handshake::in_memory_thread_struct &tstruct)
     {
@@ -210,21 +215,22 @@ namespace mpgc {
       // that's guaranteed to be big enough, even if what we get
       // would've been correctly aligned.
       std::size_t max_padding = algn-1;
-      offset_ptr<global_chunk> c = skiplist::get_from_global(tstruct, size+max_padding);
+      bool zeroed;
+      offset_ptr<global_chunk> c = skiplist::get_from_global(tstruct, size+max_padding, zeroed);
       assert(c->size() >= size);
       local_chunk *chunk = reinterpret_cast<local_chunk*>(c.as_bare_pointer());
       std::size_t padding = required_padding(chunk, algn);
       std::size_t leftover_size = c->size() - size - padding;
-      return std::make_tuple(chunk, leftover_size, padding);
+      return std::make_tuple(chunk, leftover_size, padding, zeroed);
     }
 
     inline
     void put_to_local(std::size_t *p, std::size_t size,
-                      localPoolType &local_chunks)
+                      localPoolType &local_chunks, bool zeroed)
     {
       if (size >= (sizeof(local_chunk) >> alignment_log)) {
         local_chunk*& temp = local_chunks[size];
-        temp = new (p) local_chunk(size, temp);
+        temp = new (p) local_chunk(size, temp, zeroed);
       } else if (size > 0){
         *p = size;
       }
@@ -232,20 +238,22 @@ namespace mpgc {
 
     void* alloc (gc_handshake::in_memory_thread_struct &tstruct,
                  std::size_t size,
-                 std::size_t req_alignment)
+                 std::size_t req_alignment,
+                 bool zero)
     {
       local_chunk *chunk;
       std::size_t leftover_size;
       std::size_t pad_size;
+      bool zeroed;
 
       size = align_size_up(size, alignment) >> alignment_log;
       req_alignment = align_size_up(req_alignment, alignment) >> alignment_log;
       localPoolType &local_chunks = tstruct.local_free_list;
-      std::tie(chunk, leftover_size, pad_size)
+      std::tie(chunk, leftover_size, pad_size, zeroed)
         = get_from_local(size, req_alignment, local_chunks);
       if (chunk == nullptr) {
         //We don't have a big enough chunk
-        std::tie(chunk, leftover_size, pad_size)
+        std::tie(chunk, leftover_size, pad_size, zeroed)
           = get_from_global(size, req_alignment, tstruct);
       }
       std::size_t *whole_chunk = reinterpret_cast<std::size_t*>(chunk);
@@ -259,7 +267,8 @@ namespace mpgc {
       // std::cout << " Return = " << return_addr << std::endl;
       // std::cout << "  Extra = " << extra << std::endl;
 
-      put_to_local(extra, leftover_size, local_chunks);
+      //Only the two header words of a zeroed chunk are dirty, so the leftover is still zeroed.
+      put_to_local(extra, leftover_size, local_chunks, zeroed);
       /*
        * It is essential to keep the size of object in the first word until it
        * gets initialized with a gc_descriptor in the allocation_epilogue function
@@ -271,12 +280,62 @@ namespace mpgc {
       *return_addr = size;
       if (pad_size > 0) {
         // std::cout << "  adding pad chunk " << std::endl;
-        put_to_local(whole_chunk, pad_size, local_chunks);
+        put_to_local(whole_chunk, pad_size, local_chunks, zeroed);
+      }
+      if (!zero) {
+        //The caller initializes everything itself.
+      } else if (!zeroed) {
+        //Zero-out the memory
+        std::memset(return_addr + 1, 0x0, (size - 1) << alignment_log);
+      } else if (pad_size == 0 && size > 1) {
+        //The rest is already zero, apart from the chunk header's second word.
+        return_addr[1] = 0;
       }
-      //Zero-out the memory
-      std::memset(return_addr + 1, 0x0, (size - 1) << alignment_log);
       return reinterpret_cast<local_chunk*>(return_addr);
     }
 
+    bool extend(gc_handshake::in_memory_thread_struct &tstruct,
+                std::size_t *p,
+                std::size_t size)
+    {
+      localPoolType &local_chunks = tstruct.local_free_list;
+      local_chunk * const target = reinterpret_cast<local_chunk*>(p);
+      localPoolType::iterator end = local_chunks.end();
+      for (localPoolType::iterator it = local_chunks.lower_bound(size);
+           it != end;
+           it++)
+        {
+          for (local_chunk *prev = nullptr, *chunk = it->second;
+               chunk != nullptr;
+               prev = chunk, chunk = chunk->next())
+            {
+              if (chunk != target) {
+                continue;
+              }
+              const std::size_t chunk_size = it->first;
+              const bool zeroed = chunk->zeroed();
+              local_chunk *next = chunk->next();
+              if (prev != nullptr) {
+                prev->set_next(next);
+              } else if (next != nullptr) {
+                it->second = next;
+              } else {
+                local_chunks.erase(it);
+              }
+              //As in alloc(), the leftover's size must be in place before we shrink the chunk.
+              put_to_local(p + size, chunk_size - size, local_chunks, zeroed);
+              std::atomic_signal_fence(std::memory_order_release);
+              *p = size;
+              if (!zeroed) {
+                std::memset(p + 1, 0x0, (size - 1) << alignment_log);
+              } else if (size > 1) {
+                p[1] = 0;
+              }
+              return true;
+            }
+        }
+      return false;
+    }
+
   }
 }
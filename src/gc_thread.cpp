@@ -178,6 +178,126 @@ namespace mpgc {
     }
   }
 
+  /*
+   * Batch version of allocation_epilogue() for make_gc_n(). The chunk at
+   * p holds count objects of stride bytes each. The fences, the status
+   * check and the sweep-signal handling are done once for the whole batch.
+   * On return the batch is registered as pending in the thread struct, and
+   * it is up to the caller to restore the previous batch once all objects
+   * are reachable.
+   */
+  void allocation_epilogue_n(gc_handshake::in_memory_thread_struct& thread_struct, void *p,
+                             gc_token &tok, std::size_t stride, std::size_t count) {
+
+    assert(thread_struct.status_idx.load().status() != gc_handshake::Signum::sigInit);
+    gc_control_block &cb = control_block();
+    std::size_t * const begin = static_cast<std::size_t*>(p);
+    stride >>= 3;
+
+    /* The allocator left the size of the whole chunk in the first word. For
+     * fault-tolerance, every object must look like a free chunk of its own
+     * before any descriptor is installed, so we write the sizes of the later
+     * objects first and only then shrink the first one.
+     */
+    for (std::size_t i = 1; i < count; i++) {
+      begin[i * stride] = stride;
+    }
+    std::atomic_signal_fence(std::memory_order_release);
+    *begin = stride;
+
+    //Array counts are already zero, as the chunk comes zeroed from the allocator.
+    std::atomic_signal_fence(std::memory_order_release);
+
+    for (std::size_t i = 0; i < count; i++) {
+      new (begin + i * stride) gc_allocated(gc_allocated::only_allocation_epilogue{}, tok);
+    }
+
+    /* Once the descriptors are in place, the async handshake can find the
+     * objects that are not on the stack through the pending batch.
+     */
+    std::atomic_signal_fence(std::memory_order_release);
+    thread_struct.pending_batch.count = 0;
+    std::atomic_signal_fence(std::memory_order_release);
+    thread_struct.pending_batch.begin = begin;
+    thread_struct.pending_batch.stride = stride;
+    std::atomic_signal_fence(std::memory_order_release);
+    thread_struct.pending_batch.count = count;
+    std::atomic_signal_fence(std::memory_order_release);
+
+    const offset_ptr<const gc_allocated> first(reinterpret_cast<const gc_allocated*>(begin));
+    if (thread_struct.status_idx.load().status() == gc_handshake::Signum::sigAsync) {
+      for (std::size_t i = 0; i < count; i++) {
+        cb.bitmap.mark_begin_first(offset_ptr<const gc_allocated>(
+          reinterpret_cast<const gc_allocated*>(begin + i * stride)));
+      }
+    }
+    cb.mem_stats.marked(first, count);
+
+    std::atomic_signal_fence(std::memory_order_release);
+
+    //Enable sweep signal, and process if already pending.
+    thread_struct.sweep_signal_disabled = false;
+    if (thread_struct.sweep_signal_requested) {
+      thread_struct.sweep_signal_requested = false;
+      gc_handshake::do_deferred_sweep_signal(thread_struct);
+    }
+  }
+
+  /*
+   * Grow the object at p from old_words to new_words using the free
+   * chunk (if any) that immediately follows it in the thread's local
+   * free list, and reinstall its descriptor from tok. For arrays,
+   * array_element_count is the new length.
+   *
+   * This is only done when the thread has acknowledged sweep (and we
+   * hold off the next handshake) and the object is unmarked, so no
+   * mark bits need to follow the object's new extent: either there is
+   * no GC cycle on, or the object was allocated after the sweep
+   * handshake in memory that has already been swept.
+   */
+  bool extend_in_place(void *p, std::size_t old_words, std::size_t new_words,
+                       gc_token &tok, std::size_t array_element_count) {
+    gc_handshake::in_memory_thread_struct &thread_struct = allocation_prologue();
+    gc_control_block &cb = control_block();
+    std::size_t * const obj = static_cast<std::size_t*>(p);
+    const offset_ptr<const gc_allocated> ptr(static_cast<const gc_allocated*>(p));
+
+    thread_struct.mark_signal_disabled = true;
+    std::atomic_signal_fence(std::memory_order_release);
+
+    const bool extended =
+      thread_struct.status_idx.load().status() == gc_handshake::Signum::sigSweep &&
+      !cb.bitmap.is_marked(ptr) &&
+      gc_allocator::extend(thread_struct, obj + old_words, new_words - old_words);
+    if (extended) {
+      const bool sweep_allocated = ptr->get_gc_descriptor().was_allocated_during_sweep();
+      /* Either the count or the descriptor (for blob arrays) grows the
+       * object, and the new words already parse as a chunk of their own,
+       * so this is safe in either order.
+       */
+      obj[1] = array_element_count;
+      std::atomic_signal_fence(std::memory_order_release);
+      gc_allocated *g = new (p) gc_allocated(gc_allocated::only_allocation_epilogue{}, tok);
+      if (sweep_allocated) {
+        g->_descriptor.set_sweep_allocated();
+      }
+      std::atomic_signal_fence(std::memory_order_release);
+      //The chunk size left by extend() is now part of the object.
+      obj[old_words] = 0;
+      cb.mem_stats.grew(new_words - old_words);
+    }
+
+    write_barrier_epilogue(nullptr, nullptr, thread_struct);
+
+    std::atomic_signal_fence(std::memory_order_release);
+    thread_struct.sweep_signal_disabled = false;
+    if (thread_struct.sweep_signal_requested) {
+      thread_struct.sweep_signal_requested = false;
+      gc_handshake::do_deferred_sweep_signal(thread_struct);
+    }
+    return extended;
+  }
+
   void install_descriptor_epilogue(gc_descriptor &desc) {
     constexpr auto stage_bits_fld = bits::field<Weak_stage, uint16_t>(0, 2);
     //The following condition is needed to avoid failure during gc_control_block creation.
@@ -197,7 +317,8 @@ namespace mpgc {
     tstruct.weak_signal = gc_handshake::Weak_signal::Working;
   }
 
-  void mark_bitmap::mark_gc_control_block() {
+  template <typename Layout>
+  void basic_mark_bitmap<Layout>::mark_gc_control_block() {
     //For this to work gc_control_block must be the first thing on the heap.
     _mark_end_first(0, (sizeof(gc_control_block) >> 3) - 1);
   }
@@ -928,7 +1049,7 @@ namespace mpgc {
   }
 
   static void put_to_global(gc_control_block &cb,
-                            gc_allocator::skiplist& list,
+                            gc_allocator::sharded_skiplist& list,
                             chunk_expansion_slot &slot,
                             const std::size_t beg_word,
                             const std::size_t size,
@@ -960,7 +1081,8 @@ namespace mpgc {
     list.insert(cb, c, rand);
   }
 
-  bool mark_bitmap::expand_free_chunk(std::size_t *heap_begin,
+  template <typename Layout>
+  bool basic_mark_bitmap<Layout>::expand_free_chunk(std::size_t *heap_begin,
                                       offset_ptr<gc_allocator::global_chunk> c,
                                       std::size_t size,
                                       std::size_t &beg_word,
@@ -1002,98 +1124,113 @@ namespace mpgc {
     return _mark_begin_first(beg_word + (is_not_obj ? 0 : 1), end_word - 1);
   }
 
-  void mark_bitmap::sweep1_phase(gc_control_block &cb,
-                                 chunk_expansion_slot &myslot,
-                                 std::mt19937 &rand,
-				 const uint8_t curr_idx,
-                                 const bool set_bitmap,
-                                 const bool expand_once) {
+  /* Fill one shard's chunk expansion slots with its bump chunk and its chunks
+   * of at least threshold words. Every GC thread fills the same slots with the
+   * same values, until one of them starts expanding.
+   */
+  static void fill_expansion_slots(gc_control_block &cb, gc_allocator::skiplist &prev_list) {
     using namespace gc_allocator;
     constexpr std::size_t threshold = 256;
 
-
-    skiplist &prev_list = cb.global_free_lists[1 - curr_idx];
-    skiplist &curr_list = cb.global_free_lists[curr_idx];
-
     bump_chunk exp{bump_chunk::from_volatile, prev_list.tail_node().bump_ptr};
     std::size_t *bump_chunk_first_word
            = reinterpret_cast<std::size_t*>(base_offset_ptr::base() +
                                            (exp.begin << alignment_log));
     std::size_t prev_size_bump_chunk = *bump_chunk_first_word;
-    
-    uint16_t iter = cb.expansion_slots_counter;
-    //first fill up the chunk expansion slots.
-    if (iter == 0) {
-      //Work on bump pointer first
-      prev_list.help_unfinished_bump_alloc();
-
-      bump_chunk exp{bump_chunk::from_volatile, prev_list.tail_node().bump_ptr};
-      if (exp.begin != 0 && exp.end != 0) {
-        std::size_t end_word = key_fld.decode(prev_list.tail_node().level_orig_end);
-        offset_ptr<global_chunk> tail_chunk
-                   = reinterpret_cast<global_chunk*>(base_offset_ptr::base() +
-                                                    (exp.begin << alignment_log));
-        std::size_t size = end_word - exp.begin + 1;
-        reinterpret_cast<std::atomic<std::size_t>*>(bump_chunk_first_word)
-                   ->compare_exchange_strong(prev_size_bump_chunk, size);
-        while (iter < nr_slots) {
-          chunk_expansion_slot exp_slot(0, nullptr);
-          const chunk_expansion_slot des_slot(size, tail_chunk);
-          if (prev_list.expansion_slot_ref(iter++).compare_exchange_strong(exp_slot, des_slot) ||
-              (exp_slot.size == size && exp_slot.ptr == tail_chunk)) {
-            break;
-          }
+
+    uint16_t iter = 0;
+    //Work on bump pointer first
+    prev_list.help_unfinished_bump_alloc();
+
+    exp = bump_chunk{bump_chunk::from_volatile, prev_list.tail_node().bump_ptr};
+    if (exp.begin != 0 && exp.end != 0) {
+      std::size_t end_word = key_fld.decode(prev_list.tail_node().level_orig_end);
+      offset_ptr<global_chunk> tail_chunk
+                 = reinterpret_cast<global_chunk*>(base_offset_ptr::base() +
+                                                  (exp.begin << alignment_log));
+      std::size_t size = end_word - exp.begin + 1;
+      reinterpret_cast<std::atomic<std::size_t>*>(bump_chunk_first_word)
+                 ->compare_exchange_strong(prev_size_bump_chunk, size);
+      while (iter < nr_slots) {
+        chunk_expansion_slot exp_slot(0, nullptr);
+        const chunk_expansion_slot des_slot(size, tail_chunk);
+        if (prev_list.expansion_slot_ref(iter++).compare_exchange_strong(exp_slot, des_slot) ||
+            (exp_slot.size == size && exp_slot.ptr == tail_chunk)) {
+          break;
         }
       }
+    }
 
-      prev_list.iterate_skipnodes([&cb] {return cb.expansion_slots_counter == 0;},
-                                  [&iter, &cb, &prev_list, threshold](const offset_ptr<const skip_node>& n) {
-        const std::size_t size = key_fld.decode(n->level_key);
-        if (size < threshold) {
-          return false;
-        } else {
-          for (offset_ptr<const global_chunk> exp = n->val_next.val.load();
-               exp != nullptr && iter < nr_slots;
-               exp = exp->next()) {
-            if (!exp.is_valid()) {
-              return false; 
-            }
-            chunk_expansion_slot exp_slot(0, nullptr);
-            const chunk_expansion_slot des_slot(size, exp);
-            if (!prev_list.expansion_slot_ref(iter++).compare_exchange_strong(exp_slot, des_slot) &&
-                (exp_slot.size != size || exp_slot.ptr != exp)) {
-              assert(cb.expansion_slots_counter > 0);
-              return false;
-            }
+    prev_list.iterate_skipnodes([&cb] {return cb.expansion_slots_counter == 0;},
+                                [&iter, &cb, &prev_list, threshold](const offset_ptr<const skip_node>& n) {
+      const std::size_t size = key_fld.decode(n->level_key);
+      if (size < threshold) {
+        return false;
+      } else {
+        for (offset_ptr<const global_chunk> exp = n->val_next.val.load();
+             exp != nullptr && iter < nr_slots;
+             exp = exp->next()) {
+          if (!exp.is_valid()) {
+            return false; 
           }
-          return iter < nr_slots;
-        }
-      });
-
-      //Fill rest of the slots with some non-understandable value.
-      if (cb.expansion_slots_counter == 0) {
-        while (iter < nr_slots) {
-          chunk_expansion_slot exp_slot(0, nullptr); 
-          const chunk_expansion_slot des_slot(std::size_t(~0), nullptr);
+          chunk_expansion_slot exp_slot(0, nullptr);
+          const chunk_expansion_slot des_slot(size, exp);
           if (!prev_list.expansion_slot_ref(iter++).compare_exchange_strong(exp_slot, des_slot) &&
-              (exp_slot.size != std::size_t(~0) || exp_slot.ptr != nullptr)) {
-            std::abort();
+              (exp_slot.size != size || exp_slot.ptr != exp)) {
+            assert(cb.expansion_slots_counter > 0);
+            return false;
           }
         }
+        return iter < nr_slots;
+      }
+    });
+
+    //Fill rest of the slots with some non-understandable value.
+    if (cb.expansion_slots_counter == 0) {
+      while (iter < nr_slots) {
+        chunk_expansion_slot exp_slot(0, nullptr); 
+        const chunk_expansion_slot des_slot(std::size_t(~0), nullptr);
+        if (!prev_list.expansion_slot_ref(iter++).compare_exchange_strong(exp_slot, des_slot) &&
+            (exp_slot.size != std::size_t(~0) || exp_slot.ptr != nullptr)) {
+          std::abort();
+        }
       }
     }
+  }
+
+  template <typename Layout>
+  void basic_mark_bitmap<Layout>::sweep1_phase(gc_control_block &cb,
+                                 chunk_expansion_slot &myslot,
+                                 std::mt19937 &rand,
+				 const uint8_t curr_idx,
+                                 const bool set_bitmap,
+                                 const bool expand_once) {
+    using namespace gc_allocator;
+    constexpr uint16_t total_slots = sharded_skiplist::nr_expansion_slots;
+
+    sharded_skiplist &prev_list = cb.global_free_lists[1 - curr_idx];
+    sharded_skiplist &curr_list = cb.global_free_lists[curr_idx];
+
+    //first fill up the chunk expansion slots, one shard after the other.
+    for (std::size_t i = 0; i < nr_shards && cb.expansion_slots_counter == 0; i++) {
+      fill_expansion_slots(cb, prev_list.shard(i));
+    }
 
     //Process chunks from expansion slots one by one.
-    iter = cb.expansion_slots_counter;
-    while (iter < nr_slots) {
+    uint16_t iter = cb.expansion_slots_counter;
+    while (iter < total_slots) {
       myslot = prev_list.expansion_slot_ref(iter++);
+      uint16_t exp_slots_counter = iter - 1;
       if (myslot.ptr == nullptr) {
-        //There are no more expandable slots. Set counter to nr_slots and leave.
-        cb.expansion_slots_counter = nr_slots;
+        //There are no more expandable slots in this shard. Move the counter on to the next one.
+        const uint16_t next_shard = (exp_slots_counter / nr_slots + 1) * nr_slots;
+        exp_slots_counter = cb.expansion_slots_counter;
+        while (exp_slots_counter < next_shard &&
+               !cb.expansion_slots_counter.compare_exchange_weak(exp_slots_counter, next_shard));
+        iter = std::max(next_shard, exp_slots_counter);
         myslot.clear();
-        break;
+        continue;
       }
-      uint16_t exp_slots_counter = iter - 1;
       if (cb.expansion_slots_counter.compare_exchange_strong(exp_slots_counter, iter)) {
         //I'm responsible for working on this slot now.
         expand_and_put_chunk(cb, curr_list, myslot, set_bitmap, rand);
@@ -1108,8 +1245,9 @@ namespace mpgc {
     }
   }
 
-  void mark_bitmap::expand_and_put_chunk(gc_control_block &cb,
-                                         gc_allocator::skiplist& curr_list,
+  template <typename Layout>
+  void basic_mark_bitmap<Layout>::expand_and_put_chunk(gc_control_block &cb,
+                                         gc_allocator::sharded_skiplist& curr_list,
                                          chunk_expansion_slot &slot,
                                          const bool set_bitmap,
                                          std::mt19937 &rand) {
@@ -1151,7 +1289,8 @@ namespace mpgc {
     });
   }
 
-  void mark_bitmap::atomic_cleanup_weak_ptr(gc_control_block &cb, std::size_t *p) {
+  template <typename Layout>
+  void basic_mark_bitmap<Layout>::atomic_cleanup_weak_ptr(gc_control_block &cb, std::size_t *p) {
     constexpr auto ptr_fld =
        bits::field<std::size_t, std::size_t>(0, base_offset_ptr::used_bits());
     std::atomic<std::size_t> *atomic = reinterpret_cast<std::atomic<std::size_t>*>(p);
@@ -1177,12 +1316,14 @@ namespace mpgc {
     }
   }
 */
-  void mark_bitmap::verify_weak_ptr_cleanup(std::size_t *p) {
+  template <typename Layout>
+  void basic_mark_bitmap<Layout>::verify_weak_ptr_cleanup(std::size_t *p) {
     base_offset_ptr *ptr = reinterpret_cast<base_offset_ptr*>(p);
     assert(ptr->is_null() || (ptr->is_weak() && ptr->is_valid() && is_marked(ptr)));
   }
 
-  void mark_bitmap::cleanup_weak_ptrs(gc_control_block &cb,
+  template <typename Layout>
+  void basic_mark_bitmap<Layout>::cleanup_weak_ptrs(gc_control_block &cb,
                                       std::size_t begin,
                                       const std::size_t end) {
     const bit_number_t begin_bit = compute_bit_number(begin);
@@ -1215,7 +1356,8 @@ namespace mpgc {
     func(B & construct_right_mask(end_bit), begin_idx << value_log_bits);
   }
 
-  void mark_bitmap::verify_weak_ptrs_cleanup() {
+  template <typename Layout>
+  void basic_mark_bitmap<Layout>::verify_weak_ptrs_cleanup() {
     bitmap_idx_t begin_idx = 0;
     std::size_t * const base = reinterpret_cast<std::size_t*>(base_offset_ptr::base());
 
@@ -1239,8 +1381,9 @@ namespace mpgc {
     }
   }
 
-  void mark_bitmap::process_logical_chunk(gc_control_block &cb,
-                                          gc_allocator::skiplist &list,
+  template <typename Layout>
+  void basic_mark_bitmap<Layout>::process_logical_chunk(gc_control_block &cb,
+                                          gc_allocator::sharded_skiplist &list,
                                           const std::size_t nr_chunk,
                                           const bool set_bit) {
     std::size_t first = 0;
@@ -1269,7 +1412,7 @@ namespace mpgc {
       //Go through weak-bitmap to fix weak ptrs from second to first.
       cleanup_weak_ptrs(cb, second, first - 1);
       if (first == end) {
-        rep_t B = _end[((nr_chunk + 1) << chunk_size_log_bits) - 1];
+        rep_t B = lookup_end(((nr_chunk + 1) << chunk_size_log_bits) - 1);
         if (B & 0x1) {
           //If the last word of this chunk was end of an object, then we have to process the next chunk's _begin
           second = process_next_chunk_begin(nr_chunk + 1, set_bit);
@@ -1291,7 +1434,8 @@ namespace mpgc {
     }
   }
 
-  void mark_bitmap::_set_sweep_bitmap_range(const std::size_t start_chunk, const std::size_t finish_chunk, const bool set) {
+  template <typename Layout>
+  void basic_mark_bitmap<Layout>::_set_sweep_bitmap_range(const std::size_t start_chunk, const std::size_t finish_chunk, const bool set) {
     std::size_t start_word_idx = start_chunk >> value_log_bits;
     const std::size_t finish_word_idx = finish_chunk >> value_log_bits;
 
@@ -1317,7 +1461,8 @@ namespace mpgc {
     set_sweep_bitmap(_sweep_bitmap_begin[finish_word_idx], last_chunk_desired, set);
   }
 
-  void mark_bitmap::set_sweep_bitmap_range(const std::size_t beg_word, const std::size_t end_word, const bool set_bit) {
+  template <typename Layout>
+  void basic_mark_bitmap<Layout>::set_sweep_bitmap_range(const std::size_t beg_word, const std::size_t end_word, const bool set_bit) {
     const std::size_t begin_chunk = beg_word >> (chunk_size_log_bits + value_log_bits);
     const std::size_t end_chunk = end_word >> (chunk_size_log_bits + value_log_bits);
     if (end_chunk - begin_chunk < 2) {
@@ -1327,11 +1472,12 @@ namespace mpgc {
     _set_sweep_bitmap_range(begin_chunk + 1, end_chunk - 1, set_bit);
   }
 
-  void mark_bitmap::sweep2_phase(const bool set_bitmap) {
+  template <typename Layout>
+  void basic_mark_bitmap<Layout>::sweep2_phase(const bool set_bitmap) {
     assert(gc_handshake::process_struct->get_tolerate_sweep_chunk() == 0);
     std::size_t &i = gc_handshake::process_struct->get_tolerate_sweep_chunk();
     gc_control_block &cb = control_block();
-    gc_allocator::skiplist &list = cb.global_free_lists[gc_handshake::process_struct->global_list_index()];
+    gc_allocator::sharded_skiplist &list = cb.global_free_lists[gc_handshake::process_struct->global_list_index()];
 
     do {
       if (request_gc_termination) {
@@ -1347,32 +1493,31 @@ namespace mpgc {
     } while (true);
   }
 
-  void mark_bitmap::_post_sweep_clear(atomic_rep_t &word, atomic_rep_t * bitmap_chunk,
+  template <typename Layout>
+  void basic_mark_bitmap<Layout>::_post_sweep_clear(atomic_rep_t &word, atomic_rep_t * bitmap_chunk,
                                       atomic_rep_t * other_bitmap_chunk, const bool set_bit) {
-    rep_t val = word;
-    bool is_other = other_bitmap_chunk != nullptr;
-    rep_t iter = construct_bitmap_word(0);
-    const std::size_t size = sizeof(atomic_rep_t) << chunk_size_log_bits;
-    if (!set_bit) {
-      val = ~val;
+    rep_t dirty = word;
+    if (set_bit) {
+      dirty = ~dirty;
     }
-    while (iter) {
-      if (!(val & iter)) {
-        std::memset(bitmap_chunk, 0x0, size);
-        if (is_other) {
-          std::memset(other_bitmap_chunk, 0x0, size);
-        }
-        set_sweep_bitmap(word, iter, set_bit);
-      }
-      iter >>= 1;
-      bitmap_chunk += 1 << chunk_size_log_bits;
-      if (is_other) {
-        other_bitmap_chunk += 1 << chunk_size_log_bits;
+    if (dirty == 0) {
+      return;
+    }
+    //Bit 0 is the most significant bit, so the lowest set bit is the last dirty chunk.
+    for (rep_t rest = dirty; rest; rest &= rest - 1) {
+      const std::size_t chunk = (bits_per_value - 1) - std::size_t(__builtin_ctzl(rest));
+      const std::size_t offset = chunk << chunk_size_log_bits;
+      clear_nonzero_lines<Layout::stride>(bitmap_chunk + offset * Layout::stride);
+      if (other_bitmap_chunk != nullptr) {
+        clear_nonzero_lines<1>(other_bitmap_chunk + offset);
       }
     }
+    // Recovery redoes the whole word, so the chunks can be flipped together.
+    set_sweep_bitmap(word, dirty, set_bit);
   }
 
-  void mark_bitmap::post_sweep_clear(const std::size_t nr_sweep_bitmap_word, const bool set_bit) {
+  template <typename Layout>
+  void basic_mark_bitmap<Layout>::post_sweep_clear(const std::size_t nr_sweep_bitmap_word, const bool set_bit) {
     if (nr_sweep_bitmap_word >= _total_logical_chunks) {
       /* This is possible if a process terminates after finishing
        * sweep_phase2 but before fetching first bitmap word.
@@ -1381,11 +1526,24 @@ namespace mpgc {
     }
     assert(nr_sweep_bitmap_word < _sweep_bitmap_size);
     const std::size_t word_begin = nr_sweep_bitmap_word << (value_log_bits + chunk_size_log_bits);
-    _post_sweep_clear(_sweep_bitmap_begin[nr_sweep_bitmap_word], _begin + word_begin, _weak + word_begin, set_bit);
-    _post_sweep_clear(_sweep_bitmap_end[nr_sweep_bitmap_word], _end + word_begin, nullptr, set_bit);
+    _post_sweep_clear(_sweep_bitmap_begin[nr_sweep_bitmap_word], &lookup_begin(word_begin), _weak + word_begin, set_bit);
+    _post_sweep_clear(_sweep_bitmap_end[nr_sweep_bitmap_word], &lookup_end(word_begin), nullptr, set_bit);
   }
 
-  void mark_bitmap::post_sweep_phase(per_process_struct *process_struct, const bool set_bit) {
+  // Finish the rest of the claim that nr_sweep_bitmap_word belongs to.
+  template <typename Layout>
+  void basic_mark_bitmap<Layout>::post_sweep_clear_claim(const std::size_t nr_sweep_bitmap_word, const bool set_bit) {
+    if (nr_sweep_bitmap_word >= _total_logical_chunks) {
+      return;
+    }
+    const std::size_t end = std::min(sweep_bitmap_claim_end(nr_sweep_bitmap_word), _sweep_bitmap_size);
+    for (std::size_t w = nr_sweep_bitmap_word; w < end; w++) {
+      post_sweep_clear(w, set_bit);
+    }
+  }
+
+  template <typename Layout>
+  void basic_mark_bitmap<Layout>::post_sweep_phase(per_process_struct *process_struct, const bool set_bit) {
     assert(gc_handshake::process_struct->get_tolerate_sweep_chunk() >= _total_logical_chunks);
 
     std::size_t &i = gc_handshake::process_struct->get_tolerate_sweep_chunk();
@@ -1397,7 +1555,14 @@ namespace mpgc {
       if (i >= _sweep_bitmap_size) {
         break;
       }
+      /* i always names the word being cleared, so that if we die the
+       * cleanup can pick up the rest of the claim from it.
+       */
+      const std::size_t last = std::min(i + sweep_bitmap_words_per_claim, _sweep_bitmap_size) - 1;
       post_sweep_clear(i, set_bit);
+      while (i < last) {
+        post_sweep_clear(++i, set_bit);
+      }
     } while (true);
   }
 
@@ -1411,7 +1576,8 @@ namespace mpgc {
     }
   }
 
-  void mark_bitmap::_cleanup_sweep1_phase(per_process_struct *p, gc_allocator::skiplist &list, const bool set_bitmap) {
+  template <typename Layout>
+  void basic_mark_bitmap<Layout>::_cleanup_sweep1_phase(per_process_struct *p, gc_allocator::sharded_skiplist &list, const bool set_bitmap) {
     constexpr auto flag_fld = bits::field<uint8_t, std::size_t>(63, 1);
     constexpr auto size_fld = bits::field<std::size_t, std::size_t>(0, 63);
 
@@ -1456,9 +1622,13 @@ namespace mpgc {
     } while(mpersist != nullptr);
   }
 
+  // Both layouts are built so either can be benchmarked, whichever the GC uses.
+  template class basic_mark_bitmap<separate_bitmap_layout>;
+  template class basic_mark_bitmap<interleaved_bitmap_layout>;
+
   static bool cleanup_sweep1_phase(per_process_struct *p, per_process_struct::liveness &expected, const bool set_bitmap) {
     gc_control_block &cb = control_block();
-    gc_allocator::skiplist &list = cb.global_free_lists[gc_handshake::process_struct->global_list_index()];
+    gc_allocator::sharded_skiplist &list = cb.global_free_lists[gc_handshake::process_struct->global_list_index()];
     per_process_struct::liveness desired = gc_handshake::process_struct->get_liveness();
     if (p->set_liveness(expected, desired)) {
       cb.bitmap._cleanup_sweep1_phase(p, list, set_bitmap);
@@ -1478,7 +1648,7 @@ namespace mpgc {
   static bool cleanup_post_sweep_phase(per_process_struct *p, per_process_struct::liveness &expected, const bool set_bit) {
     per_process_struct::liveness desired = gc_handshake::process_struct->get_liveness();
     if (p->set_liveness(expected, desired)) {
-      control_block().bitmap.post_sweep_clear(p->get_tolerate_sweep_chunk(), set_bit);
+      control_block().bitmap.post_sweep_clear_claim(p->get_tolerate_sweep_chunk(), set_bit);
       p->reset_tolerate_sweep_chunk();
       expected.is_live = per_process_struct::Alive::Dead;
       bool assert_test = p->set_liveness(desired, expected);
@@ -1772,6 +1942,7 @@ namespace mpgc {
         gc_handshake::thread_struct_list.deletion(gc_handshake::in_memory_thread_struct::is_marked);
         cb.process_struct_list.deletion(gc_handshake::process_struct, per_process_struct::is_marked);
         gc_handshake::process_struct->clear();
+        ruts::managed_space::coalesce();
       }
       } //switch-case statement
 
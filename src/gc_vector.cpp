@@ -0,0 +1,54 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the 
+ *  Application containing code generated by the Library and added to the 
+ *  Application during this compilation process under terms of your choice, 
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#include <cmath>
+#include <cstddef>
+
+namespace mpgc {
+
+  /*
+   * The exponent is ceil(log(needed/current)/log(growth_factor)).  The
+   * common case is a single step, so we check that first and only go
+   * to the logs when we're growing by more than that.  Since floating
+   * point might leave us a hair short, the result is never less than
+   * needed.
+   */
+  std::size_t grown_vector_capacity(std::size_t current, std::size_t needed,
+                                    double growth_factor, std::size_t min_grow_to) {
+    if (current < min_grow_to) {
+      current = min_grow_to;
+    }
+    if (current >= needed) {
+      return current;
+    }
+    std::size_t c = current * growth_factor;
+    if (c < needed) {
+      const double steps = std::ceil(std::log(double(needed) / current) / std::log(growth_factor));
+      c = current * std::pow(growth_factor, steps);
+    }
+    return c < needed ? needed : c;
+  }
+}
@@ -0,0 +1,161 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the 
+ *  Application containing code generated by the Library and added to the 
+ *  Application during this compilation process under terms of your choice, 
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#include <cassert>
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "mpgc/gc.h"
+#include "mpgc/gc_concurrent_vector.h"
+
+using namespace mpgc;
+using namespace std;
+
+using int_vector = gc_concurrent_vector<size_t>;
+
+/*
+ * Every value appended by any thread ends up at the index its
+ * push_back() returned, and readers only ever see written values.
+ */
+void test_concurrent_append() {
+  const size_t n_threads = 4;
+  const size_t per_thread = 20000;
+  gc_ptr<int_vector> v = make_gc<int_vector>(4);
+  vector<vector<size_t>> indexes(n_threads, vector<size_t>(per_thread));
+  atomic<bool> done{false};
+  thread reader([&] {
+      initialize_thread();
+      while (!done) {
+        size_t expected = 0;
+        v->for_each([&](size_t i, size_t val) {
+            assert(i == expected++);
+            assert(val != 0);
+          });
+      }
+    });
+  vector<thread> writers;
+  for (size_t t = 0; t < n_threads; t++) {
+    writers.emplace_back([&, t] {
+        initialize_thread();
+        for (size_t i = 0; i < per_thread; i++) {
+          indexes[t][i] = v->push_back(t*per_thread + i + 1);
+        }
+      });
+  }
+  for (thread &w : writers) {
+    w.join();
+  }
+  done = true;
+  reader.join();
+
+  const size_t total = n_threads*per_thread;
+  assert(v->size() == total);
+  assert(v->reserved() == total);
+  vector<bool> seen(total);
+  for (size_t t = 0; t < n_threads; t++) {
+    for (size_t i = 0; i < per_thread; i++) {
+      size_t idx = indexes[t][i];
+      assert(idx < total && !seen[idx]);
+      seen[idx] = true;
+      assert((*v)[idx] == t*per_thread + i + 1);
+    }
+  }
+  cout << n_threads << " threads appended " << total << " values" << endl;
+}
+
+/*
+ * A value whose assignment waits for the gate to open, to stand in
+ * for an appender that has reserved an index and then stalled (or
+ * died) before marking it ready.
+ */
+constexpr size_t stalled = 999;
+atomic<bool> gate_open{false};
+
+struct gated {
+  size_t v = 0;
+  gated() = default;
+  gated(size_t x) : v(x) {}
+  gated &operator=(const gated &other) {
+    while (other.v == stalled && !gate_open) {
+      this_thread::yield();
+    }
+    v = other.v;
+    return *this;
+  }
+  static const auto &descriptor() {
+    static gc_descriptor d =
+      GC_DESC(gated)
+      .template WITH_FIELD(&gated::v);
+    return d;
+  }
+};
+
+void test_recover() {
+  using gated_vector = gc_concurrent_vector<gated>;
+  gc_ptr<gated_vector> v = make_gc<gated_vector>();
+  for (size_t i = 0; i < 10; i++) {
+    v->push_back(gated{i});
+  }
+  assert(v->recover() == 0);
+
+  size_t stalled_index = 0;
+  thread appender([&] {
+      initialize_thread();
+      stalled_index = v->push_back(gated{stalled});
+    });
+  while (v->reserved() < 11) {
+    this_thread::yield();
+  }
+  v->push_back(gated{11});
+  assert(v->size() == 10);
+
+  assert(v->recover() == 1);
+  assert(v->size() == 12);
+  gated g;
+  assert(!v->try_get(10, g));
+  assert(v->try_get(11, g) && g.v == 11);
+  size_t n_seen = 0;
+  v->for_each([&](size_t i, const gated &val) {
+      assert(i != 10);
+      assert(val.v == i);
+      n_seen++;
+    });
+  assert(n_seen == 11);
+
+  gate_open = true;
+  appender.join();
+  assert(stalled_index == 12);
+  assert((*v)[stalled_index].v == stalled);
+  assert(v->size() == 13);
+  assert(v->reserved() == 13);
+  cout << "Recovered past a stalled append, which moved to " << stalled_index << endl;
+}
+
+int main() {
+  test_concurrent_append();
+  test_recover();
+}
@@ -24,17 +24,129 @@
  *
  */
 
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
 #include "mpgc/gc_interned_string.h"
 #include "mpgc/gc_cuckoo_map.h"
 
 using namespace mpgc;
 using namespace std;
 
-int main() {
-  using string_table_type = gc_interned_string_table<0>;
-  using string_type = typename string_table_type::value_type;
-  using map_type = small_gc_cuckoo_map<string_type, size_t>;
+using string_table_type = gc_interned_string_table<0>;
+using string_type = typename string_table_type::value_type;
+using map_type = small_gc_cuckoo_map<string_type, size_t>;
+
+/*
+ * The interned strings are held by the table, so they can sit in
+ * std::vectors here.
+ */
+vector<string_type> intern_keys(gc_ptr<string_table_type> table, size_t n) {
+  vector<string_type> keys;
+  for (size_t i = 0; i < n; i++) {
+    string name = "key " + to_string(i);
+    keys.push_back(table->intern(name.data(), name.size()));
+  }
+  return keys;
+}
+
+/*
+ * Batches that mix strings that are already interned with new ones,
+ * and keys that are in the map with ones that aren't.
+ */
+void test_batches(gc_ptr<string_table_type> table) {
+  const size_t n = 40;
+  vector<string> names;
+  for (size_t i = 0; i < n; i++) {
+    names.push_back("batch " + to_string(i));
+  }
+  vector<string_type> singles(n);
+  for (size_t i = 0; i < n; i += 2) {
+    singles[i] = table->intern(names[i].data(), names[i].size());
+  }
+  vector<string_type> interned(n);
+  table->intern_many(names.begin(), names.end(), interned.begin());
+  for (size_t i = 0; i < n; i++) {
+    assert(interned[i] != nullptr);
+    assert(singles[i] == nullptr || interned[i] == singles[i]);
+    assert(interned[i] == table->intern(names[i].data(), names[i].size()));
+  }
+
+  gc_ptr<map_type> map = make_gc<map_type>();
+  for (size_t i = 0; i < n; i += 3) {
+    map->put(interned[i], i + 1);
+  }
+  vector<size_t> vals(n);
+  map->get_many(interned.begin(), interned.end(), vals.begin());
+  for (size_t i = 0; i < n; i++) {
+    assert(vals[i] == (i % 3 == 0 ? i + 1 : 0));
+  }
+  cout << "Batches of " << n << " agree with single lookups" << endl;
+}
 
+/*
+ * The array overloads of intern() remember recent keys by address,
+ * so reusing a buffer for different text has to give different
+ * strings.
+ */
+void test_reused_buffer(gc_ptr<string_table_type> table) {
+  char buf[] = "buffer A";
+  string_type a = table->intern(buf);
+  buf[7] = 'B';
+  string_type b = table->intern(buf);
+  assert(a != b);
+  assert(b == table->intern("buffer B"));
+  buf[7] = 'A';
+  assert(table->intern(buf) == a);
+  cout << "Reused buffer interned as " << a << " and " << b << endl;
+}
+
+/*
+ * Scans while another thread grows the map only ever see entries that
+ * were put, and once the growing stops, a scan and size() see all of
+ * them.
+ */
+void test_scan_while_growing(gc_ptr<string_table_type> table) {
+  const size_t initial = 1000;
+  const size_t total = 20000;
+  const vector<string_type> keys = intern_keys(table, total);
+  gc_ptr<map_type> map = make_gc<map_type>();
+  for (size_t i = 0; i < initial; i++) {
+    map->put(keys[i], i);
+  }
+
+  atomic<bool> done{false};
+  thread grower([&] {
+      initialize_thread();
+      for (size_t i = initial; i < total; i++) {
+        map->put(keys[i], i);
+      }
+      done = true;
+    });
+  size_t scans = 0;
+  do {
+    map->for_each([&](const string_type &k, size_t v) {
+        assert(v < total && k == keys[v]);
+      });
+    scans++;
+  } while (!done);
+  grower.join();
+
+  vector<bool> seen(total);
+  size_t n_seen = 0;
+  map->for_each([&](const string_type &k, size_t v) {
+      assert(v < total && k == keys[v] && !seen[v]);
+      seen[v] = true;
+      n_seen++;
+    });
+  cout << scans << " scans while growing to " << total
+       << ", size() = " << map->size() << endl;
+  assert(n_seen == total);
+  assert(map->size() == total);
+}
+
+int main() {
   gc_ptr<string_table_type> table = make_gc<string_table_type>(100);
   gc_ptr<map_type> map = make_gc<map_type>();
 
@@ -51,6 +163,8 @@ int main() {
   cout << "map[" << s1 << "] was " << was << endl;
   map->at(s1) *= 2;
   cout << "map[" << s1 << "] = " << map->at(s1) << endl;
-  
 
+  test_batches(table);
+  test_reused_buffer(table);
+  test_scan_while_growing(table);
 }
@@ -0,0 +1,107 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the 
+ *  Application containing code generated by the Library and added to the 
+ *  Application during this compilation process under terms of your choice, 
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+
+/*
+ * Checks that the descriptors desc_spec computes at compile time
+ * (static_rep()) agree with the ones the runtime collector builds for
+ * the same layout.
+ */
+
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <set>
+#include <type_traits>
+#include <utility>
+#include "mpgc/gc.h"
+
+using namespace mpgc;
+using namespace std;
+
+template <size_t N>
+struct words {
+  size_t w[N];
+};
+
+// A desc_spec for words<N> in which word i is a reference iff bit i of Map is set.
+template <size_t N, uint64_t Map, size_t...I>
+auto spec_for(index_sequence<I...>) {
+  return desc_spec<words<N>,
+                   field_spec<conditional_t<((Map >> I) & 1) != 0, gc_ptr<gc_allocated>, size_t>, I>...>();
+}
+
+set<size_t> refs(const gc_descriptor &d) {
+  set<size_t> s;
+  d.for_each_ref_index([&](size_t i) { s.insert(i); });
+  return s;
+}
+
+template <size_t N, uint64_t Map>
+void check() {
+  using spec = decltype(spec_for<N, Map>(make_index_sequence<N>()));
+  const gc_descriptor runtime = spec::runtime_descriptor();
+  set<size_t> expected;
+  for (size_t i = 0; i < N; i++) {
+    if ((Map >> i) & 1) {
+      expected.insert(i);
+    }
+  }
+
+  cout << N << " words, " << expected.size() << " refs: ";
+  assert(refs(runtime) == expected);
+  if (spec::static_rep() == 0) {
+    // Only layouts that need an external descriptor are left to the
+    // runtime, and each of those gets its own external_descriptor.
+    cout << "runtime only" << endl;
+    return;
+  }
+  const gc_descriptor stat = spec();
+  cout << "static" << endl;
+  assert(stat == runtime);
+}
+
+int main() {
+  check<4, 0x0>();
+  check<4, 0xf>();
+  check<6, 0x4>();
+  check<63, uint64_t(1) << 62>();
+  check<40, 0x8000000401>();
+  // Include lists of up to seven references.
+  check<20, 0x5a0a1>();
+  // Eight references is one too many for an include list.
+  check<20, 0xf00f0>();
+  check<9, 0x1fe>();
+  check<40, 0x842108421>();
+  // Exclude lists.
+  check<12, 0xefb>();
+  check<33, 0x1fffffffe>();
+  // Bitmaps.
+  check<30, 0x15555555>();
+  check<32, 0xaaaaaaaa>();
+  // Too many references for a list and too big for a bitmap.
+  check<50, 0x333333333333>();
+}
@@ -0,0 +1,171 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the 
+ *  Application containing code generated by the Library and added to the 
+ *  Application during this compilation process under terms of your choice, 
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "mpgc/gc_flat_cuckoo_map.h"
+
+using namespace mpgc;
+using namespace std;
+
+struct thing : gc_allocated {
+  uint64_t id;
+  thing(gc_token &gc, uint64_t i) : gc_allocated{gc}, id(i) {}
+  static const auto &descriptor() {
+    using this_type = thing;
+    static gc_descriptor d =
+      GC_DESC(this_type)
+      .template WITH_FIELD(&this_type::id)
+      ;
+    return d;
+  }
+};
+
+template <uint64_t Mult>
+struct mix_hash {
+  uint64_t operator()(uint64_t k) const {
+    k *= Mult;
+    return k ^ (k >> 29);
+  }
+};
+using hash_a = mix_hash<0x9e3779b97f4a7c15ull>;
+using hash_b = mix_hash<0xc2b2ae3d27d4eb4full>;
+
+using int_map = small_gc_flat_cuckoo_map<uint64_t, uint32_t, hash_a, hash_b>;
+using ref_map = gc_flat_cuckoo_map<uint64_t, gc_ptr<thing>, hash_a, hash_b>;
+
+void test_basics() {
+  gc_ptr<int_map> m = make_gc<int_map>();
+  assert(!m->contains(5));
+  m->put(5, 7);
+  assert(m->get(5) == 7 && (*m)[5] == 7);
+  assert(m->lookup(6) == make_pair(false, uint32_t(0)));
+
+  auto rr = m->put_new(5, 8);
+  assert(rr.had_value && rr.old_value == 7 && m->get(5) == 7);
+  m->put_new(6, 8);
+  assert(m->lookup(6) == make_pair(true, uint32_t(8)));
+
+  m->replace(5, 1, 9);
+  assert(m->get(5) == 7);
+  m->replace(5, 7, 9);
+  assert(m->get(5) == 9);
+  m->put(5, [](bool, uint32_t v) { return v + 1; });
+  assert(m->get(5) == 10);
+
+  assert(m->remove(6) && !m->contains(6) && !m->remove(6));
+  assert(m->get(5) == 10);
+  cout << "Basic operations work" << endl;
+}
+
+/*
+ * The small map starts with one tiny segment per table, so this many
+ * keys makes it grow several times.
+ */
+void test_growth() {
+  const uint64_t n = 50000;
+  gc_ptr<int_map> m = make_gc<int_map>();
+  for (uint64_t k = 0; k < n; k++) {
+    m->put(k, uint32_t(k * 3));
+  }
+  for (uint64_t k = 0; k < n; k++) {
+    assert(m->get(k) == uint32_t(k * 3));
+  }
+  for (uint64_t k = 0; k < n; k += 2) {
+    assert(m->remove(k));
+  }
+  for (uint64_t k = 0; k < n; k++) {
+    assert(m->contains(k) == (k % 2 == 1));
+  }
+  cout << "Grew to " << n << " keys" << endl;
+}
+
+/*
+ * The values are gc_ptrs packed into the slot words, so the only
+ * references to the things are in the map while collections run.
+ */
+void test_refs() {
+  const uint64_t n = 10000;
+  gc_ptr<ref_map> m = make_gc<ref_map>(1000);
+  for (uint64_t k = 0; k < n; k++) {
+    m->put(k, make_gc<thing>(k));
+  }
+  const size_t cycle = memory_stats().cycle_number();
+  while (memory_stats().cycle_number() < cycle + 2) {
+    make_gc_array<size_t>(1000);
+  }
+  for (uint64_t k = 0; k < n; k++) {
+    gc_ptr<thing> t = m->get(k);
+    assert(t != nullptr && t->id == k);
+  }
+  cout << n << " things survived " << memory_stats().cycle_number() - cycle << " collections" << endl;
+}
+
+/*
+ * Two threads insert disjoint keys while a third looks them up.  A
+ * key that's found must have its own value.
+ */
+void test_concurrent() {
+  const uint64_t per_thread = 20000;
+  gc_ptr<int_map> m = make_gc<int_map>();
+  vector<thread> writers;
+  for (uint64_t t = 0; t < 2; t++) {
+    writers.emplace_back([=] {
+        initialize_thread();
+        for (uint64_t k = t; k < 2 * per_thread; k += 2) {
+          m->put(k, uint32_t(k + 1));
+        }
+      });
+  }
+  thread reader([=] {
+      initialize_thread();
+      for (size_t pass = 0; pass < 10; pass++) {
+        for (uint64_t k = 0; k < 2 * per_thread; k++) {
+          auto found = m->lookup(k);
+          assert(!found.first || found.second == uint32_t(k + 1));
+        }
+      }
+    });
+  for (thread &t : writers) {
+    t.join();
+  }
+  reader.join();
+  for (uint64_t k = 0; k < 2 * per_thread; k++) {
+    assert(m->get(k) == uint32_t(k + 1));
+  }
+  cout << "Two writers put " << 2 * per_thread << " keys" << endl;
+}
+
+int main() {
+  test_basics();
+  test_growth();
+  test_refs();
+  test_concurrent();
+}
@@ -0,0 +1,139 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the 
+ *  Application containing code generated by the Library and added to the 
+ *  Application during this compilation process under terms of your choice, 
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+
+#include <cassert>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include "mpgc/gc.h"
+
+using namespace mpgc;
+using namespace std;
+
+struct node : gc_allocated {
+  size_t id;
+  gc_ptr<node> next;
+  node(gc_token &gc, size_t i) : gc_allocated{gc}, id(i) {}
+  static const auto &descriptor() {
+    using this_type = node;
+    static gc_descriptor d =
+      GC_DESC(this_type)
+      .template WITH_FIELD(&this_type::id)
+      .template WITH_FIELD(&this_type::next)
+      ;
+    return d;
+  }
+};
+
+// Each holder makes its own batch while the enclosing batch is pending.
+struct holder : gc_allocated {
+  gc_array_ptr<gc_ptr<node>> kids;
+  holder(gc_token &gc, size_t n)
+    : gc_allocated{gc},
+      kids(make_gc_n<node>(n, [](size_t i) { return make_tuple(i); }))
+  {}
+  static const auto &descriptor() {
+    using this_type = holder;
+    static gc_descriptor d =
+      GC_DESC(this_type)
+      .template WITH_FIELD(&this_type::kids)
+      ;
+    return d;
+  }
+};
+
+struct thrower : gc_allocated {
+  size_t id;
+  thrower(gc_token &gc, size_t i) : gc_allocated{gc}, id(i) {
+    if (i == 3) {
+      throw runtime_error("thrower 3");
+    }
+  }
+  static const auto &descriptor() {
+    using this_type = thrower;
+    static gc_descriptor d =
+      GC_DESC(this_type)
+      .template WITH_FIELD(&this_type::id)
+      ;
+    return d;
+  }
+};
+
+void check_no_pending_batch() {
+  const gc_handshake::allocation_batch &batch = gc_handshake::thread_struct_handles.handle->pending_batch;
+  assert(batch.count == 0);
+  assert(batch.outer == nullptr);
+}
+
+int main() {
+  const size_t n = 100;
+  gc_array_ptr<gc_ptr<node>> nodes = make_gc_n<node>(n, [](size_t i) { return make_tuple(i); });
+  assert(nodes->size() == n);
+  for (size_t i = 0; i < n; i++) {
+    assert(nodes[i]->id == i);
+    if (i > 0) {
+      // One chunk, in order.
+      assert(nodes[i].as_bare_pointer() == nodes[i-1].as_bare_pointer() + 1);
+    }
+  }
+  check_no_pending_batch();
+  cout << n << " nodes in one batch" << endl;
+
+  gc_array_ptr<gc_ptr<holder>> holders = make_gc_n<holder>(10, [](size_t i) { return make_tuple(i + 1); });
+  for (size_t i = 0; i < 10; i++) {
+    assert(holders[i]->kids->size() == i + 1);
+    for (size_t j = 0; j <= i; j++) {
+      assert(holders[i]->kids[j]->id == j);
+    }
+  }
+  check_no_pending_batch();
+  cout << "10 holders with nested batches" << endl;
+
+  size_t sunk = 0;
+  try {
+    make_gc_n<thrower>(10, [](size_t i) { return make_tuple(i); },
+                       [&sunk](size_t i, const gc_ptr<thrower> &p) {
+                         assert(p->id == i);
+                         sunk++;
+                       });
+    assert(false);
+  } catch (const runtime_error &e) {
+    cout << "caught '" << e.what() << "' after " << sunk << " objects" << endl;
+  }
+  assert(sunk == 3);
+  check_no_pending_batch();
+
+  // A count whose size overflows is rejected before anything is allocated.
+  try {
+    make_gc_n<node>(max_batch_count<node>() + 1, [](size_t i) { return make_tuple(i); });
+    assert(false);
+  } catch (const bad_array_new_length &) {
+    cout << "rejected an overflowing count" << endl;
+  }
+  check_no_pending_batch();
+}
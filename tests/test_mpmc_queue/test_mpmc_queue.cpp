@@ -0,0 +1,136 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the 
+ *  Application containing code generated by the Library and added to the 
+ *  Application during this compilation process under terms of your choice, 
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#include <cassert>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "mpgc/gc.h"
+#include "mpgc/gc_mpmc_queue.h"
+
+using namespace mpgc;
+using namespace std;
+
+struct item : gc_allocated {
+  const size_t producer;
+  const size_t seq;
+  item(gc_token &gc, size_t p, size_t s) : gc_allocated{gc}, producer(p), seq(s) {}
+  static const auto &descriptor() {
+    static gc_descriptor d =
+      GC_DESC(item)
+      .template WITH_FIELD(&item::producer)
+      .template WITH_FIELD(&item::seq);
+    return d;
+  }
+};
+
+using queue_type = gc_mpmc_queue<item>;
+
+void test_single_thread() {
+  assert(make_gc<queue_type>(0)->capacity() == 2);
+  assert(make_gc<queue_type>(1)->capacity() == 2);
+  assert(make_gc<queue_type>(5)->capacity() == 8);
+
+  gc_ptr<queue_type> q = make_gc<queue_type>(4);
+  gc_ptr<item> out;
+  assert(!q->try_pop(out));
+  // Go around the ring a few times.
+  for (size_t lap = 0; lap < 3; lap++) {
+    for (size_t i = 0; i < 4; i++) {
+      assert(q->try_push(make_gc<item>(lap, i)));
+    }
+    assert(!q->try_push(make_gc<item>(lap, 4)));
+    assert(q->size() == 4);
+    for (size_t i = 0; i < 4; i++) {
+      assert(q->try_pop(out));
+      assert(out->producer == lap && out->seq == i);
+    }
+    assert(!q->try_pop(out));
+    assert(q->empty());
+  }
+  auto start = chrono::steady_clock::now();
+  assert(!q->try_pop_for(out, chrono::milliseconds(20)));
+  assert(chrono::steady_clock::now() - start >= chrono::milliseconds(20));
+  cout << "FIFO order holds around the ring" << endl;
+}
+
+/*
+ * Producers and consumers share a queue that's usually full or
+ * empty.  Every item comes out exactly once, never as null, and each
+ * consumer sees each producer's items in the order they were pushed.
+ */
+void test_concurrent(size_t capacity) {
+  const size_t n_producers = 2;
+  const size_t n_consumers = 2;
+  const size_t per_producer = 5000;
+  const size_t total = n_producers*per_producer;
+  gc_ptr<queue_type> q = make_gc<queue_type>(capacity);
+  vector<atomic<unsigned>> seen(total);
+  atomic<size_t> n_popped{0};
+  vector<thread> threads;
+  for (size_t p = 0; p < n_producers; p++) {
+    threads.emplace_back([&, p] {
+        initialize_thread();
+        for (size_t i = 0; i < per_producer; i++) {
+          q->push(make_gc<item>(p, i));
+        }
+      });
+  }
+  for (size_t c = 0; c < n_consumers; c++) {
+    threads.emplace_back([&] {
+        initialize_thread();
+        vector<size_t> next(n_producers, 0);
+        while (n_popped < total) {
+          gc_ptr<item> it;
+          if (!q->try_pop_for(it, chrono::milliseconds(10))) {
+            continue;
+          }
+          assert(it != nullptr);
+          assert(it->seq >= next[it->producer]);
+          next[it->producer] = it->seq+1;
+          seen[it->producer*per_producer + it->seq]++;
+          n_popped++;
+        }
+      });
+  }
+  for (thread &th : threads) {
+    th.join();
+  }
+  for (size_t i = 0; i < total; i++) {
+    assert(seen[i] == 1);
+  }
+  assert(q->empty());
+  cout << n_producers << " producers and " << n_consumers << " consumers moved "
+       << total << " items through capacity " << q->capacity() << endl;
+}
+
+int main() {
+  test_single_thread();
+  test_concurrent(1);
+  test_concurrent(64);
+}
@@ -0,0 +1,182 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the 
+ *  Application containing code generated by the Library and added to the 
+ *  Application during this compilation process under terms of your choice, 
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "mpgc/gc_rope.h"
+
+using namespace mpgc;
+using namespace std;
+
+string piece(size_t i) {
+  return "<piece " + to_string(i) + string(60, 'a'+i%26) + ">";
+}
+
+template <typename R>
+void check(const R &r, const string &expected) {
+  assert(r.size() == static_cast<long>(expected.size()));
+  assert(string(r.data(), r.size()) == expected);
+  const char *cs = r.c_str();
+  assert(strlen(cs) == expected.size());
+  assert(expected == cs);
+  size_t i = 0;
+  r.for_each_chunk([&](const char *p, size_t n) {
+      assert(expected.compare(i, n, p, n) == 0);
+      i += n;
+    });
+  assert(i == expected.size());
+}
+
+void test_basics() {
+  gc_rope r;
+  string expected;
+  check(r, expected);
+  for (size_t i = 0; i < 20; i++) {
+    r += piece(i).c_str();
+    expected += piece(i);
+    assert(r[expected.size()-1] == '>');
+  }
+  check(r, expected);
+  assert(r == gc_rope{expected});
+  assert(r.find("<piece 7") == static_cast<long>(expected.find("<piece 7")));
+  assert(r.find('z') == static_cast<long>(expected.find('z')));
+
+  external_gc_rope e = r;
+  check(e, expected);
+  e += "!";
+  check(r, expected);
+  check(e, expected + "!");
+  cout << "Built a rope of " << r.size() << " chars from 20 pieces" << endl;
+}
+
+/*
+ * A slice in the middle of its array isn't null-terminated, so
+ * c_str() copies it, but only once, and ropes that share the slice
+ * share the copy.
+ */
+void test_slices() {
+  string text;
+  for (size_t i = 0; i < 4; i++) {
+    text += piece(i);
+  }
+  gc_rope whole{text};
+  gc_rope mid = whole.substr(10, 100);
+  check(mid, text.substr(10, 100));
+  const char *p = mid.c_str();
+  assert(mid.c_str() == p);
+  gc_rope same = mid;
+  assert(same.c_str() == p);
+  // The data() of a slice is still in the original array.
+  assert(mid.data() == whole.data()+10);
+
+  gc_rope tail = whole.substr(10);
+  assert(tail.c_str() == tail.data());
+  check(tail, text.substr(10));
+  cout << "Slices share their null-terminated copies" << endl;
+}
+
+/*
+ * Comparing against a C string walks the rope's chunks, so check it
+ * on ropes that haven't been flattened yet.
+ */
+void test_compare() {
+  string text;
+  gc_rope r;
+  for (size_t i = 0; i < 10; i++) {
+    text += piece(i);
+    r += piece(i).c_str();
+  }
+  gc_rope same;
+  for (size_t i = 0; i < 10; i++) {
+    same += piece(i).c_str();
+  }
+  assert(same == text.c_str());
+  assert(!(same != text.c_str()));
+  assert(r.compare(text.c_str()) == 0);
+  string shorter = text.substr(0, text.size()-1);
+  assert(r.compare(shorter.c_str()) > 0);
+  assert(r.compare((text + "x").c_str()) < 0);
+  string changed = text;
+  changed[200] = 'A';
+  assert(r.compare(changed.c_str()) > 0);
+  assert(r != changed.c_str());
+  assert(gc_rope{}.compare("") == 0);
+  assert(gc_rope{}.compare("x") < 0);
+  check(r, text);
+  cout << "Compared an unflattened rope against C strings" << endl;
+}
+
+/*
+ * Threads that flatten and terminate the same ropes at once all see
+ * the same characters, and each builds its own rope alongside.
+ */
+void test_concurrent() {
+  const size_t n_threads = 4;
+  string text;
+  gc_rope shared;
+  for (size_t i = 0; i < 40; i++) {
+    text += piece(i);
+    shared += piece(i).c_str();
+  }
+  gc_rope slice = shared.substr(5, text.size()-10);
+  vector<const char *> flat(n_threads), terminated(n_threads);
+  vector<thread> threads;
+  for (size_t t = 0; t < n_threads; t++) {
+    threads.emplace_back([&, t] {
+        initialize_thread();
+        flat[t] = shared.c_str();
+        terminated[t] = slice.c_str();
+        gc_rope mine;
+        string expected;
+        for (size_t i = 0; i < 200; i++) {
+          mine += piece(t*1000+i).c_str();
+          expected += piece(t*1000+i);
+        }
+        check(mine, expected);
+      });
+  }
+  for (thread &th : threads) {
+    th.join();
+  }
+  for (size_t t = 0; t < n_threads; t++) {
+    assert(flat[t] == flat[0]);
+    assert(terminated[t] == terminated[0]);
+  }
+  check(shared, text);
+  check(slice, text.substr(5, text.size()-10));
+  cout << n_threads << " threads agree on the flattened rope" << endl;
+}
+
+int main() {
+  test_basics();
+  test_slices();
+  test_compare();
+  test_concurrent();
+}
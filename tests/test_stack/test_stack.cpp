@@ -0,0 +1,225 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the 
+ *  Application containing code generated by the Library and added to the 
+ *  Application during this compilation process under terms of your choice, 
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#include <cassert>
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "mpgc/gc.h"
+#include "mpgc/gc_stack.h"
+
+using namespace mpgc;
+using namespace std;
+
+using stack_type = gc_atomic_stack<size_t>;
+using node_type = gc_threaded_node<size_t>;
+
+namespace mpgc {
+  template <>
+  struct gc_stack_test_access<stack_type> {
+    static bool eliminate_push(stack_type &s, const gc_ptr<node_type> &n) {
+      return s.eliminate_push(n);
+    }
+    static gc_ptr<node_type> eliminate_pop(stack_type &s) {
+      return s.eliminate_pop();
+    }
+  };
+}
+using exchangers = gc_stack_test_access<stack_type>;
+
+struct holder : gc_allocated {
+  stack_type stack;
+  holder(gc_token &gc) : gc_allocated{gc} {}
+  static const auto &descriptor() {
+    static gc_descriptor d =
+      GC_DESC(holder)
+      .template WITH_FIELD(&holder::stack);
+    return d;
+  }
+};
+
+vector<size_t> contents(const gc_threaded_list<size_t> &list) {
+  vector<size_t> vals;
+  list.for_each([&](size_t v) { vals.push_back(v); });
+  return vals;
+}
+
+vector<size_t> pop_everything(stack_type &s) {
+  vector<size_t> vals;
+  for (auto p = s.pop(); p.first; p = s.pop()) {
+    vals.push_back(p.second);
+  }
+  return vals;
+}
+
+void test_batches() {
+  gc_ptr<holder> h = make_gc<holder>();
+  stack_type &s = h->stack;
+  s.push(1);
+  s.push(2);
+  vector<size_t> more{3, 4, 5};
+  s.push_all(more.begin(), more.end());
+  assert(s.pop().second == 5);
+  assert((contents(s.pop_all()) == vector<size_t>{4, 3, 2, 1}));
+  assert(s.empty());
+  assert(s.pop_all().empty());
+
+  gc_threaded_list<size_t> list = gc_threaded_list<size_t>{}.push(8).push(7).push(6);
+  s.push(9);
+  s.push_all(list);
+  assert((pop_everything(s) == vector<size_t>{6, 7, 8, 9}));
+  // The list's own nodes were copied, not relinked.
+  assert((contents(list) == vector<size_t>{6, 7, 8}));
+
+  gc_ptr<node_type> last = make_gc<node_type>(12);
+  gc_ptr<node_type> first = make_gc<node_type>(10, make_gc<node_type>(11, last));
+  s.push(13);
+  s.push_all(first, last);
+  assert((pop_everything(s) == vector<size_t>{10, 11, 12, 13}));
+  cout << "Batched pushes and pop_all() keep their order" << endl;
+}
+
+/*
+ * Pushers and poppers hammer the same stack, single and batched, so
+ * some pushes and pops meet in the exchangers.  Every value pushed
+ * has to come out exactly once.
+ */
+void test_concurrent() {
+  const size_t n_pushers = 3;
+  const size_t n_poppers = 3;
+  const size_t per_pusher = 30000;
+  const size_t total = n_pushers*per_pusher;
+  gc_ptr<holder> h = make_gc<holder>();
+  vector<atomic<unsigned>> seen(total);
+  atomic<size_t> n_popped{0};
+  vector<thread> threads;
+  for (size_t t = 0; t < n_pushers; t++) {
+    threads.emplace_back([&, t] {
+        initialize_thread();
+        size_t base = t*per_pusher;
+        for (size_t i = 0; i < per_pusher; ) {
+          if (i % 16 == 0 && i+4 <= per_pusher) {
+            size_t batch[4] = {base+i, base+i+1, base+i+2, base+i+3};
+            h->stack.push_all(batch, batch+4);
+            i += 4;
+          } else {
+            h->stack.push(base+i);
+            i++;
+          }
+        }
+      });
+  }
+  for (size_t t = 0; t < n_poppers; t++) {
+    threads.emplace_back([&, t] {
+        initialize_thread();
+        for (size_t round = 0; n_popped < total; round++) {
+          if (round % 64 == t) {
+            size_t n = 0;
+            h->stack.pop_all().for_each([&](size_t v) {
+                seen[v]++;
+                n++;
+              });
+            n_popped += n;
+          } else {
+            auto p = h->stack.pop();
+            if (p.first) {
+              seen[p.second]++;
+              n_popped++;
+            } else {
+              this_thread::yield();
+            }
+          }
+        }
+      });
+  }
+  for (thread &th : threads) {
+    th.join();
+  }
+  assert(n_popped == total);
+  for (size_t v = 0; v < total; v++) {
+    assert(seen[v] == 1);
+  }
+  assert(h->stack.empty());
+  cout << n_pushers << " pushers and " << n_poppers << " poppers moved "
+       << total << " values" << endl;
+}
+
+/*
+ * A stack CAS only fails under contention, which can't be arranged
+ * reliably, so drive the exchangers directly.  With nobody to meet,
+ * a push takes its node back.  A pusher that only eliminates and a
+ * popper that only eliminates hand every value across exactly once,
+ * in order, without touching the stack itself.
+ */
+void test_elimination() {
+  gc_ptr<holder> h = make_gc<holder>();
+  stack_type &s = h->stack;
+  assert(exchangers::eliminate_pop(s) == nullptr);
+  gc_ptr<node_type> alone = make_gc<node_type>(42);
+  assert(!exchangers::eliminate_push(s, alone));
+  assert(exchangers::eliminate_pop(s) == nullptr);
+  assert(s.empty());
+
+  const size_t n = 500;
+  vector<size_t> received;
+  thread popper([&] {
+      initialize_thread();
+      while (received.size() < n) {
+        gc_ptr<node_type> got;
+        for (unsigned tries = 0; got == nullptr && tries < 64; tries++) {
+          got = exchangers::eliminate_pop(s);
+        }
+        if (got == nullptr) {
+          this_thread::yield();
+        } else {
+          received.push_back(got->value);
+        }
+      }
+    });
+  thread pusher([&] {
+      initialize_thread();
+      for (size_t i = 0; i < n; i++) {
+        gc_ptr<node_type> node = make_gc<node_type>(i);
+        while (!exchangers::eliminate_push(s, node)) {
+        }
+      }
+    });
+  pusher.join();
+  popper.join();
+  for (size_t i = 0; i < n; i++) {
+    assert(received[i] == i);
+  }
+  assert(exchangers::eliminate_pop(s) == nullptr);
+  assert(s.empty());
+  cout << n << " values handed across the exchangers" << endl;
+}
+
+int main() {
+  test_batches();
+  test_elimination();
+  test_concurrent();
+}
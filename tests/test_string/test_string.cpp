@@ -30,6 +30,132 @@
 using namespace mpgc;
 using namespace std;
 
+/*
+ * Growing a vector either takes the free space right after its rep or
+ * copies the rep.  Either way the elements have to come along.  Which
+ * one happens depends on where the GC is in its cycle and on whether
+ * the rep came out of this thread's free chunks, so the first case
+ * just counts.
+ */
+void test_vector_growth() {
+  const size_t n_tries = 1000;
+  size_t in_place = 0;
+  for (size_t t = 0; t < n_tries; t++) {
+    gc_vector<size_t> v;
+    v.reserve(8);
+    for (size_t i = 0; i < 8; i++) {
+      v.push_back(i);
+    }
+    const size_t *before = &v[0];
+    v.push_back(8);
+    assert(v.size() == 9 && v.capacity() > 8);
+    for (size_t i = 0; i < v.size(); i++) {
+      assert(v[i] == i);
+    }
+    if (&v[0] == before) {
+      in_place++;
+    }
+  }
+  cout << in_place << " of " << n_tries << " vectors grew in place" << endl;
+
+  // Something allocated right after the rep rules out growing in place.
+  gc_vector<size_t> w;
+  w.reserve(8);
+  for (size_t i = 0; i < 8; i++) {
+    w.push_back(i);
+  }
+  const size_t *before = &w[0];
+  gc_array_ptr<size_t> blocker = make_gc_array<size_t>(1);
+  const bool blocked = static_cast<const void*>(blocker.as_bare_pointer())
+    == static_cast<const void*>(before + 8);
+  w.push_back(8);
+  cout << "Grew from 8 to " << w.capacity()
+       << (&w[0] == before ? " in place" : " with a move")
+       << (blocked ? " (blocked)" : "") << endl;
+  assert(!blocked || &w[0] != before);
+  for (size_t i = 0; i < w.size(); i++) {
+    assert(w[i] == i);
+  }
+}
+
+/*
+ * Strings of up to small_capacity characters are kept inside the
+ * string object, and longer ones in a heap rep.
+ */
+template <typename S>
+bool is_inline(const S &s) {
+  const char *p = s.data();
+  const char *obj = reinterpret_cast<const char *>(&s);
+  return p >= obj && p < obj+sizeof(S);
+}
+
+template <typename S>
+void check(const S &s, const string &expected) {
+  assert(s.size() == static_cast<long>(expected.size()));
+  assert(string(s.data(), s.size()) == expected);
+  assert(s.c_str()[s.size()] == '\0');
+  assert(is_inline(s) == (s.capacity() == S::small_capacity));
+}
+
+void test_short_strings() {
+  const long cap = gc_string::small_capacity;
+  assert(cap == 15);
+
+  string expected;
+  gc_string s;
+  check(s, expected);
+  for (long i = 0; i < cap; i++) {
+    s.push_back('a'+i);
+    expected.push_back('a'+i);
+    check(s, expected);
+    assert(is_inline(s));
+  }
+  s.push_back('z');
+  expected.push_back('z');
+  check(s, expected);
+  assert(!is_inline(s));
+  s.pop_back();
+  expected.pop_back();
+  check(s, expected);
+  assert(!is_inline(s));
+  s.shrink_to_fit();
+  check(s, expected);
+  assert(is_inline(s));
+  s.erase(3, 4);
+  expected.erase(3, 4);
+  check(s, expected);
+  s.resize(cap, 'x');
+  expected.resize(cap, 'x');
+  check(s, expected);
+  assert(is_inline(s));
+
+  // Inserting a string into itself, both staying inline and spilling.
+  gc_string a = "abcde";
+  string ea = "abcde";
+  a.insert(a.cbegin()+2, a.cbegin(), a.cend());
+  ea.insert(ea.begin()+2, ea.begin(), ea.end());
+  check(a, ea);
+  assert(is_inline(a));
+  a.insert(a.cbegin()+1, a.cbegin(), a.cend());
+  ea.insert(ea.begin()+1, ea.begin(), ea.end());
+  check(a, ea);
+  assert(!is_inline(a));
+
+  // Moves between pointer categories, short and long.
+  for (const string &text : {string{"short"}, string{"a string that is too long to be inline"}}) {
+    gc_string from{text.data(), static_cast<long>(text.size())};
+    external_gc_string to = std::move(from);
+    check(to, text);
+    check(from, "");
+    gc_string back;
+    back = std::move(to);
+    check(back, text);
+    check(to, "");
+  }
+  cout << "Short strings stay inline up to " << cap << " chars in "
+       << sizeof(gc_string) << " bytes" << endl;
+}
+
 int main() {
   gc_string s1 = "Hi";
   cout << s1 << endl;
@@ -57,7 +183,9 @@ int main() {
   s2 = std::move(e2);
   cout << "'" << e2 << "'" << endl;
   cout << "'" << s2 << "'" << endl;
-  
+
+  test_vector_growth();
+  test_short_strings();
 }
 
 namespace test_gc {
@@ -0,0 +1,189 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+/*
+ * bitmap-bench.cpp
+ *
+ * Compares the separate and interleaved mark bitmap layouts on a
+ * synthetic heap: marking a shuffled set of live objects (as a trace
+ * would), scanning for free runs (as sweep does) and clearing. The
+ * bitmaps are taken from the control heap, so the heaps must exist (see
+ * createheap), but nothing is allocated in the GC heap itself.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <getopt.h>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "mpgc/gc.h"
+
+using namespace std;
+
+const size_t _DEFAULT_HEAP_MB = 1024,
+             _DEFAULT_MAX_OBJ_WORDS = 16,
+             _DEFAULT_ITERS = 5;
+const double _DEFAULT_LIVE_RATIO = 0.5;
+
+using object_list = vector<pair<size_t, size_t>>;
+
+void show_usage() {
+   cerr << "usage: ./bitmap-bench [options]\n\n"
+        << "Times marking, sweep scanning and clearing with each mark bitmap layout.\n\n"
+        << "Options:\n"
+        << "-s, --heap-size <MB>\t Size of the simulated GC heap. Default: " << _DEFAULT_HEAP_MB << "\n"
+        << "-o, --max-obj <words>\t Largest object, in words. Default: " << _DEFAULT_MAX_OBJ_WORDS << "\n"
+        << "-l, --live <ratio>\t Fraction of objects that are live. Default: " << _DEFAULT_LIVE_RATIO << "\n"
+        << "-i, --iters <n>\t\t Runs per layout. Default: " << _DEFAULT_ITERS << "\n"
+        << "-h, --help\t\t Display this message.\n";
+}
+
+object_list make_live_objects(size_t heap_words, size_t max_obj, double live, mt19937 &rand) {
+  uniform_int_distribution<size_t> size_dist(2, max_obj);
+  bernoulli_distribution live_dist(live);
+  object_list objs;
+  // Word 0 is where the control block goes.
+  size_t w = 1;
+  while (true) {
+    const size_t n = size_dist(rand);
+    if (w + n > heap_words) {
+      break;
+    }
+    if (live_dist(rand)) {
+      objs.emplace_back(w, w + n - 1);
+    }
+    w += n;
+  }
+  shuffle(objs.begin(), objs.end(), rand);
+  return objs;
+}
+
+template <typename Fn>
+double time_ms(Fn &&fn) {
+  auto start = chrono::steady_clock::now();
+  fn();
+  return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+template <typename Layout>
+void run(const char *name, size_t heap_size, const object_list &objs, size_t iters) {
+  using bitmap_type = mpgc::basic_mark_bitmap<Layout>;
+  const size_t heap_words = heap_size >> 3;
+  bitmap_type *bitmap = ruts::managed_space::create<bitmap_type>(heap_size);
+  double mark = 0, sweep = 0, clear = 0;
+  size_t free_runs = 0;
+
+  for (size_t i = 0; i < iters; i++) {
+    mark += time_ms([&] {
+      for (const auto &o : objs) {
+        bitmap->mark_end_first(o.first, o.second);
+      }
+    });
+    sweep += time_ms([&] {
+      free_runs = 0;
+      size_t used = 0;
+      while (used < heap_words) {
+        bool found_set_bit = false;
+        const size_t free = bitmap->find_next_free_word(used, heap_words, found_set_bit);
+        if (free >= heap_words) {
+          break;
+        }
+        used = bitmap->find_next_used_word(free, heap_words);
+        free_runs++;
+      }
+    });
+    clear += time_ms([&] {
+      bitmap->clear();
+    });
+  }
+  ruts::managed_space::destroy(bitmap);
+
+  cout << name << ":\tmark " << mark / iters << " ms"
+       << "\tsweep " << sweep / iters << " ms"
+       << "\tclear " << clear / iters << " ms"
+       << "\t(" << free_runs << " free runs)" << endl;
+}
+
+int main(int argc, char **argv) {
+  struct option long_options[] = {
+           {"help",       no_argument,       0, 'h'},
+           {"heap-size",  required_argument, 0, 's'},
+           {"max-obj",    required_argument, 0, 'o'},
+           {"live",       required_argument, 0, 'l'},
+           {"iters",      required_argument, 0, 'i'},
+           {0,            0,                 0,  0 }
+    };
+
+  size_t heap_mb = _DEFAULT_HEAP_MB;
+  size_t max_obj = _DEFAULT_MAX_OBJ_WORDS;
+  size_t iters = _DEFAULT_ITERS;
+  double live = _DEFAULT_LIVE_RATIO;
+
+  while (true) {
+    int c = getopt_long(argc, argv, "hs:o:l:i:", long_options, nullptr);
+
+    if (c == -1) {
+      break;
+    }
+
+    switch (c) {
+    case 's':
+      heap_mb = stoul(optarg);
+      break;
+    case 'o':
+      max_obj = max<size_t>(2, stoul(optarg));
+      break;
+    case 'l':
+      live = stod(optarg);
+      break;
+    case 'i':
+      iters = max<size_t>(1, stoul(optarg));
+      break;
+    case 'h':
+      show_usage();
+      return 0;
+    default:
+      show_usage();
+      return 1;
+    }
+  }
+
+  mpgc::initialize();
+
+  const size_t heap_size = heap_mb << 20;
+  mt19937 rand(12345);
+  const object_list objs = make_live_objects(heap_size >> 3, max_obj, live, rand);
+  cout << objs.size() << " live objects in a " << heap_mb << "MB heap" << endl;
+
+  run<mpgc::separate_bitmap_layout>("separate", heap_size, objs, iters);
+  run<mpgc::interleaved_bitmap_layout>("interleaved", heap_size, objs, iters);
+  return 0;
+}